@@ -0,0 +1,160 @@
+/*
+  CouplerEngine Library - Declaration and implementation
+
+  Organ couplers on whole keyboards at a time.  Each division (a manual or
+  the pedalboard) has a 64 bit word with one bit per key; the keys that
+  sound on a division are its own word ORed with the shifted words of the
+  divisions coupled to it, and what has to be sent is the difference from
+  what sounded before.  A coupler costs a shift and an OR of one word per
+  update, whatever the number of keys held, and a note that two sources
+  ask for sounds once: a key held on the swell and the same key on the
+  great with Swell to Great drawn is one note-on and, when the last of
+  them is let go, one note-off.
+
+  . A coupler is a row of a table in flash: the division whose keys are
+    taken, the division they sound on and the shift in keys.  Swell to
+    Great, the swell's stops played from the great's keys, goes from the
+    great to the swell.  The shift is the interval (12 for an octave
+    coupler, 0 for unison) plus the difference of the two divisions'
+    first notes, so Great to Pedal with the pedals starting an octave
+    below the great is a shift of -12.
+  . Couplers act on the keys played, not on what other couplers add, as
+    on most consoles.  Keys shifted off either end of the word are lost,
+    like the top octave of a super octave coupler without extended
+    chests.
+  . Which couplers are drawn is a mask, bit n for row n, so a stop
+    combination is one byte.
+  . DIVISIONS is a template parameter, so the state is 24 bytes a
+    division and nothing more.
+
+  This file is in the public domain.
+*/
+
+#ifndef COUPLER_ENGINE_H
+#define COUPLER_ENGINE_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+// one coupler, in flash
+struct Coupler
+{
+  // division whose keys are taken
+  uint8_t from;
+  // division they sound on
+  uint8_t to;
+  // keys to move them up by, negative for down, less than 64 either way
+  int8_t shift;
+};
+
+template <uint8_t DIVISIONS>
+class CouplerEngine {
+
+public:
+
+  // couplers is a table in flash of count rows, at most 8
+  CouplerEngine(const Coupler *couplers, uint8_t count)
+  {
+    _couplers = couplers;
+    _count = count;
+    _stops = 0;
+    for (uint8_t d = 0; d < DIVISIONS; d++)
+    {
+      _keys[d] = 0;
+      _sounding[d] = 0;
+      _changed[d] = 0;
+    }
+  }
+
+  // The couplers drawn, bit n for row n of the table.
+  // Takes effect on the next update().
+  void setStops(uint8_t stops)
+  {
+    _stops = stops;
+  }
+
+  uint8_t stops()
+  {
+    return _stops;
+  }
+
+  // A key of a division went down or up.
+  void setKey(uint8_t division, uint8_t key, bool down)
+  {
+    uint64_t bit = (uint64_t)1 << key;
+    if (down)
+    {
+      _keys[division] |= bit;
+    }
+    else
+    {
+      _keys[division] &= ~bit;
+    }
+  }
+
+  uint64_t keys(uint8_t division)
+  {
+    return _keys[division];
+  }
+
+  // Works out what sounds on every division now and what changed since
+  // the last call.
+  void update()
+  {
+    uint64_t next[DIVISIONS];
+
+    for (uint8_t d = 0; d < DIVISIONS; d++)
+    {
+      next[d] = _keys[d];
+    }
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      if (!(_stops & (1 << i)))
+      {
+        continue;
+      }
+      uint8_t from = pgm_read_byte(&_couplers[i].from);
+      uint8_t to = pgm_read_byte(&_couplers[i].to);
+      int8_t shift = (int8_t)pgm_read_byte(&_couplers[i].shift);
+      if (shift >= 0)
+      {
+        next[to] |= _keys[from] << shift;
+      }
+      else
+      {
+        next[to] |= _keys[from] >> -shift;
+      }
+    }
+    for (uint8_t d = 0; d < DIVISIONS; d++)
+    {
+      _changed[d] = next[d] ^ _sounding[d];
+      _sounding[d] = next[d];
+    }
+  }
+
+  // What sounds on a division, bit n for its key n, as of the last update().
+  uint64_t sounding(uint8_t division)
+  {
+    return _sounding[division];
+  }
+
+  // The keys of a division that started or stopped sounding at the last
+  // update(); the ones still in sounding() need a note-on, the others a
+  // note-off.
+  uint64_t changed(uint8_t division)
+  {
+    return _changed[division];
+  }
+
+private:
+
+  const Coupler *_couplers;
+  uint8_t _count;
+  uint8_t _stops;
+
+  uint64_t _keys[DIVISIONS];
+  uint64_t _sounding[DIVISIONS];
+  uint64_t _changed[DIVISIONS];
+};
+
+#endif // COUPLER_ENGINE_H
@@ -13,6 +13,51 @@
       to the synth; it may be used alone, or in combination with existing
       library functions (use of fluxWrite must leave the synth capable of
       accepting library commands after, however).
+    . transmitThrough(tx) sends the bytes on pin 4 through a transmitter
+      the sketch declares instead of NewSoftSerial, e.g. a TimerSerialTx
+      from the library of that name: buffered and sent bit by bit from the
+      Timer2 interrupt, so noteOn() and friends return right away.  The
+      library only knows it as a FluxamasynthTransmitter, so a sketch that
+      does not include TimerSerialTx.h does not compile its buffer or
+      take Timer2's interrupt.
+    . setRunningStatus(1) leaves out a channel status byte that is the
+      same as the last one sent (MIDI running status), and sends note-off
+      as note-on with velocity 0, so a chord takes 2 bytes per note.  The
+      status byte is sent again at least every
+      FLUXAMASYNTH_STATUS_REFRESH_MS, in case the synth missed it.
+    . setPriorityScheduling(1) holds controller, NRPN and SysEx messages
+      back until update() finds the line idle, so notes never wait behind
+      more than one of them.  A newer value for a parameter that is still
+      held back replaces the old one.
+    . setNrpnCaching(1) remembers the NRPN each channel has selected, and
+      when the next NRPN call is for the same parameter only sends the
+      data entry (06h vv), 2 or 3 bytes instead of 7.
+    . passThrough(...) sends a whole message from another source, such as
+      a MIDI in port, right away.  It takes part in running status, and a
+      parameter select, controller reset, SysEx or reset in it makes the
+      NRPN cache forget what it no longer knows.  Anything but a note
+      first lets out what priority scheduling holds back, so parameter
+      changes reach the synth in the order they were made.
+    . mirrorTo(sink) sends every byte that goes to the synth to a second
+      output too, e.g. Serial for recording on a computer, as it is sent:
+      nothing is copied or queued in between.  The sink's type is a
+      template parameter, so only the sinks a sketch hands in are compiled.
+    . setPolyphony(n) keeps count of the notes sounding, in a bitmap per
+      channel and a list in the order they started, and lets at most n
+      sound at once: a note-on past the budget first ends the oldest note
+      (or the quietest, with setVoiceStealing(STEAL_QUIETEST)) with a
+      note-off, instead of leaving the synth to steal one unseen.  The
+      note-off of a stolen note is not sent again.  The bitmaps and the
+      list are a FluxamasynthVoices the sketch declares and hands in with
+      trackVoices(), 355 bytes of RAM, so a sketch that does not count its
+      notes does not pay for them.
+    . reconcileNotes(channel, held) ends the notes the bitmap has sounding
+      on a channel that held (16 bytes, one bit per note) does not ask
+      for, with a note-off each: a stuck note guard for a sketch that knows
+      which keys are down.  Notes that came in through passThrough() are
+      left alone, they are not the keys' to end; they are found in the
+      list of notes sounding, so the work grows with the notes sounding,
+      up to FLUXAMASYNTH_MAX_VOICES.
     -------------------------------------
     This software is in the public domain.
     Modified 4/2011 R.McGinnis
@@ -22,27 +67,93 @@
 #include "Fluxamasynth.h"
 #include "NewSoftSerial.h"
 
+FluxamasynthVoices::FluxamasynthVoices() {
+    count = 0;                                                   // trackVoices() clears the bitmaps
+}
+
 Fluxamasynth::Fluxamasynth() : synth(255, 4) {                   // 255 -> do not use rx; pin 4 for tx
+    transmitter = 0;
+    runningStatus = 0;
+    lastStatus = 0;
+    scheduling = 0;
+    sendingDeferred = 0;
+    deferredCount = 0;
+    nrpnCaching = 0;
+    forgetNrpns();
+    mirror = 0;
+    polyphony = 0;
+    stealing = STEAL_OLDEST;
+    tracker = 0;
     synthInitialized = 0;                                        // Initialization needs to be done
 }
 
 Fluxamasynth::Fluxamasynth(byte rxPin, byte txPin) : synth(rxPin, txPin) {
+    transmitter = 0;
+    runningStatus = 0;
+    lastStatus = 0;
+    scheduling = 0;
+    sendingDeferred = 0;
+    deferredCount = 0;
+    nrpnCaching = 0;
+    forgetNrpns();
+    mirror = 0;
+    polyphony = 0;
+    stealing = STEAL_OLDEST;
+    tracker = 0;
     synthInitialized = 0;                                        // Initialization needs to be done
 }
 
 void Fluxamasynth::begin() {
     if (!(this->synthInitialized)){
-      this->synth.begin(31250);		                         // Set MIDI baud rate
+      if (this->transmitter) {
+        this->transmitter->begin(4, 31250);
+      } else {
+        this->synth.begin(31250);		                 // Set MIDI baud rate
+      }
       delay(2);                                                  // let the port settle
       this->synthInitialized = -1;                               // Initialization has been done
     }
 }
 
+size_t Fluxamasynth::transmit(byte c) {
+    size_t sent;
+
+    // the copy first: an interrupt that comes in between may hold it up,
+    // and it must not start after the synth has the byte
+    if (this->mirror) {
+        this->mirrorWrite(this->mirror, c);
+    }
+    if (this->transmitter) {
+        sent = this->transmitter->write(c);
+    } else {
+        sent = this->synth.write(c);
+    }
+    return sent;
+}
+
+// with running status on, leave out a channel status byte the synth already has
+size_t Fluxamasynth::encode(byte c) {
+    if (this->runningStatus && (c & 0x80)) {
+        if (c < 0xf0) {
+            unsigned long now = millis();
+            if (c == this->lastStatus && now - this->lastStatusTime < FLUXAMASYNTH_STATUS_REFRESH_MS) {
+                return 1;
+            }
+            this->lastStatus = c;
+            this->lastStatusTime = now;
+        } else if (c < 0xf8 || c == 0xff) {
+            // system exclusive, system common and reset cancel running status
+            this->lastStatus = 0;
+        }
+    }
+    return this->transmit(c);
+}
+
  size_t Fluxamasynth::fluxWrite(byte c) {
     if (!(this->synthInitialized)){
         this->begin();
     }
-    this->synth.write(c);
+    return this->encode(c);
 }
 
  size_t Fluxamasynth::fluxWrite(byte *buf, int cnt) {
@@ -52,21 +163,346 @@ void Fluxamasynth::begin() {
         this->begin();
     }
     for (i=0; i<cnt; i++) {
-        this->synth.write(buf[i]);
+        this->encode(buf[i]);
     }
+    return cnt;
+}
+
+void Fluxamasynth::passThrough(const byte *message, byte length) {
+    byte status = message[0];
+    byte i;
+
+    if ((status & 0xf0) == 0xb0 && length == 3) {
+        byte number = message[1];
+        // NRPN or RPN select, or reset all controllers, which deselects both
+        if ((number >= 0x62 && number <= 0x65) || number == 0x79) {
+            this->nrpnMsb[status & 0x0f] = 0xff;
+            this->nrpnLsb[status & 0x0f] = 0xff;
+        }
+        if (number == 0x78 || number == 0x7b) {                  // all sound off, all notes off
+            this->forgetVoices(status & 0x0f);
+        }
+    } else if (status == 0xf0 || status == 0xff) {
+        this->forgetNrpns();                                     // a GS or GM reset looks like any other SysEx
+        if (status == 0xff) {
+            this->forgetVoices(0xff);
+        }
+    } else if (this->polyphony && (status & 0xe0) == 0x80 && length == 3) {
+        // notes from elsewhere count against the same budget, and go out as they came
+        if ((status & 0xf0) == 0x90 && message[2]) {
+            this->startVoice(status & 0x0f, message[1] & 0x7f, message[2] | FluxamasynthVoices::PASSED_THROUGH);
+        } else if (!this->endVoice(status & 0x0f, message[1] & 0x7f)) {
+            return;
+        }
+    }
+    if ((status & 0xe0) != 0x80) {
+        while (this->deferredCount) {                            // an older value must not land after this one
+            this->sendDeferred();
+        }
+    }
+    if (!this->synthInitialized){
+        this->begin();
+    }
+    for (i = 0; i < length; i++) {
+        this->encode(message[i]);
+    }
+}
+
+void Fluxamasynth::setRunningStatus(byte enable) {
+    this->runningStatus = enable;
+    this->lastStatus = 0;                                        // start over with a full status byte
+}
+
+void Fluxamasynth::setPriorityScheduling(byte enable) {
+    this->scheduling = enable;
+    while (!enable && this->deferredCount) {                     // whatever is held back goes out now
+        this->sendDeferred();
+    }
+}
+
+// hold a library call back for update(), or replace the arguments of the same
+// call that is still waiting; returns 0 if the call has to be sent right away
+byte Fluxamasynth::defer(byte kind, byte channel, byte v0, byte v1, byte v2, byte v3) {
+    byte i;
+
+    if (!this->scheduling || this->sendingDeferred) {
+        return 0;
+    }
+    for (i = 0; i < this->deferredCount; i++) {
+        Deferred &d = this->deferred[i];
+        // the special synth controls are told apart by their first parameter
+        if (d.kind == kind && d.channel == channel && (kind != SPECIAL_SYNTH_CONTROL || d.value[0] == v0)) {
+            break;
+        }
+    }
+    if (i == this->deferredCount) {
+        if (this->deferredCount == FLUXAMASYNTH_DEFERRED_SIZE) {
+            this->sendDeferred();                                // make room, the oldest goes out now
+        }
+        i = this->deferredCount++;
+        this->deferred[i].kind = kind;
+        this->deferred[i].channel = channel;
+    }
+    this->deferred[i].value[0] = v0;
+    this->deferred[i].value[1] = v1;
+    this->deferred[i].value[2] = v2;
+    this->deferred[i].value[3] = v3;
+    return 1;
+}
+
+// make the oldest held back call
+void Fluxamasynth::sendDeferred() {
+    byte i;
+    Deferred d = this->deferred[0];
+
+    this->deferredCount--;
+    for (i = 0; i < this->deferredCount; i++) {
+        this->deferred[i] = this->deferred[i + 1];
+    }
+    this->sendingDeferred = 1;
+    switch (d.kind) {
+      case PROGRAM_CHANGE: this->programChange(d.value[0], d.channel, d.value[1]); break;
+      case PITCH_BEND: this->pitchBend(d.channel, d.value[0] | (d.value[1] << 8)); break;
+      case PITCH_BEND_RANGE: this->pitchBendRange(d.channel, d.value[0]); break;
+      case CHANNEL_VOLUME: this->setChannelVolume(d.channel, d.value[0]); break;
+      case MASTER_VOLUME: this->setMasterVolume(d.value[0]); break;
+      case REVERB: this->setReverb(d.channel, d.value[0], d.value[1], d.value[2]); break;
+      case CHORUS: this->setChorus(d.channel, d.value[0], d.value[1], d.value[2], d.value[3]); break;
+      case TVF_RESONANCE: this->setTVFResonance(d.channel, d.value[0]); break;
+      case TVF_CUTOFF: this->setTVFCutoff(d.channel, d.value[0]); break;
+      case ENV_ATTACK: this->setEnvAttack(d.channel, d.value[0]); break;
+      case MASTER_PAN: this->setMasterPan(d.value[0], d.value[1]); break;
+      case PORTAMENTO: this->setPortamento(d.channel, d.value[0]); break;
+      case SPECIAL_SYNTH_CONTROL: this->setSpecialSynthControl(d.channel, d.value[0], d.value[1]); break;
+    }
+    this->sendingDeferred = 0;
+}
+
+void Fluxamasynth::update() {
+    // only onto an idle line, so a note that comes next waits for one message at most
+    if (this->deferredCount && !(this->transmitter && this->transmitter->pending())) {
+        this->sendDeferred();
+    }
+}
+
+void Fluxamasynth::setNrpnCaching(byte enable) {
+    this->nrpnCaching = enable;
+    this->forgetNrpns();                                         // whatever was sent before is not known
+}
+
+void Fluxamasynth::forgetNrpns() {
+    byte i;
+
+    for (i = 0; i < 16; i++) {
+        this->nrpnMsb[i] = 0xff;
+        this->nrpnLsb[i] = 0xff;
+    }
+}
+
+// NRPN data entry; the parameter number is left out if the channel has it selected already
+void Fluxamasynth::nrpn(byte channel, byte msb, byte lsb, byte value) {
+    channel &= 0x0f;
+    if (this->nrpnCaching && this->nrpnMsb[channel] == msb && this->nrpnLsb[channel] == lsb) {
+        // Bnh 06h vv
+        byte command[3] = {0xb0 | channel, 0x06, (value & 0x7f)};
+        this->fluxWrite(command, 3);
+        return;
+    }
+    // Bnh 63h mm 62h ll 06h vv
+    byte command[7] = {0xb0 | channel, 0x63, msb, 0x62, lsb, 0x06, (value & 0x7f)};
+    this->fluxWrite(command, 7);
+    this->nrpnMsb[channel] = msb;
+    this->nrpnLsb[channel] = lsb;
 }
 
 void Fluxamasynth::noteOn(byte channel, byte pitch, byte velocity) {
+    if (this->polyphony) {
+        if (velocity == 0) {
+            this->noteOff(channel, pitch);
+            return;
+        }
+        this->startVoice(channel & 0x0f, pitch & 0x7f, velocity);   // may end another note first
+    }
     byte command[3] = { 0x90 | (channel & 0x0f), pitch, velocity };
     this->fluxWrite(command, 3);
 }
 
 void Fluxamasynth::noteOff(byte channel, byte pitch) {
-    byte command[3] = { 0x80 | (channel & 0x0f), pitch, byte(0x00) };
+    if (this->polyphony && !this->endVoice(channel & 0x0f, pitch & 0x7f)) {
+        return;                                                  // stolen, its note-off has been sent
+    }
+    this->sendNoteOff(channel, pitch);
+}
+
+void Fluxamasynth::sendNoteOff(byte channel, byte pitch) {
+    // as note-on with velocity 0 under running status, so it shares the note-on's status byte
+    byte status = this->runningStatus ? 0x90 : 0x80;
+    byte command[3] = { status | (channel & 0x0f), pitch, byte(0x00) };
     this->fluxWrite(command, 3);
 }
 
+void Fluxamasynth::transmitThrough(FluxamasynthTransmitter &transmitter) {
+    this->transmitter = &transmitter;
+}
+
+void Fluxamasynth::trackVoices(FluxamasynthVoices &voices) {
+    this->polyphony = 0;                                         // the notes in it are not known
+    this->tracker = &voices;
+    this->forgetVoices(0xff);
+}
+
+void Fluxamasynth::setPolyphony(byte voices) {
+    FluxamasynthVoices *tracker = this->tracker;
+
+    if (!tracker) {
+        return;                                                  // nowhere to count them
+    }
+    if (voices > FLUXAMASYNTH_MAX_VOICES) {
+        voices = FLUXAMASYNTH_MAX_VOICES;
+    }
+    if (voices == 0) {
+        this->forgetVoices(0xff);                                // their note-offs go out untracked
+    }
+    while (voices && tracker->count > voices) {                  // a smaller budget takes effect now
+        byte i = this->victim();
+        this->sendNoteOff(tracker->voices[i].channel, tracker->voices[i].note);
+        this->removeVoice(i);
+    }
+    this->polyphony = voices;
+}
+
+void Fluxamasynth::setVoiceStealing(Stealing stealing) {
+    this->stealing = stealing;
+}
+
+byte Fluxamasynth::voicesSounding() {
+    return this->polyphony ? this->tracker->count : 0;
+}
+
+byte Fluxamasynth::reconcileNotes(byte channel, const byte *held) {
+    FluxamasynthVoices *tracker = this->tracker;
+    byte passed[16];
+    byte i;
+    byte stray;
+    byte count = 0;
+
+    if (!this->polyphony) {
+        return 0;                                                // nothing known to compare
+    }
+    channel &= 0x0f;
+    for (i = 0; i < 16; i++) {
+        passed[i] = 0;
+    }
+    for (i = 0; i < tracker->count; i++) {                       // notes from elsewhere are not the keys' to end
+        if (tracker->voices[i].channel == channel && (tracker->voices[i].velocity & FluxamasynthVoices::PASSED_THROUGH)) {
+            passed[tracker->voices[i].note >> 3] |= 1 << (tracker->voices[i].note & 7);
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        stray = tracker->sounding[channel][i] & ~held[i] & ~passed[i];
+        while (stray) {
+            this->noteOff(channel, (i << 3) | __builtin_ctz(stray));
+            stray &= stray - 1;                                  // the lowest note is done
+            count++;
+        }
+    }
+    return count;
+}
+
+// forget the notes of one channel, or of all of them with 0xff, without sending anything
+void Fluxamasynth::forgetVoices(byte channel) {
+    FluxamasynthVoices *tracker = this->tracker;
+    byte i = 0;
+
+    if (!tracker) {
+        return;
+    }
+    if (channel == 0xff) {
+        tracker->count = 0;
+        for (i = 0; i < 16; i++) {
+            for (channel = 0; channel < 16; channel++) {
+                tracker->sounding[i][channel] = 0;
+            }
+        }
+        return;
+    }
+    while (i < tracker->count) {
+        if (tracker->voices[i].channel == channel) {
+            this->removeVoice(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+// count a note in, ending one to make room if the budget is used up
+void Fluxamasynth::startVoice(byte channel, byte note, byte velocity) {
+    FluxamasynthVoices *tracker = this->tracker;
+    byte i;
+
+    if (tracker->sounding[channel][note >> 3] & (1 << (note & 7))) {
+        // struck again: the synth would start a second voice, end the first
+        for (i = 0; tracker->voices[i].channel != channel || tracker->voices[i].note != note; i++) {
+        }
+        this->sendNoteOff(channel, note);
+        this->removeVoice(i);
+    } else if (tracker->count >= this->polyphony) {
+        i = this->victim();
+        this->sendNoteOff(tracker->voices[i].channel, tracker->voices[i].note);
+        this->removeVoice(i);
+    }
+    i = tracker->count++;
+    tracker->voices[i].channel = channel;
+    tracker->voices[i].note = note;
+    tracker->voices[i].velocity = velocity;
+    tracker->sounding[channel][note >> 3] |= 1 << (note & 7);
+}
+
+// count a note out; returns 0 if it was not sounding
+byte Fluxamasynth::endVoice(byte channel, byte note) {
+    FluxamasynthVoices *tracker = this->tracker;
+    byte i;
+
+    if (!(tracker->sounding[channel][note >> 3] & (1 << (note & 7)))) {
+        return 0;
+    }
+    for (i = 0; tracker->voices[i].channel != channel || tracker->voices[i].note != note; i++) {
+    }
+    this->removeVoice(i);
+    return 1;
+}
+
+void Fluxamasynth::removeVoice(byte i) {
+    FluxamasynthVoices *tracker = this->tracker;
+    FluxamasynthVoices::Voice v = tracker->voices[i];
+
+    tracker->sounding[v.channel][v.note >> 3] &= ~(1 << (v.note & 7));
+    tracker->count--;
+    for (; i < tracker->count; i++) {                            // keep the rest oldest first
+        tracker->voices[i] = tracker->voices[i + 1];
+    }
+}
+
+// the note to end: the oldest, or the quietest and the oldest of those
+byte Fluxamasynth::victim() {
+    FluxamasynthVoices *tracker = this->tracker;
+    byte i;
+    byte quietest = 0;
+
+    if (this->stealing == STEAL_QUIETEST) {
+        for (i = 1; i < tracker->count; i++) {
+            if ((tracker->voices[i].velocity & 0x7f) < (tracker->voices[quietest].velocity & 0x7f)) {
+                quietest = i;
+            }
+        }
+    }
+    return quietest;
+}
+
 void Fluxamasynth::programChange(byte bank, byte channel, byte v) {
+    if (this->defer(PROGRAM_CHANGE, channel, bank, v)) {
+        return;
+    }
     // bank is either 0 or 127
     byte command[3] = { 0xB0 | (channel & 0x0f), byte(0x00), bank };
     this->fluxWrite(command, 3);
@@ -75,6 +511,9 @@ void Fluxamasynth::programChange(byte bank, byte channel, byte v) {
 }
 
 void Fluxamasynth::pitchBend(byte channel, int v) {
+    if (this->defer(PITCH_BEND, channel, v & 0xff, v >> 8)) {
+        return;
+    }
     // v is a value from 0 to 1023
     // it is mapped to the full range 0 to 0x3fff
     v = map(v, 0, 1023, 0, 0x3fff);
@@ -83,34 +522,51 @@ void Fluxamasynth::pitchBend(byte channel, int v) {
 }
 
 void Fluxamasynth::pitchBendRange(byte channel, byte v) {
+    if (this->defer(PITCH_BEND_RANGE, channel, v)) {
+        return;
+    }
     // Also called pitch bend sensitivity
     //BnH 65H 00H 64H 00H 06H vv
     byte command[7] = {0xb0 | (channel & 0x0f), 0x65, 0x00, 0x64, 0x00, 0x06, (v & 0x7f)};
     this->fluxWrite(command, 7);
+    this->nrpnMsb[channel & 0x0f] = 0xff;                        // an RPN is selected now
 }
 
 void Fluxamasynth::midiReset() {
+    this->deferredCount = 0;                                     // the reset wipes what they would have set
+    this->forgetNrpns();
+    this->forgetVoices(0xff);                                    // and ends every note
     this->fluxWrite(0xff);
 }
 
 void Fluxamasynth::setChannelVolume(byte channel, byte level) {
+    if (this->defer(CHANNEL_VOLUME, channel, level)) {
+        return;
+    }
     byte command[3] = { (0xb0 | (channel & 0x0f)), 0x07, level };
     this->fluxWrite(command, 3);
 }
 
 void Fluxamasynth::allNotesOff(byte channel) {
+    this->forgetVoices(channel & 0x0f);
     // BnH 7BH 00H
     byte command[3] = { (0xb0 | (channel & 0x0f)), 0x7b, 0x00 };
     this->fluxWrite(command, 3);
 }
 
 void Fluxamasynth::setMasterVolume(byte level) {
+    if (this->defer(MASTER_VOLUME, 0, level)) {
+        return;
+    }
     //F0H 7FH 7FH 04H 01H 00H ll F7H
     byte command[8] = { 0xf0, 0x7f, 0x7f, 0x04, 0x01, 0x00, (level & 0x7f), 0xf7 };
     this->fluxWrite(command, 8);
 }
 
 void Fluxamasynth::setReverb(byte channel, byte program, byte level, byte delayFeedback) {
+    if (this->defer(REVERB, channel, program, level, delayFeedback)) {
+        return;
+    }
     // Program 
     // 0: Room1   1: Room2    2: Room3 
     // 3: Hall1   4: Hall2    5: Plate
@@ -132,6 +588,9 @@ void Fluxamasynth::setReverb(byte channel, byte program, byte level, byte delayF
 }
 
 void Fluxamasynth::setChorus(byte channel, byte program, byte level, byte feedback, byte chorusDelay) {
+    if (this->defer(CHORUS, channel, program, level, feedback, chorusDelay)) {
+        return;
+    }
     // Program 
     // 0: Chorus1   1: Chorus2    2: Chorus3 
     // 3: Chorus4   4: Feedback   5: Flanger
@@ -159,40 +618,54 @@ void Fluxamasynth::setChorus(byte channel, byte program, byte level, byte feedba
 }
 
 void Fluxamasynth::setTVFResonance(byte channel, byte resonance) {
+    if (this->defer(TVF_RESONANCE, channel, resonance)) {
+        return;
+    }
     // 0h - max reduce, 40h - no change, 7fh - max increase
     // Bnh 63h 01h 62h 21h 06h vv
-    byte command[7] = {0xb0 | (channel & 0x0f), 0x63, 0x01, 0x62, 0x21, 0x06, (resonance & 0x7f)};
-    this->fluxWrite(command, 7);
+    this->nrpn(channel, 0x01, 0x21, resonance);
 }
 
 void Fluxamasynth::setTVFCutoff(byte channel, byte cutoff) {
+    if (this->defer(TVF_CUTOFF, channel, cutoff)) {
+        return;
+    }
     // 0h - max reduce, 40h - no change, 7fh - max increase
-    // Bnh 63h 01h 62h 21h 06h vv
-    byte command[7] = {0xb0 | (channel & 0x0f), 0x63, 0x01, 0x62, 0x20, 0x06, (cutoff & 0x7f)};
-    this->fluxWrite(command, 7);
+    // Bnh 63h 01h 62h 20h 06h vv
+    this->nrpn(channel, 0x01, 0x20, cutoff);
 }
 
 void Fluxamasynth::setEnvAttack(byte channel, byte attack) {
+    if (this->defer(ENV_ATTACK, channel, attack)) {
+        return;
+    }
 	// bnh 63h 01h 62h 63h 06h vv
-	byte command[7] = {0xb0 | (channel & 0x0f), 0x63, 0x01, 0x62, 0x63, 0x06, (attack & 0x7f)};
-    this->fluxWrite(command, 7);
+	this->nrpn(channel, 0x01, 0x63, attack);
 }
 
 void Fluxamasynth::setMasterPan(byte pan1, byte pan2) {
+    if (this->defer(MASTER_PAN, 0, pan1, pan2)) {
+        return;
+    }
     // f0h 41h 00h 42h 12h 40h 00h 06h vv xx f7h
     byte command[11] = { 0xf0, 0x41, 0x00, 0x42, 0x12, 0x40, 0x00, 0x06, (pan1 & 0x7f), (pan2 & 0x7f), 0xf7 };
     this->fluxWrite(command, 11);
 }
 
 void Fluxamasynth::setPortamento(byte channel, byte enable) {
+    if (this->defer(PORTAMENTO, channel, enable)) {
+        return;
+    }
 	// bnh 41h cc
 	byte command[3] = {0xb0 | (channel & 0x0f), 0x41, enable};
 	this->fluxWrite(command, 3);
 }
 
 void Fluxamasynth::setSpecialSynthControl(byte channel, byte p1, byte p2) {
+    if (this->defer(SPECIAL_SYNTH_CONTROL, channel, p1, p2)) {
+        return;
+    }
 	// bnh 63h 37h 62h xx 06h vv
-	byte command[7] = {0xb0 | (channel & 0x0f), 0x63, 0x37, 0x62, (p1 & 0x7f), 0x06, (p2 & 0x7f)};
-	this->fluxWrite(command, 7);
+	this->nrpn(channel, 0x37, p1 & 0x7f, p2);
 }
 
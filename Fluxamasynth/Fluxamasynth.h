@@ -13,6 +13,51 @@
       to the synth; it may be used alone, or in combination with existing
       library functions (use of fluxWrite must leave the synth capable of
       accepting library commands after, however).
+    . transmitThrough(tx) sends the bytes on pin 4 through a transmitter
+      the sketch declares instead of NewSoftSerial, e.g. a TimerSerialTx
+      from the library of that name: buffered and sent bit by bit from the
+      Timer2 interrupt, so noteOn() and friends return right away.  The
+      library only knows it as a FluxamasynthTransmitter, so a sketch that
+      does not include TimerSerialTx.h does not compile its buffer or
+      take Timer2's interrupt.
+    . setRunningStatus(1) leaves out a channel status byte that is the
+      same as the last one sent (MIDI running status), and sends note-off
+      as note-on with velocity 0, so a chord takes 2 bytes per note.  The
+      status byte is sent again at least every
+      FLUXAMASYNTH_STATUS_REFRESH_MS, in case the synth missed it.
+    . setPriorityScheduling(1) holds controller, NRPN and SysEx messages
+      back until update() finds the line idle, so notes never wait behind
+      more than one of them.  A newer value for a parameter that is still
+      held back replaces the old one.
+    . setNrpnCaching(1) remembers the NRPN each channel has selected, and
+      when the next NRPN call is for the same parameter only sends the
+      data entry (06h vv), 2 or 3 bytes instead of 7.
+    . passThrough(...) sends a whole message from another source, such as
+      a MIDI in port, right away.  It takes part in running status, and a
+      parameter select, controller reset, SysEx or reset in it makes the
+      NRPN cache forget what it no longer knows.  Anything but a note
+      first lets out what priority scheduling holds back, so parameter
+      changes reach the synth in the order they were made.
+    . mirrorTo(sink) sends every byte that goes to the synth to a second
+      output too, e.g. Serial for recording on a computer, as it is sent:
+      nothing is copied or queued in between.  The sink's type is a
+      template parameter, so only the sinks a sketch hands in are compiled.
+    . setPolyphony(n) keeps count of the notes sounding, in a bitmap per
+      channel and a list in the order they started, and lets at most n
+      sound at once: a note-on past the budget first ends the oldest note
+      (or the quietest, with setVoiceStealing(STEAL_QUIETEST)) with a
+      note-off, instead of leaving the synth to steal one unseen.  The
+      note-off of a stolen note is not sent again.  The bitmaps and the
+      list are a FluxamasynthVoices the sketch declares and hands in with
+      trackVoices(), 355 bytes of RAM, so a sketch that does not count its
+      notes does not pay for them.
+    . reconcileNotes(channel, held) ends the notes the bitmap has sounding
+      on a channel that held (16 bytes, one bit per note) does not ask
+      for, with a note-off each: a stuck note guard for a sketch that knows
+      which keys are down.  Notes that came in through passThrough() are
+      left alone, they are not the keys' to end; they are found in the
+      list of notes sounding, so the work grows with the notes sounding,
+      up to FLUXAMASYNTH_MAX_VOICES.
     -------------------------------------
     This software is in the public domain.
     Modified 4/2011 R.McGinnis
@@ -25,12 +70,92 @@
 #ifndef  Fluxamasynth_h
 #define  Fluxamasynth_h
 
+// with running status on, the longest a status byte is left out for
+#define FLUXAMASYNTH_STATUS_REFRESH_MS 250
+// controller messages held back with priority scheduling on
+#define FLUXAMASYNTH_DEFERRED_SIZE 8
+// most notes setPolyphony() can keep track of
+#define FLUXAMASYNTH_MAX_VOICES 32
+
+// the notes sounding, for Fluxamasynth::setPolyphony(); only the synth uses it
+class FluxamasynthVoices
+{
+  friend class Fluxamasynth;
+  private:
+    // velocity bit of a note from passThrough(), reconcileNotes() leaves it alone
+    static const byte PASSED_THROUGH = 0x80;
+    // one sounding note
+    struct Voice {
+      byte channel;
+      byte note;
+      byte velocity;                                             // | PASSED_THROUGH
+    };
+    byte count;
+    Voice voices[FLUXAMASYNTH_MAX_VOICES];                       // oldest first
+    byte sounding[16][16];                                       // one bit per channel and note
+  public:
+    FluxamasynthVoices();
+};
+
+// sends the bytes to the synth in place of NewSoftSerial, for Fluxamasynth::transmitThrough()
+class FluxamasynthTransmitter : public Print
+{
+  public:
+    virtual void begin(uint8_t txPin, long speed) = 0;
+    // bytes written and not yet out on the line
+    virtual uint8_t pending() = 0;
+};
+
 class Fluxamasynth
 {
+  public:
+    // which note setPolyphony() ends to make room
+    enum Stealing { STEAL_OLDEST, STEAL_QUIETEST };
   private:
+    // the library calls that priority scheduling holds back
+    enum DeferredKind { PROGRAM_CHANGE, PITCH_BEND, PITCH_BEND_RANGE, CHANNEL_VOLUME, MASTER_VOLUME,
+                        REVERB, CHORUS, TVF_RESONANCE, TVF_CUTOFF, ENV_ATTACK, MASTER_PAN, PORTAMENTO,
+                        SPECIAL_SYNTH_CONTROL };
+    // one held back call and its arguments
+    struct Deferred {
+      byte kind;
+      byte channel;
+      byte value[4];
+    };
     NewSoftSerial synth;
+    FluxamasynthTransmitter *transmitter;                        // in place of synth, 0 for none
     byte synthInitialized;
+    byte runningStatus;
+    byte lastStatus;                                             // last channel status sent, 0 for none
+    unsigned long lastStatusTime;                                // millis() when it was sent
+    byte scheduling;
+    byte sendingDeferred;                                        // update() is making a held back call
+    Deferred deferred[FLUXAMASYNTH_DEFERRED_SIZE];               // oldest first
+    byte deferredCount;
+    byte nrpnCaching;
+    byte nrpnMsb[16];                                            // NRPN selected on each channel, 0xff for unknown
+    byte nrpnLsb[16];
+    byte polyphony;                                              // voice budget, 0 for no tracking
+    byte stealing;
+    FluxamasynthVoices *tracker;                                 // the notes sounding, 0 for none
+    void *mirror;                                                // second output for the same bytes, 0 for none
+    void (*mirrorWrite)(void *sink, byte c);
+    template <class Sink> static void writeTo(void *sink, byte c) {
+        static_cast<Sink *>(sink)->write(c);
+    }
     void begin();
+    void nrpn(byte channel, byte msb, byte lsb, byte value);
+    void forgetNrpns();
+    byte defer(byte kind, byte channel, byte v0, byte v1 = 0, byte v2 = 0, byte v3 = 0);
+    void sendDeferred();
+    void forgetVoices(byte channel);
+    void startVoice(byte channel, byte note, byte velocity);
+    byte endVoice(byte channel, byte note);
+    void removeVoice(byte i);
+    byte victim();
+    void sendNoteOff(byte channel, byte pitch);
+    size_t encode(byte c);
+    size_t transmit(byte c);
   public:
     // default constructor sets NewSoftSerial to use pin 4 for tx, and inhibits rx
     Fluxamasynth();
@@ -38,6 +163,35 @@ class Fluxamasynth
     Fluxamasynth(byte rxPin, byte txPin);
     virtual size_t fluxWrite(byte c);
     virtual size_t fluxWrite(byte *buf, int cnt);
+    // a complete message from elsewhere, status byte included
+    void passThrough(const byte *message, byte length);
+    // 1 to use running status and note-on velocity 0 for note-off, 0 (the default) not to
+    void setRunningStatus(byte enable);
+    // 1 to send notes ahead of controller messages, 0 (the default) to send everything in call order
+    void setPriorityScheduling(byte enable);
+    // with priority scheduling on, call often (from loop()); sends a held back message when the line is idle
+    void update();
+    // 1 to leave out NRPN selects the synth already has, 0 (the default) to send them every time
+    void setNrpnCaching(byte enable);
+    // the bytes go out on pin 4 through transmitter instead of NewSoftSerial; before the first message
+    void transmitThrough(FluxamasynthTransmitter &transmitter);
+    // where setPolyphony() keeps the notes sounding; without one it stays off
+    void trackVoices(FluxamasynthVoices &voices);
+    // most notes sounding at once, up to FLUXAMASYNTH_MAX_VOICES, 0 (the default) not to count them;
+    // set it before the first note, notes from before are not known
+    void setPolyphony(byte voices);
+    // STEAL_OLDEST (the default) or STEAL_QUIETEST
+    void setVoiceStealing(Stealing stealing);
+    // notes sounding, with setPolyphony on
+    byte voicesSounding();
+    // note-offs for the notes sounding on channel that held, a bit per note, leaves out;
+    // returns how many were sent, 0 as well with setPolyphony off
+    byte reconcileNotes(byte channel, const byte *held);
+    // every byte from now on also goes to sink, anything with a write(byte), such as Serial
+    template <class Sink> void mirrorTo(Sink &sink) {
+        this->mirrorWrite = &Fluxamasynth::writeTo<Sink>;
+        this->mirror = &sink;
+    }
     void noteOn(byte channel, byte pitch, byte velocity);
     void noteOff(byte channel, byte pitch);
     void programChange (byte bank, byte channel, byte v);
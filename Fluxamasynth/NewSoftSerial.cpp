@@ -36,6 +36,9 @@ http://arduiniana.org.
 #include <avr/pgmspace.h>
 #include "Arduino.h"
 #include "NewSoftSerial.h"
+#if !defined(__AVR__)
+#include "HostSim.h"
+#endif
 //
 // Lookup table
 //
@@ -127,6 +130,7 @@ inline void DebugPulse(uint8_t pin, uint8_t count)
 
 /* static */ 
 inline void NewSoftSerial::tunedDelay(uint16_t delay) { 
+#if defined(__AVR__)
   uint8_t tmp=0;
 
   asm volatile("sbiw    %0, 0x01 \n\t"
@@ -137,6 +141,11 @@ inline void NewSoftSerial::tunedDelay(uint16_t delay) {
     : "+r" (delay), "+a" (tmp)
     : "0" (delay)
     );
+#else
+  // Each pass of the loop above is 7 cycles; the call, pin write and bit
+  // loop around it add about 36 more, which the table values allow for
+  hostSim().advance((uint32_t)delay * 7 + 36);
+#endif
 }
 
 // This function sets the current object as the "active"
@@ -239,15 +248,23 @@ void NewSoftSerial::recv()
 
 void NewSoftSerial::tx_pin_write(uint8_t pin_state)
 {
+#if defined(__AVR__)
  	if (pin_state == LOW) 
     *_transmitPortRegister &= ~_transmitBitMask;
 	else 
     *_transmitPortRegister |= _transmitBitMask;
+#else
+  hostSim().writePin(_transmitPin, pin_state);
+#endif
 }
 
 uint8_t NewSoftSerial::rx_pin_read()
 {
+#if defined(__AVR__)
   return *_receivePortRegister & _receiveBitMask;
+#else
+  return hostSim().readPin(_receivePin);
+#endif
 }
 
 //
@@ -263,6 +280,7 @@ inline void NewSoftSerial::handle_interrupt()
   }
 }
 
+#if defined(__AVR__)
 ISR(PCINT0_vect)
 {
   NewSoftSerial::handle_interrupt();
@@ -277,6 +295,7 @@ ISR(PCINT2_vect)
 {
   NewSoftSerial::handle_interrupt();
 }
+#endif
 
 //
 // Constructor
@@ -299,9 +318,13 @@ void NewSoftSerial::setTX(uint8_t tx)
 {
   pinMode(tx, OUTPUT);
   digitalWrite(tx, HIGH);
+#if defined(__AVR__)
   _transmitBitMask = digitalPinToBitMask(tx);
 	uint8_t port = digitalPinToPort(tx);
   _transmitPortRegister = portOutputRegister(port);
+#else
+  _transmitPin = tx;
+#endif
 }
 
 void NewSoftSerial::setRX(uint8_t rx)
@@ -309,9 +332,11 @@ void NewSoftSerial::setRX(uint8_t rx)
   pinMode(rx, INPUT);
   digitalWrite(rx, HIGH);  // pullup!
   _receivePin = rx;
+#if defined(__AVR__)
   _receiveBitMask = digitalPinToBitMask(rx);
  	uint8_t port = digitalPinToPort(rx);
   _receivePortRegister = portInputRegister(port);
+#endif
 }
 
 void NewSoftSerial::begin(long speed)
@@ -332,6 +357,7 @@ void NewSoftSerial::begin(long speed)
   }
 
   // Set up RX interrupts, but only if we have a valid RX baud rate
+#if defined(__AVR__)
   if (_rx_delay_stopbit)
   {
     if (_receivePin < 8) 
@@ -355,6 +381,7 @@ void NewSoftSerial::begin(long speed)
 
     tunedDelay(_tx_delay); // if we were low this establishes the end
   }
+#endif
 
 #if _DEBUG
   pinMode(13, OUTPUT);
@@ -423,12 +450,15 @@ size_t NewSoftSerial::write(uint8_t b)
   SREG = oldSREG; // turn interrupts back on. hooray!
   tunedDelay(_tx_delay);
   DebugPulse(13, 1);
+
+  return 1;
 }
 
 #define cbi(sfr, bit) (_SFR_BYTE(sfr) &= ~_BV(bit))
 #define sbi(sfr, bit) (_SFR_BYTE(sfr) |= _BV(bit))
 void NewSoftSerial::enable_timer0(bool enable) 
 { 
+#if defined(__AVR__)
   if (enable) 
 #if defined(__AVR_ATmega8__)
   	sbi(TIMSK, TOIE0);
@@ -441,6 +471,7 @@ void NewSoftSerial::enable_timer0(bool enable)
 #else
 	  cbi(TIMSK0, TOIE0);
 #endif
+#endif
 }
 
 void NewSoftSerial::flush()
@@ -50,6 +50,9 @@ private:
   volatile uint8_t *_receivePortRegister;
   uint8_t _transmitBitMask;
   volatile uint8_t *_transmitPortRegister;
+#if !defined(__AVR__)
+  uint8_t _transmitPin;
+#endif
 
   uint16_t _rx_delay_centering;
   uint16_t _rx_delay_intrabit;
@@ -0,0 +1,1027 @@
+/*
+  HostSim - virtual hardware for running the organ firmware on a PC
+
+  This file is in the public domain.
+*/
+
+#include "HostSim.h"
+#include <algorithm>
+#include <stdio.h>
+#include "avr/io.h"
+
+// the vectors the sketch may define with ISR(), null when it does not
+extern "C"
+{
+  void __vector_7(void) __attribute__((weak));
+  void __vector_11(void) __attribute__((weak));
+  void __vector_15(void) __attribute__((weak));
+  void __vector_17(void) __attribute__((weak));
+  void __vector_18(void) __attribute__((weak));
+  void __vector_19(void) __attribute__((weak));
+  void __vector_20(void) __attribute__((weak));
+}
+
+static void (*simVector(uint8_t vector))(void)
+{
+  switch (vector)
+  {
+    case TIMER2_COMPA_vect_num:
+      return __vector_7;
+    case TIMER1_COMPA_vect_num:
+      return __vector_11;
+    case TIMER0_COMPB_vect_num:
+      return __vector_15;
+    case SPI_STC_vect_num:
+      return __vector_17;
+    case USART_RX_vect_num:
+      return __vector_18;
+    case USART_UDRE_vect_num:
+      return __vector_19;
+    case USART_TX_vect_num:
+      return __vector_20;
+    default:
+      return 0;
+  }
+}
+
+// cycles between compare matches of the two timers from their registers
+static uint32_t timer1Period()
+{
+  static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  uint16_t prescaler = prescalers[TCCR1B & 7];
+  bool ctc = (TCCR1B & (_BV(WGM12) | _BV(WGM13))) == _BV(WGM12) && (TCCR1A & 3) == 0;
+  if (!prescaler || !ctc || !(TIMSK1 & _BV(OCIE1A)))
+  {
+    return 0;
+  }
+  return (uint32_t)prescaler * ((uint32_t)OCR1A + 1);
+}
+
+static uint32_t timer2Period()
+{
+  static const uint16_t prescalers[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+  uint16_t prescaler = prescalers[TCCR2B & 7];
+  bool ctc = (TCCR2A & 3) == _BV(WGM21) && !(TCCR2B & 8);
+  if (!prescaler || !ctc || !(TIMSK2 & _BV(OCIE2A)))
+  {
+    return 0;
+  }
+  return (uint32_t)prescaler * ((uint32_t)OCR2A + 1);
+}
+
+// the value Timer0's count is matched against for compare match B, which
+// only comes as the count reaches it in normal mode; in the core's fast
+// PWM mode OCR0B is only taken up at the bottom and is not modelled
+static int timer0CompareB()
+{
+  bool normal = (TCCR0A & (_BV(WGM01) | _BV(WGM00))) == 0 && !(TCCR0B & 8);
+  if ((TCCR0B & 7) != (_BV(CS01) | _BV(CS00)) || !normal || !(TIMSK0 & _BV(OCIE0B)))
+  {
+    return -1;
+  }
+  return OCR0B;
+}
+
+// the HP VFD's commands, as HpDecVfd sends them
+#define VFD_EXTENDED_COMMANDS 0x00
+#define VFD_EXTENDED_CLEAR 0x00
+#define VFD_EXTENDED_SET_CURSOR 0x80
+#define VFD_EXTENDED_BLANK 0x08
+#define VFD_EXTENDED_UNBLANK 0x0C
+#define VFD_DRAW_TEXT 0x02
+#define VFD_SET_ICON_STATE 0x40
+#define VFD_SET_BRIGHTNESS 0xA0
+#define VFD_RESET 0xFA
+#define VFD_NO_COMMAND 0xFF
+
+//---------------------------------------------------------------------------------------------//
+// pin mapping
+//---------------------------------------------------------------------------------------------//
+uint8_t simPinPort(uint8_t pin)
+{
+  if (pin < 8)
+  {
+    return SIM_PORT_D;
+  }
+  if (pin < 14)
+  {
+    return SIM_PORT_B;
+  }
+  return SIM_PORT_C;
+}
+
+uint8_t simPinBit(uint8_t pin)
+{
+  if (pin < 8)
+  {
+    return pin;
+  }
+  if (pin < 14)
+  {
+    return pin - 8;
+  }
+  return pin - 14;
+}
+
+static uint8_t simPortPin(uint8_t port, uint8_t bit)
+{
+  if (port == SIM_PORT_D)
+  {
+    return bit;
+  }
+  if (port == SIM_PORT_B)
+  {
+    return bit + 8;
+  }
+  return bit + 14;
+}
+
+HostSim &hostSim()
+{
+  static HostSim sim;
+  return sim;
+}
+
+//---------------------------------------------------------------------------------------------//
+// 74LS165 chain
+//---------------------------------------------------------------------------------------------//
+SimShiftChain::SimShiftChain()
+{
+  _loadPin = SIM_NO_PIN;
+  _clockPin = SIM_NO_PIN;
+  _dataPin = SIM_NO_PIN;
+  for (uint8_t i = 0; i < SIM_MAX_BUSES; i++)
+  {
+    _busPin[i] = SIM_NO_PIN;
+    keys[i] = 0;
+  }
+  _chips = 0;
+  _register = 0;
+  _loading = false;
+  _loadStart = 0;
+  _clocks = 0;
+}
+
+void SimShiftChain::configure(uint8_t loadPin, uint8_t clockPin, uint8_t dataPin, uint8_t chips)
+{
+  _loadPin = loadPin;
+  _clockPin = clockPin;
+  _dataPin = dataPin;
+  _chips = chips;
+}
+
+void SimShiftChain::setBusPin(uint8_t bus, uint8_t pin)
+{
+  _busPin[bus] = pin;
+}
+
+uint8_t SimShiftChain::activeBuses() const
+{
+  HostSim &sim = hostSim();
+  uint8_t mask = 0;
+
+  // a bus is active if it is an output and low
+  for (uint8_t i = 0; i < SIM_MAX_BUSES; i++)
+  {
+    if (_busPin[i] == SIM_NO_PIN)
+    {
+      continue;
+    }
+    uint8_t port = simPinPort(_busPin[i]);
+    uint8_t bit = 1 << simPinBit(_busPin[i]);
+    if ((sim.ddrRead(port) & bit) && !(sim.portRead(port) & bit))
+    {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+uint64_t SimShiftChain::parallelInputs() const
+{
+  uint8_t active = activeBuses();
+  uint64_t inputs = 0;
+
+  for (uint8_t i = 0; i < SIM_MAX_BUSES; i++)
+  {
+    if (active & (1 << i))
+    {
+      inputs |= keys[i];
+    }
+  }
+  if (_chips < SIM_MAX_SHIFT_CHIPS)
+  {
+    inputs &= ((uint64_t)1 << (_chips * 8)) - 1;
+  }
+  return inputs;
+}
+
+uint8_t SimShiftChain::dataOut() const
+{
+  uint64_t bits = _loading ? parallelInputs() : _register;
+  return (bits >> (_chips * 8 - 1)) & 1;
+}
+
+void SimShiftChain::loadChanged(uint8_t level, uint64_t cycle)
+{
+  if (level == 0)
+  {
+    // parallel load, the chain follows its inputs while load is low
+    _loading = true;
+    _loadStart = cycle;
+    return;
+  }
+  // the state at the rising edge is what gets shifted out
+  _loading = false;
+  _register = parallelInputs();
+  _clocks = 0;
+  SimLoad load = { _loadStart, cycle, 0, activeBuses() };
+  loads.push_back(load);
+}
+
+void SimShiftChain::clockChanged(uint8_t level, uint64_t cycle)
+{
+  // the rising edge shifts the next bit to the output, a zero comes in
+  if (level == 1 && !_loading)
+  {
+    _register <<= 1;
+    _clocks++;
+    // one clock per bit, the read out is complete
+    if (_clocks == _chips * 8 && !loads.empty())
+    {
+      loads.back().shifted = cycle;
+    }
+  }
+}
+
+//---------------------------------------------------------------------------------------------//
+// HP VFD serial input
+//---------------------------------------------------------------------------------------------//
+SimVfdReceiver::SimVfdReceiver()
+{
+  _clockPin = SIM_NO_PIN;
+  _dataPin = SIM_NO_PIN;
+  _shift = 0;
+  _bitCount = 0;
+  _byteStart = 0;
+  // undriven lines idle high
+  _clockLevel = 1;
+  _clockEdge = 0;
+  _dataEdge = 0;
+  _command = VFD_NO_COMMAND;
+  _wanted = 0;
+  _lastEnd = 0;
+  _readyAt = 0;
+  for (uint8_t i = 0; i < SIM_VFD_ADDRESSES; i++)
+  {
+    text[i] = ' ';
+  }
+  cursor = 0;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    icons[i] = 0;
+  }
+  brightness = 15;
+  blanked = false;
+  commands = 0;
+  characters = 0;
+  timingErrors = 0;
+  busyErrors = 0;
+  unknownBytes = 0;
+}
+
+void SimVfdReceiver::configure(uint8_t clockPin, uint8_t dataPin)
+{
+  _clockPin = clockPin;
+  _dataPin = dataPin;
+}
+
+std::string SimVfdReceiver::line(uint8_t row, uint8_t columns) const
+{
+  std::string line;
+  for (uint8_t column = 0; column < columns; column++)
+  {
+    line += text[((row * 64 + column) ^ 0x40) & 0x7f];
+  }
+  return line;
+}
+
+void SimVfdReceiver::error(uint32_t &count, uint64_t cycle, const char *what)
+{
+  count++;
+  if (firstError.empty())
+  {
+    char description[80];
+    snprintf(description, sizeof(description), "%s at %.3f ms", what, cycle / (double)SIM_CYCLES_PER_MILLISECOND);
+    firstError = description;
+  }
+}
+
+void SimVfdReceiver::clockChanged(uint8_t level, uint8_t data, uint64_t cycle)
+{
+  if (cycle - _clockEdge < SIM_VFD_MIN_PHASE_US * SIM_CYCLES_PER_MICROSECOND)
+  {
+    error(timingErrors, cycle, level ? "short clock low" : "short clock high");
+  }
+  _clockLevel = level;
+  _clockEdge = cycle;
+
+  if (level == 0)
+  {
+    if (_bitCount == 0)
+    {
+      _byteStart = cycle;
+    }
+    return;
+  }
+
+  if (cycle - _dataEdge < SIM_VFD_MIN_SETUP_US * SIM_CYCLES_PER_MICROSECOND)
+  {
+    error(timingErrors, cycle, "short data setup");
+  }
+  _shift = (_shift << 1) | (data & 1);
+  _bitCount++;
+  if (_bitCount == 8)
+  {
+    SimByte byte = { _byteStart, cycle, _shift };
+    bytes.push_back(byte);
+    received(byte);
+    _shift = 0;
+    _bitCount = 0;
+  }
+}
+
+void SimVfdReceiver::dataChanged(uint8_t level, uint64_t cycle)
+{
+  (void)level;
+  if (_clockLevel && cycle - _clockEdge < SIM_VFD_MIN_HOLD_US * SIM_CYCLES_PER_MICROSECOND)
+  {
+    error(timingErrors, cycle, "short data hold");
+  }
+  _dataEdge = cycle;
+}
+
+// one byte into the display's command decoder
+void SimVfdReceiver::received(const SimByte &byte)
+{
+  bool chained = byte.start - _lastEnd <= SIM_VFD_TEXT_CHAIN_US * SIM_CYCLES_PER_MICROSECOND;
+  _lastEnd = byte.end;
+
+  if (_wanted)
+  {
+    // the rest of an extended or icon command
+    _wanted--;
+    if (_command == VFD_SET_ICON_STATE)
+    {
+      icons[2 - _wanted] = byte.value;
+    }
+    else if (byte.value == VFD_EXTENDED_CLEAR)
+    {
+      // homes to address 0, the start of the bottom row
+      for (uint8_t i = 0; i < SIM_VFD_ADDRESSES; i++)
+      {
+        text[i] = ' ';
+      }
+      cursor = 0;
+    }
+    else if (byte.value & VFD_EXTENDED_SET_CURSOR)
+    {
+      cursor = byte.value & 0x7f;
+    }
+    else if (byte.value == VFD_EXTENDED_BLANK || byte.value == VFD_EXTENDED_UNBLANK)
+    {
+      blanked = byte.value == VFD_EXTENDED_BLANK;
+    }
+    else
+    {
+      error(unknownBytes, byte.end, "unknown extended command");
+    }
+    if (!_wanted)
+    {
+      commands++;
+      _readyAt = byte.end + SIM_VFD_COMMAND_US * SIM_CYCLES_PER_MICROSECOND;
+    }
+    return;
+  }
+
+  if (_command == VFD_DRAW_TEXT && chained)
+  {
+    text[cursor] = byte.value;
+    cursor = (cursor + 1) & 0x7f;
+    characters++;
+    _readyAt = byte.end + SIM_VFD_COMMAND_US * SIM_CYCLES_PER_MICROSECOND;
+    return;
+  }
+
+  // a new command
+  if (byte.start < _readyAt)
+  {
+    error(busyErrors, byte.start, "command while busy");
+  }
+  _command = byte.value;
+  _readyAt = byte.end + SIM_VFD_COMMAND_US * SIM_CYCLES_PER_MICROSECOND;
+  if (byte.value == VFD_EXTENDED_COMMANDS)
+  {
+    _wanted = 1;
+  }
+  else if (byte.value == VFD_SET_ICON_STATE)
+  {
+    _wanted = 3;
+  }
+  else if (byte.value == VFD_DRAW_TEXT || (byte.value & 0xf0) == VFD_SET_BRIGHTNESS)
+  {
+    commands++;
+    if (byte.value != VFD_DRAW_TEXT)
+    {
+      brightness = byte.value & 0x0f;
+    }
+  }
+  else if (byte.value == VFD_RESET)
+  {
+    // back as at power up, taken to be blank at full brightness
+    commands++;
+    _readyAt = byte.end + SIM_VFD_RESET_US * SIM_CYCLES_PER_MICROSECOND;
+    for (uint8_t i = 0; i < SIM_VFD_ADDRESSES; i++)
+    {
+      text[i] = ' ';
+    }
+    cursor = 0;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      icons[i] = 0;
+    }
+    brightness = 15;
+    blanked = false;
+  }
+  else
+  {
+    _command = VFD_NO_COMMAND;
+    error(unknownBytes, byte.end, "unknown command");
+  }
+}
+
+//---------------------------------------------------------------------------------------------//
+// asynchronous serial line
+//---------------------------------------------------------------------------------------------//
+SimSerialLine::SimSerialLine()
+{
+  _pin = SIM_NO_PIN;
+  _bitCycles = 0;
+  _decodedEdges = 0;
+}
+
+void SimSerialLine::configure(uint8_t pin, long baud)
+{
+  _pin = pin;
+  _bitCycles = SIM_F_CPU / baud;
+}
+
+void SimSerialLine::lineChanged(uint8_t level, uint64_t cycle)
+{
+  _edges.push_back(cycle);
+  _levels.push_back(level);
+}
+
+uint8_t SimSerialLine::levelAt(uint64_t cycle, size_t &hint) const
+{
+  while (hint + 1 < _edges.size() && _edges[hint + 1] <= cycle)
+  {
+    hint++;
+  }
+  return _levels[hint];
+}
+
+const std::vector<SimByte> &SimSerialLine::bytes()
+{
+  uint64_t now = hostSim().cycles();
+
+  while (_decodedEdges < _edges.size())
+  {
+    // look for the falling edge of a start bit
+    if (_levels[_decodedEdges] != 0)
+    {
+      _decodedEdges++;
+      continue;
+    }
+
+    uint64_t start = _edges[_decodedEdges];
+    uint64_t stopSample = start + (uint64_t)_bitCycles * 19 / 2;
+    if (stopSample > now)
+    {
+      // frame still on the wire
+      break;
+    }
+
+    // sample each data bit in the middle, LSB first
+    size_t hint = _decodedEdges;
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      uint64_t sample = start + (uint64_t)_bitCycles * (3 + 2 * i) / 2;
+      if (levelAt(sample, hint))
+      {
+        value |= 1 << i;
+      }
+    }
+    SimByte received = { start, start + (uint64_t)_bitCycles * 10, value };
+    _bytes.push_back(received);
+
+    // resume after the stop bit
+    while (_decodedEdges < _edges.size() && _edges[_decodedEdges] <= stopSample)
+    {
+      _decodedEdges++;
+    }
+  }
+  return _bytes;
+}
+
+//---------------------------------------------------------------------------------------------//
+// USART receiver
+//---------------------------------------------------------------------------------------------//
+SimSerialInput::SimSerialInput()
+{
+  overruns = 0;
+  _vector = 0;
+  _frameCycles = 0;
+  _nextQueued = 0;
+  _fifoCount = 0;
+}
+
+void SimSerialInput::configure(uint8_t vector, long baud)
+{
+  _vector = vector;
+  _frameCycles = SIM_F_CPU * 10 / baud;
+}
+
+void SimSerialInput::schedule(uint64_t cycle, uint8_t value)
+{
+  // the sender can not start a byte before the last one is out
+  if (!_queued.empty() && _queued.back().end > cycle)
+  {
+    cycle = _queued.back().end;
+  }
+  SimByte byte = { cycle, cycle + _frameCycles, value };
+  _queued.push_back(byte);
+}
+
+uint64_t SimSerialInput::next() const
+{
+  return _nextQueued < _queued.size() ? _queued[_nextQueued].end : UINT64_MAX;
+}
+
+bool SimSerialInput::arrived()
+{
+  SimByte byte = _queued[_nextQueued++];
+  bytes.push_back(byte);
+  if (_nextQueued == _queued.size())
+  {
+    _queued.clear();
+    _nextQueued = 0;
+  }
+  // two bytes wait in UDR0, a third one is lost
+  if (_fifoCount == sizeof(_fifo))
+  {
+    overruns++;
+    return false;
+  }
+  _fifo[_fifoCount++] = byte.value;
+  return true;
+}
+
+uint8_t SimSerialInput::read()
+{
+  if (_fifoCount == 0)
+  {
+    return 0;
+  }
+  uint8_t value = _fifo[0];
+  _fifo[0] = _fifo[1];
+  _fifoCount--;
+  return value;
+}
+
+//---------------------------------------------------------------------------------------------//
+// timers
+//---------------------------------------------------------------------------------------------//
+SimTimer::SimTimer()
+{
+  matches = 0;
+  missed = 0;
+  _vector = 0;
+  _period = 0;
+  _lastPeriod = 0;
+  _compare = 0;
+  _lastCompare = -1;
+  _tick = 1;
+  _next = UINT64_MAX;
+}
+
+void SimTimer::configure(uint8_t vector, uint32_t (*period)())
+{
+  _vector = vector;
+  _period = period;
+}
+
+void SimTimer::configureCompare(uint8_t vector, int (*compare)(), uint32_t tick)
+{
+  _vector = vector;
+  _compare = compare;
+  _tick = tick;
+}
+
+void SimTimer::update(uint64_t now)
+{
+  if (_compare)
+  {
+    int compare = _compare();
+    if (compare == _lastCompare)
+    {
+      return;
+    }
+    // the next tick the count reaches the new value, a whole turn away
+    // if it is there now
+    _lastCompare = compare;
+    uint64_t tick = now / _tick;
+    uint32_t ahead = (uint8_t)(compare - tick);
+    _next = compare < 0 ? UINT64_MAX : (tick + (ahead ? ahead : 256)) * _tick;
+    return;
+  }
+
+  uint32_t period = _period ? _period() : 0;
+  if (period == _lastPeriod)
+  {
+    return;
+  }
+  // started, stopped or reprogrammed, count from here
+  _lastPeriod = period;
+  _next = period ? now + period : UINT64_MAX;
+}
+
+void SimTimer::matched()
+{
+  matches++;
+  _next += _compare ? 256 * _tick : _lastPeriod;
+}
+
+//---------------------------------------------------------------------------------------------//
+// the board
+//---------------------------------------------------------------------------------------------//
+HostSim::HostSim()
+{
+  _cycles = 0;
+  // interrupts start out enabled, as they are once the Arduino core has run init()
+  _sreg = SIM_SREG_I;
+  _pending = 0;
+  _inInterrupt = 0;
+  _cliStart = 0;
+  longestCli = 0;
+  for (uint8_t i = 0; i < SIM_NUM_VECTORS; i++)
+  {
+    interrupts[i] = 0;
+    interruptCycles[i] = 0;
+  }
+  for (uint8_t i = 0; i < SIM_NUM_PORTS; i++)
+  {
+    _port[i] = 0;
+    _ddr[i] = 0;
+    _driven[i] = 0;
+    _drivenLevel[i] = 0;
+    // undriven lines idle high
+    _outputLevel[i] = 0xff;
+  }
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    _analog[i] = 512;
+  }
+
+  // organ wiring, see keyboard_shift_midi_bytewise_0_0_4
+  shiftChain.configure(13, 12, 11, 8);
+  shiftChain.setBusPin(0, 9);
+  shiftChain.setBusPin(1, 10);
+  // the second contacts of a keyboard with two under each key, see
+  // VELOCITY_SENSING in keyboard_shift_midi_bytewise_0_0_5
+  shiftChain.setBusPin(2, 8);
+  shiftChain.setBusPin(3, 5);
+  vfd.configure(6, 7);
+  midiOut.configure(4, SIM_MIDI_BAUD);
+  midiIn.configure(USART_RX_vect_num, SIM_MIDI_BAUD);
+  timer0.configureCompare(TIMER0_COMPB_vect_num, timer0CompareB, 64);
+  timer1.configure(TIMER1_COMPA_vect_num, timer1Period);
+  timer2.configure(TIMER2_COMPA_vect_num, timer2Period);
+}
+
+void HostSim::advance(uint32_t cycles)
+{
+  run(_cycles + cycles, true);
+}
+
+void HostSim::advanceTo(uint64_t cycle)
+{
+  run(cycle, false);
+}
+
+// move the clock to the cycle, taking the timer matches, received bytes
+// and key changes on the way in time order; with stretch, time spent in
+// interrupts pushes the end out
+void HostSim::run(uint64_t cycle, bool stretch)
+{
+  timer0.update(_cycles);
+  timer1.update(_cycles);
+  timer2.update(_cycles);
+  while (true)
+  {
+    SimTimer *timer = timer1.next() <= timer2.next() ? &timer1 : &timer2;
+    if (timer0.next() < timer->next())
+    {
+      timer = &timer0;
+    }
+    bool received = midiIn.next() < timer->next();
+    uint64_t next = received ? midiIn.next() : timer->next();
+    if (next > cycle)
+    {
+      break;
+    }
+    applyKeyEvents(next);
+    if (next > _cycles)
+    {
+      _cycles = next;
+    }
+    uint8_t vector;
+    if (received)
+    {
+      vector = midiIn.vector();
+      if (!midiIn.arrived())
+      {
+        continue;
+      }
+    }
+    else
+    {
+      vector = timer->vector();
+      timer->matched();
+      if (interruptPending(vector))
+      {
+        timer->missed++;
+      }
+    }
+    uint64_t before = _cycles;
+    raiseInterrupt(vector);
+    if (stretch)
+    {
+      cycle += _cycles - before;
+    }
+    // a handler may have moved its own compare register on
+    timer0.update(_cycles);
+  }
+  applyKeyEvents(cycle);
+  if (cycle > _cycles)
+  {
+    _cycles = cycle;
+  }
+}
+
+void HostSim::sregWrite(uint8_t value)
+{
+  if (!_inInterrupt && (_sreg & SIM_SREG_I) != (value & SIM_SREG_I))
+  {
+    if (!(value & SIM_SREG_I))
+    {
+      _cliStart = _cycles;
+    }
+    else if (_cycles - _cliStart > longestCli)
+    {
+      longestCli = _cycles - _cliStart;
+    }
+  }
+  _sreg = value;
+  serviceInterrupts();
+}
+
+void HostSim::raiseInterrupt(uint8_t vector)
+{
+  _pending |= (uint32_t)1 << vector;
+  serviceInterrupts();
+}
+
+// run the pending interrupts while they are enabled, lowest vector first
+// like the AVR's fixed priority
+void HostSim::serviceInterrupts()
+{
+  while (_pending && (_sreg & SIM_SREG_I))
+  {
+    uint8_t vector = __builtin_ctz(_pending);
+    _pending &= ~((uint32_t)1 << vector);
+    void (*handler)(void) = simVector(vector);
+    if (!handler)
+    {
+      // nothing there, avr-libc would reset, here it is dropped
+      continue;
+    }
+    uint64_t start = _cycles;
+    _sreg &= ~SIM_SREG_I;
+    _inInterrupt++;
+    advance(SIM_CYCLES_ISR_ENTRY);
+    handler();
+    advance(SIM_CYCLES_ISR_EXIT);
+    _inInterrupt--;
+    _sreg |= SIM_SREG_I;
+    interrupts[vector]++;
+    interruptCycles[vector] += _cycles - start;
+  }
+}
+
+void HostSim::scheduleKey(uint64_t cycle, uint8_t bus, uint8_t key, bool pressed)
+{
+  SimKeyEvent event = { cycle, bus, key, pressed };
+  // after any events already scheduled for the same cycle
+  std::vector<SimKeyEvent>::iterator it = _keyEvents.end();
+  while (it != _keyEvents.begin() && (it - 1)->cycle > cycle)
+  {
+    --it;
+  }
+  _keyEvents.insert(it, event);
+}
+
+void HostSim::applyKeyEvents(uint64_t until)
+{
+  size_t applied = 0;
+  while (applied < _keyEvents.size() && _keyEvents[applied].cycle <= until)
+  {
+    SimKeyEvent &event = _keyEvents[applied];
+    if (event.cycle > _cycles)
+    {
+      _cycles = event.cycle;
+    }
+    uint64_t bit = (uint64_t)1 << event.key;
+    if (event.pressed)
+    {
+      shiftChain.keys[event.bus] |= bit;
+    }
+    else
+    {
+      shiftChain.keys[event.bus] &= ~bit;
+    }
+    applied++;
+  }
+  if (applied)
+  {
+    _keyEvents.erase(_keyEvents.begin(), _keyEvents.begin() + applied);
+  }
+}
+
+uint8_t HostSim::portRead(uint8_t port)
+{
+  return _port[port];
+}
+
+void HostSim::portWrite(uint8_t port, uint8_t value)
+{
+  _port[port] = value;
+  outputsChanged(port);
+}
+
+void HostSim::ddrWrite(uint8_t port, uint8_t value)
+{
+  _ddr[port] = value;
+  outputsChanged(port);
+}
+
+uint8_t HostSim::usartRead()
+{
+  uint8_t value = midiIn.read();
+  if (midiIn.unread())
+  {
+    // RXC0 is still set, the handler runs again after its reti
+    _pending |= (uint32_t)1 << midiIn.vector();
+  }
+  return value;
+}
+
+uint8_t HostSim::pinRead(uint8_t port)
+{
+  uint8_t value = 0;
+  for (uint8_t bit = 0; bit < 8; bit++)
+  {
+    if (readPin(simPortPin(port, bit)))
+    {
+      value |= 1 << bit;
+    }
+  }
+  return value;
+}
+
+void HostSim::setPinMode(uint8_t pin, uint8_t output)
+{
+  uint8_t port = simPinPort(pin);
+  uint8_t bit = 1 << simPinBit(pin);
+  if (output)
+  {
+    ddrWrite(port, _ddr[port] | bit);
+  }
+  else
+  {
+    ddrWrite(port, _ddr[port] & ~bit);
+  }
+}
+
+void HostSim::writePin(uint8_t pin, uint8_t level)
+{
+  uint8_t port = simPinPort(pin);
+  uint8_t bit = 1 << simPinBit(pin);
+  if (level)
+  {
+    portWrite(port, _port[port] | bit);
+  }
+  else
+  {
+    portWrite(port, _port[port] & ~bit);
+  }
+}
+
+uint8_t HostSim::readPin(uint8_t pin)
+{
+  uint8_t port = simPinPort(pin);
+  uint8_t bit = 1 << simPinBit(pin);
+
+  if (_ddr[port] & bit)
+  {
+    return (_port[port] & bit) ? 1 : 0;
+  }
+  if (pin == shiftChain.dataPin())
+  {
+    return shiftChain.dataOut();
+  }
+  if (_driven[port] & bit)
+  {
+    return (_drivenLevel[port] & bit) ? 1 : 0;
+  }
+  // pull-up enabled reads high, a floating input reads low
+  return (_port[port] & bit) ? 1 : 0;
+}
+
+void HostSim::setInput(uint8_t pin, uint8_t level)
+{
+  uint8_t port = simPinPort(pin);
+  uint8_t bit = 1 << simPinBit(pin);
+  _driven[port] |= bit;
+  if (level)
+  {
+    _drivenLevel[port] |= bit;
+  }
+  else
+  {
+    _drivenLevel[port] &= ~bit;
+  }
+}
+
+void HostSim::releaseInput(uint8_t pin)
+{
+  uint8_t port = simPinPort(pin);
+  _driven[port] &= ~(1 << simPinBit(pin));
+}
+
+void HostSim::setAnalog(uint8_t channel, int value)
+{
+  _analog[channel & 7] = value;
+}
+
+void HostSim::outputsChanged(uint8_t port)
+{
+  // what the outside world sees: the driven level of an output,
+  // or the idle-high line of an input
+  uint8_t level = (_port[port] & _ddr[port]) | ~_ddr[port];
+  uint8_t changed = level ^ _outputLevel[port];
+  _outputLevel[port] = level;
+
+  for (uint8_t bit = 0; changed; bit++, changed >>= 1)
+  {
+    if (changed & 1)
+    {
+      pinChanged(simPortPin(port, bit), (level >> bit) & 1);
+    }
+  }
+}
+
+void HostSim::pinChanged(uint8_t pin, uint8_t level)
+{
+  if (pin == shiftChain.loadPin())
+  {
+    shiftChain.loadChanged(level, _cycles);
+  }
+  else if (pin == shiftChain.clockPin())
+  {
+    shiftChain.clockChanged(level, _cycles);
+  }
+  else if (pin == vfd.clockPin())
+  {
+    vfd.clockChanged(level, readPin(vfd.dataPin()), _cycles);
+  }
+  else if (pin == vfd.dataPin())
+  {
+    vfd.dataChanged(level, _cycles);
+  }
+  else if (pin == midiOut.pin())
+  {
+    midiOut.lineChanged(level, _cycles);
+  }
+}
@@ -0,0 +1,420 @@
+/*
+  HostSim - virtual hardware for running the organ firmware on a PC
+
+  HostSim is the Linux backend of the pin/timing layer used by the organ
+  sketches.  The AVR backend is the stock Arduino core; on the host the
+  same calls (digitalWrite, digitalRead, pinMode, delayMicroseconds,
+  micros, millis and the PORTx/DDRx/PINx registers) land here instead.
+
+  Time is virtual and counted in 16 MHz CPU cycles.  Every core call
+  charges roughly what it costs on an ATmega328p, so the timing of the
+  pin-banging code (shift register scan, VFD clock, MIDI bit timing)
+  is reproduced closely.  Plain C++ between those calls is free, which
+  is a fair approximation for this firmware since it is dominated by
+  I/O and busy-waits.
+
+  The attached devices are:
+  . a chain of 74LS165 shift registers with one 64 bit key word per bus
+  . the two keyboard bus pins (active when driven low), and two more for
+    the second contacts of velocity sensing keyboards
+  . the HP VFD clocked serial input (clock on pin 6, data on pin 7)
+  . the 31250 baud MIDI TX line to the Fluxamasynth (pin 4)
+  . a MIDI controller sending into the USART's receiver (pin 0), which
+    raises the USART RX interrupt for each byte, with the 2 byte receive
+    FIFO of the ATmega328p behind UDR0
+  . Timer1 and Timer2 in CTC mode, with their compare match interrupts
+  . Timer0's compare match B interrupt, once the timer is switched from
+    the core's fast PWM to normal mode; it keeps counting for millis()
+
+  Interrupts are taken as the clock advances: when a timer matches or a
+  device raises one, and SREG's I bit is set, the vector the sketch
+  defined with ISR() runs right there, with I clear, and the code it
+  interrupted is delayed by as long as it took.
+
+  This file is in the public domain.
+*/
+
+#ifndef HostSim_h
+#define HostSim_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define SIM_F_CPU 16000000UL
+#define SIM_CYCLES_PER_MICROSECOND (SIM_F_CPU / 1000000UL)
+#define SIM_CYCLES_PER_MILLISECOND (SIM_F_CPU / 1000UL)
+
+// approximate cost of the Arduino 1.0 core calls on a 16 MHz ATmega328p
+#define SIM_CYCLES_PIN_MODE 64
+#define SIM_CYCLES_DIGITAL_WRITE 54
+#define SIM_CYCLES_DIGITAL_READ 50
+#define SIM_CYCLES_ANALOG_READ 1744
+#define SIM_CYCLES_MICROS 60
+#define SIM_CYCLES_MILLIS 40
+#define SIM_CYCLES_EEPROM_WRITE 54400
+// Print::print() of a number, per digit: a 32 bit division by the base
+// (__udivmodsi4) and the multiply for the remainder
+#define SIM_CYCLES_PRINT_DIGIT 700
+
+// into an ISR (vector, jmp, prologue of a C handler) and back out through reti
+#define SIM_CYCLES_ISR_ENTRY 45
+#define SIM_CYCLES_ISR_EXIT 45
+
+// I/O register access, in/out is 1 cycle, sbi/cbi is 2
+#define SIM_CYCLES_REG_READ 1
+#define SIM_CYCLES_REG_WRITE 1
+#define SIM_CYCLES_REG_MODIFY 2
+
+// a read from flash, pgm_read_byte() and the like: the address into Z,
+// then an lpm for each byte
+#define SIM_CYCLES_PGM_READ 1
+#define SIM_CYCLES_LPM 3
+
+// the ATmega328p ports, in Arduino Uno pin order
+#define SIM_PORT_B 0
+#define SIM_PORT_C 1
+#define SIM_PORT_D 2
+#define SIM_NUM_PORTS 3
+
+#define SIM_NUM_PINS 20
+#define SIM_NO_PIN 255
+
+#define SIM_MAX_BUSES 4
+#define SIM_MAX_SHIFT_CHIPS 8
+
+#define SIM_MIDI_BAUD 31250
+
+// what the HP VFD's serial input is taken to need.  HpDecVfd has always
+// clocked it with 28 us phases and the display's own limits are not
+// known, so each clock phase must be at least a little under that, with
+// the data set up for as long before the rising edge and held a moment
+// after it
+#define SIM_VFD_MIN_PHASE_US 24
+#define SIM_VFD_MIN_SETUP_US 24
+#define SIM_VFD_MIN_HOLD_US 1
+// a text command goes on with a character started within this time of
+// the last: the 1 ms HpDecVfd allows and the first clock phase on top
+#define SIM_VFD_TEXT_CHAIN_US 1100
+// the time the display takes over a command as measured with the
+// library, and over a reset; no command may start before
+#define SIM_VFD_COMMAND_US 3000
+#define SIM_VFD_RESET_US 65000
+// the display's character addresses, two rows of 64, bottom row first
+#define SIM_VFD_ADDRESSES 128
+
+// interrupt vectors go up to 25 on the ATmega328p
+#define SIM_NUM_VECTORS 26
+#define SIM_SREG_I 0x80
+
+// a byte seen on one of the simulated serial lines
+struct SimByte
+{
+  // cycle at which the byte started (start bit or first clock)
+  uint64_t start;
+  // cycle at which the byte was complete
+  uint64_t end;
+  uint8_t value;
+};
+
+// a scheduled change of a key contact
+struct SimKeyEvent
+{
+  uint64_t cycle;
+  uint8_t bus;
+  uint8_t key;
+  bool pressed;
+};
+
+// a parallel load of the shift register chain
+struct SimLoad
+{
+  // falling edge of the load pulse
+  uint64_t start;
+  // rising edge, the key state is latched here
+  uint64_t cycle;
+  // clock edge that shifted out the last bit, 0 if the chain was not read out
+  uint64_t shifted;
+  // which buses were driven low at the moment of the load
+  uint8_t busMask;
+};
+
+//---------------------------------------------------------------------------------------------//
+// 74LS165 chain
+// the first bit out of the chain is the highest key, as in getKeystate()
+//---------------------------------------------------------------------------------------------//
+class SimShiftChain
+{
+  public:
+    SimShiftChain();
+    void configure(uint8_t loadPin, uint8_t clockPin, uint8_t dataPin, uint8_t chips);
+    void setBusPin(uint8_t bus, uint8_t pin);
+
+    // physical contact state, bit n set means key n touches the bus bar
+    uint64_t keys[SIM_MAX_BUSES];
+    std::vector<SimLoad> loads;
+
+    uint8_t loadPin() const { return _loadPin; }
+    uint8_t clockPin() const { return _clockPin; }
+    uint8_t dataPin() const { return _dataPin; }
+    uint8_t busPin(uint8_t bus) const { return _busPin[bus]; }
+    uint8_t chips() const { return _chips; }
+
+    uint64_t parallelInputs() const;
+    uint8_t activeBuses() const;
+    uint8_t dataOut() const;
+    void loadChanged(uint8_t level, uint64_t cycle);
+    void clockChanged(uint8_t level, uint64_t cycle);
+
+  private:
+    uint8_t _loadPin;
+    uint8_t _clockPin;
+    uint8_t _dataPin;
+    uint8_t _busPin[SIM_MAX_BUSES];
+    uint8_t _chips;
+    uint64_t _register;
+    bool _loading;
+    uint64_t _loadStart;
+    uint8_t _clocks;
+};
+
+//---------------------------------------------------------------------------------------------//
+// HP VFD serial input
+// data is sampled MSB first on the rising clock edge; the bytes are taken
+// as the display's commands and the timing of the line is checked
+//---------------------------------------------------------------------------------------------//
+class SimVfdReceiver
+{
+  public:
+    SimVfdReceiver();
+    void configure(uint8_t clockPin, uint8_t dataPin);
+
+    std::vector<SimByte> bytes;
+
+    // what the display shows: a character per address, the cursor
+    // address, the three icon bytes, brightness 0 to 15 and blanking
+    char text[SIM_VFD_ADDRESSES];
+    uint8_t cursor;
+    uint8_t icons[3];
+    uint8_t brightness;
+    bool blanked;
+    // commands and characters taken
+    uint32_t commands;
+    uint32_t characters;
+    // clock phases, setup or hold times too short; commands started while
+    // the one before was still executing; bytes that are no command
+    uint32_t timingErrors;
+    uint32_t busyErrors;
+    uint32_t unknownBytes;
+    // the first of those errors, empty while there is none
+    std::string firstError;
+
+    // a row of text as it looks, row 0 on top
+    std::string line(uint8_t row, uint8_t columns) const;
+
+    uint8_t clockPin() const { return _clockPin; }
+    uint8_t dataPin() const { return _dataPin; }
+    void clockChanged(uint8_t level, uint8_t data, uint64_t cycle);
+    void dataChanged(uint8_t level, uint64_t cycle);
+
+  private:
+    uint8_t _clockPin;
+    uint8_t _dataPin;
+    uint8_t _shift;
+    uint8_t _bitCount;
+    uint64_t _byteStart;
+    uint8_t _clockLevel;
+    uint64_t _clockEdge;
+    uint64_t _dataEdge;
+    // the command being taken, the bytes it still wants, the end of the
+    // last byte and when the display is ready for the next command
+    uint8_t _command;
+    uint8_t _wanted;
+    uint64_t _lastEnd;
+    uint64_t _readyAt;
+
+    void error(uint32_t &count, uint64_t cycle, const char *what);
+    void received(const SimByte &byte);
+};
+
+//---------------------------------------------------------------------------------------------//
+// asynchronous serial line, 8N1, idle high
+//---------------------------------------------------------------------------------------------//
+class SimSerialLine
+{
+  public:
+    SimSerialLine();
+    void configure(uint8_t pin, long baud);
+
+    uint8_t pin() const { return _pin; }
+    void lineChanged(uint8_t level, uint64_t cycle);
+    // decode every complete frame seen so far
+    const std::vector<SimByte> &bytes();
+
+  private:
+    uint8_t _pin;
+    uint32_t _bitCycles;
+    std::vector<uint64_t> _edges;
+    std::vector<uint8_t> _levels;
+    std::vector<SimByte> _bytes;
+    size_t _decodedEdges;
+    uint8_t levelAt(uint64_t cycle, size_t &hint) const;
+};
+
+//---------------------------------------------------------------------------------------------//
+// bytes coming in on the USART's receive pin, 8N1
+//---------------------------------------------------------------------------------------------//
+class SimSerialInput
+{
+  public:
+    SimSerialInput();
+    void configure(uint8_t vector, long baud);
+
+    // send a byte starting at the cycle, or right after the one queued before it
+    void schedule(uint64_t cycle, uint8_t value);
+    // the bytes that have come in so far, with their times
+    std::vector<SimByte> bytes;
+    // bytes lost because the receive FIFO was full
+    uint32_t overruns;
+
+    uint8_t vector() const { return _vector; }
+    // end of the stop bit of the next byte, UINT64_MAX if none is on its way
+    uint64_t next() const;
+    // the next byte has arrived: true if the FIFO took it
+    bool arrived();
+    // UDR0 read, takes the oldest byte out of the FIFO
+    uint8_t read();
+    uint8_t unread() const { return _fifoCount; }
+
+  private:
+    uint8_t _vector;
+    uint32_t _frameCycles;
+    std::vector<SimByte> _queued;
+    size_t _nextQueued;
+    uint8_t _fifo[2];
+    uint8_t _fifoCount;
+};
+
+//---------------------------------------------------------------------------------------------//
+// timer in CTC mode, counting up to OCRnA and raising its compare match interrupt,
+// or an 8 bit timer counting freely with an interrupt where it matches a compare register
+//---------------------------------------------------------------------------------------------//
+class SimTimer
+{
+  public:
+    SimTimer();
+    // period() returns the cycles between compare matches, 0 when the
+    // timer is stopped, not in CTC mode or its interrupt is off
+    void configure(uint8_t vector, uint32_t (*period)());
+    // compare() returns the value the count is matched against, -1 when
+    // the timer is not in normal mode or its interrupt is off; the count
+    // goes up one every tick cycles from the start, wrapping at 256
+    void configureCompare(uint8_t vector, int (*compare)(), uint32_t tick);
+
+    // compare matches, and matches that came while the last was still pending
+    uint32_t matches;
+    uint32_t missed;
+
+    uint8_t vector() const { return _vector; }
+    uint64_t next() const { return _next; }
+    void update(uint64_t now);
+    void matched();
+
+  private:
+    uint8_t _vector;
+    uint32_t (*_period)();
+    uint32_t _lastPeriod;
+    int (*_compare)();
+    int _lastCompare;
+    uint32_t _tick;
+    uint64_t _next;
+};
+
+//---------------------------------------------------------------------------------------------//
+// the whole board
+//---------------------------------------------------------------------------------------------//
+class HostSim
+{
+  public:
+    HostSim();
+
+    // virtual time
+    // advance() runs code for that many cycles, interrupts taken meanwhile
+    // add to it; advanceTo() waits for a point in time, like delay()
+    uint64_t cycles() const { return _cycles; }
+    void advance(uint32_t cycles);
+    void advanceTo(uint64_t cycle);
+
+    // interrupts
+    uint8_t sreg() const { return _sreg; }
+    void sregWrite(uint8_t value);
+    void raiseInterrupt(uint8_t vector);
+    bool interruptPending(uint8_t vector) const { return (_pending >> vector) & 1; }
+    bool inInterrupt() const { return _inInterrupt > 0; }
+    // times each vector ran and the cycles spent in it
+    uint32_t interrupts[SIM_NUM_VECTORS];
+    uint64_t interruptCycles[SIM_NUM_VECTORS];
+    // longest stretch the code outside of interrupts ran with them disabled
+    uint64_t longestCli;
+
+    // register level access, used by the core and the PORTx/DDRx/PINx registers
+    uint8_t portRead(uint8_t port);
+    void portWrite(uint8_t port, uint8_t value);
+    uint8_t ddrRead(uint8_t port) const { return _ddr[port]; }
+    void ddrWrite(uint8_t port, uint8_t value);
+    uint8_t pinRead(uint8_t port);
+    // UDR0, the receive interrupt stays raised while the FIFO has more
+    uint8_t usartRead();
+
+    // pin level access in Arduino pin numbers, no cycles are charged
+    void setPinMode(uint8_t pin, uint8_t output);
+    void writePin(uint8_t pin, uint8_t level);
+    uint8_t readPin(uint8_t pin);
+
+    // outside world
+    void setInput(uint8_t pin, uint8_t level);
+    void releaseInput(uint8_t pin);
+    void setAnalog(uint8_t channel, int value);
+    int analog(uint8_t channel) const { return _analog[channel]; }
+    void scheduleKey(uint64_t cycle, uint8_t bus, uint8_t key, bool pressed);
+    bool keyEventsPending() const { return !_keyEvents.empty(); }
+
+    SimShiftChain shiftChain;
+    SimVfdReceiver vfd;
+    SimSerialLine midiOut;
+    SimSerialInput midiIn;
+    SimTimer timer0;
+    SimTimer timer1;
+    SimTimer timer2;
+
+  private:
+    uint64_t _cycles;
+    uint8_t _sreg;
+    uint32_t _pending;
+    uint8_t _inInterrupt;
+    uint64_t _cliStart;
+    uint8_t _port[SIM_NUM_PORTS];
+    uint8_t _ddr[SIM_NUM_PORTS];
+    uint8_t _driven[SIM_NUM_PORTS];
+    uint8_t _drivenLevel[SIM_NUM_PORTS];
+    uint8_t _outputLevel[SIM_NUM_PORTS];
+    int _analog[8];
+    std::vector<SimKeyEvent> _keyEvents;
+
+    void outputsChanged(uint8_t port);
+    void pinChanged(uint8_t pin, uint8_t level);
+    void applyKeyEvents(uint64_t until);
+    void run(uint64_t cycle, bool stretch);
+    void serviceInterrupts();
+};
+
+// Arduino pin number to port and bit, Uno layout
+uint8_t simPinPort(uint8_t pin);
+uint8_t simPinBit(uint8_t pin);
+
+// the one simulated board; constructed on first use so the sketch's
+// global objects can touch pins from their constructors
+HostSim &hostSim();
+
+#endif
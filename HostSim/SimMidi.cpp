@@ -0,0 +1,130 @@
+/*
+  SimMidi - MIDI stream decoding for HostSim traces
+
+  This file is in the public domain.
+*/
+
+#include "SimMidi.h"
+
+uint8_t simMidiDataLength(uint8_t status)
+{
+  switch (status & 0xf0)
+  {
+    case 0xc0:
+    case 0xd0:
+      return 1;
+    case 0xf0:
+      if (status == 0xf1 || status == 0xf3)
+      {
+        return 1;
+      }
+      if (status == 0xf2)
+      {
+        return 2;
+      }
+      return 0;
+    default:
+      return 2;
+  }
+}
+
+void simParseMidi(const std::vector<SimByte> &bytes, std::vector<SimMidiMessage> &messages)
+{
+  uint8_t running = 0;
+  uint8_t need = 0;
+  uint8_t have = 0;
+  bool inSysex = false;
+  SimMidiMessage message = SimMidiMessage();
+
+  for (size_t i = 0; i < bytes.size(); i++)
+  {
+    const SimByte &b = bytes[i];
+
+    // real time messages may appear anywhere and leave everything alone
+    if (b.value >= 0xf8)
+    {
+      SimMidiMessage realTime = { b.start, b.end, b.value, { 0, 0 }, 1, false };
+      messages.push_back(realTime);
+      continue;
+    }
+
+    if (b.value & 0x80)
+    {
+      if (inSysex)
+      {
+        // any status byte ends a system exclusive message
+        inSysex = false;
+        message.end = b.end;
+        message.length++;
+        messages.push_back(message);
+        if (b.value == 0xf7)
+        {
+          continue;
+        }
+      }
+      message = SimMidiMessage();
+      message.start = b.start;
+      message.status = b.value;
+      message.length = 1;
+      have = 0;
+
+      if (b.value == 0xf0)
+      {
+        inSysex = true;
+        running = 0;
+        continue;
+      }
+      if (b.value >= 0xf0)
+      {
+        // system common cancels running status
+        running = 0;
+        need = simMidiDataLength(b.value);
+        if (need == 0)
+        {
+          message.end = b.end;
+          messages.push_back(message);
+        }
+        else
+        {
+          running = b.value;
+        }
+        continue;
+      }
+      running = b.value;
+      need = simMidiDataLength(b.value);
+      continue;
+    }
+
+    // data byte
+    if (inSysex)
+    {
+      message.length++;
+      continue;
+    }
+    if (running == 0)
+    {
+      // stray data byte, nothing to attach it to
+      continue;
+    }
+    if (have == 0 && message.length == 0)
+    {
+      // running status, the message starts with its first data byte
+      message.start = b.start;
+      message.status = running;
+      message.runningStatus = true;
+    }
+    message.data[have++] = b.value;
+    message.length++;
+    if (have == need)
+    {
+      message.end = b.end;
+      messages.push_back(message);
+      if (running >= 0xf0)
+      {
+        running = 0;
+      }
+      message = SimMidiMessage();
+      have = 0;
+    }
+  }
+}
@@ -0,0 +1,39 @@
+/*
+  SimMidi - MIDI stream decoding for HostSim traces
+
+  This file is in the public domain.
+*/
+
+#ifndef SimMidi_h
+#define SimMidi_h
+
+#include <stdint.h>
+#include <vector>
+#include "HostSim.h"
+
+struct SimMidiMessage
+{
+  // start of the first byte and end of the last byte of the message
+  uint64_t start;
+  uint64_t end;
+  uint8_t status;
+  uint8_t data[2];
+  // number of bytes the message took on the wire
+  uint8_t length;
+  // the status byte was left out
+  bool runningStatus;
+
+  uint8_t channel() const { return status & 0x0f; }
+  uint8_t type() const { return status & 0xf0; }
+  bool isNoteOn() const { return type() == 0x90 && data[1] != 0; }
+  bool isNoteOff() const { return type() == 0x80 || (type() == 0x90 && data[1] == 0); }
+};
+
+// number of data bytes following a channel or system common status byte
+uint8_t simMidiDataLength(uint8_t status);
+
+// split a byte trace into messages, following running status; system
+// exclusive messages come out whole with status 0xf0 and data[] unused
+void simParseMidi(const std::vector<SimByte> &bytes, std::vector<SimMidiMessage> &messages);
+
+#endif
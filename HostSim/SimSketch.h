@@ -0,0 +1,29 @@
+/*
+  SimSketch.h - the Arduino main() for a sketch running on HostSim
+
+  This file is in the public domain.
+*/
+
+#ifndef SimSketch_h
+#define SimSketch_h
+
+#include "HostSim.h"
+
+// the call into loop() and the serialEventRun() check around it
+#define SIM_CYCLES_LOOP_CALL 10
+
+void setup(void);
+void loop(void);
+
+// run loop() until the virtual clock reaches the given cycle
+inline void simRunLoop(uint64_t untilCycle)
+{
+  HostSim &sim = hostSim();
+  while (sim.cycles() < untilCycle)
+  {
+    loop();
+    sim.advance(SIM_CYCLES_LOOP_CALL);
+  }
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+  SimStats - percentiles and text histograms for HostSim benchmarks
+
+  This file is in the public domain.
+*/
+
+#ifndef SimStats_h
+#define SimStats_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+class SimHistogram
+{
+  public:
+    SimHistogram() : _sorted(true) {}
+
+    void add(double value) { _values.push_back(value); _sorted = false; }
+    size_t count() const { return _values.size(); }
+
+    // nearest-rank percentile, p from 0 to 100
+    double percentile(double p)
+    {
+      if (_values.empty())
+      {
+        return 0;
+      }
+      sort();
+      size_t rank = (size_t)(p / 100.0 * _values.size() + 0.5);
+      if (rank < 1)
+      {
+        rank = 1;
+      }
+      if (rank > _values.size())
+      {
+        rank = _values.size();
+      }
+      return _values[rank - 1];
+    }
+
+    double max()
+    {
+      if (_values.empty())
+      {
+        return 0;
+      }
+      sort();
+      return _values.back();
+    }
+
+    // one row of a p50/p99/max table
+    void printRow(const char *name)
+    {
+      printf("  %-18s %10.1f %10.1f %10.1f\n", name, percentile(50), percentile(99), max());
+    }
+
+    // power of two buckets, one bar per bucket
+    void printHistogram(const char *name, const char *unit)
+    {
+      if (_values.empty())
+      {
+        return;
+      }
+      sort();
+      printf("  %s (%s)\n", name, unit);
+
+      double bound = 1;
+      while (bound <= _values.front())
+      {
+        bound *= 2;
+      }
+      size_t i = 0;
+      while (i < _values.size())
+      {
+        size_t n = 0;
+        while (i < _values.size() && _values[i] < bound)
+        {
+          n++;
+          i++;
+        }
+        int bar = (int)((n * 50 + _values.size() - 1) / _values.size());
+        printf("    < %8.0f | %-50.*s %u\n", bound, bar, "##################################################", (unsigned)n);
+        bound *= 2;
+      }
+    }
+
+  private:
+    std::vector<double> _values;
+    bool _sorted;
+
+    void sort()
+    {
+      if (!_sorted)
+      {
+        std::sort(_values.begin(), _values.end());
+        _sorted = true;
+      }
+    }
+};
+
+#endif
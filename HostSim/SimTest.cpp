@@ -0,0 +1,72 @@
+/*
+  SimTest - what the HostSim test programs share
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "SimTest.h"
+#include "SimSketch.h"
+
+// keys in a manual of the organ sketches, and pots
+#define SIM_TEST_NUM_KEYS 64
+#define SIM_TEST_NUM_POTS 4
+#define SIM_TEST_POT_STEP_MS 10
+
+bool simLoadPerformance(const char *path, std::vector<SimHold> &holds)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  unsigned number = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    number++;
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+    {
+      continue;
+    }
+    unsigned bus;
+    unsigned key;
+    SimHold hold;
+    if (sscanf(line, "%u %u %lf %lf", &bus, &key, &hold.onMs, &hold.offMs) != 4 || bus > 1
+      || key >= SIM_TEST_NUM_KEYS || hold.offMs <= hold.onMs)
+    {
+      fprintf(stderr, "%s:%u: expected bus key on_ms off_ms\n", path, number);
+      fclose(f);
+      return false;
+    }
+    hold.bus = bus;
+    hold.key = key;
+    holds.push_back(hold);
+  }
+  fclose(f);
+  return true;
+}
+
+void simSweepPots(double t)
+{
+  HostSim &sim = hostSim();
+  for (uint8_t pot = 0; pot < SIM_TEST_NUM_POTS; pot++)
+  {
+    double phase = t / (700.0 + pot * 300.0);
+    sim.setAnalog(pot, 512 + (int)(450 * sin(phase * 6.2832)));
+  }
+}
+
+void simRunLoopSweeping(uint64_t untilCycle)
+{
+  HostSim &sim = hostSim();
+  while (sim.cycles() < untilCycle)
+  {
+    simSweepPots(msOf(sim.cycles()));
+    uint64_t step = sim.cycles() + ms(SIM_TEST_POT_STEP_MS);
+    simRunLoop(step < untilCycle ? step : untilCycle);
+  }
+}
@@ -0,0 +1,54 @@
+/*
+  SimTest - what the HostSim test programs share: virtual time in
+  milliseconds and microseconds, the performance files of key holds, and
+  the pots turning while the sketch runs
+
+  This file is in the public domain.
+*/
+
+#ifndef SimTest_h
+#define SimTest_h
+
+#include <stdint.h>
+#include <vector>
+#include "HostSim.h"
+
+// the cycles in a time in milliseconds
+inline uint64_t ms(double milliseconds)
+{
+  return (uint64_t)(milliseconds * SIM_CYCLES_PER_MILLISECOND);
+}
+
+// a number of cycles in microseconds, and in milliseconds
+inline double us(int64_t cycles)
+{
+  return cycles / (double)SIM_CYCLES_PER_MICROSECOND;
+}
+
+inline double msOf(int64_t cycles)
+{
+  return cycles / (double)SIM_CYCLES_PER_MILLISECOND;
+}
+
+// a key held in a performance, its times from the start in ms
+struct SimHold
+{
+  uint8_t bus;
+  uint8_t key;
+  double onMs;
+  double offMs;
+};
+
+// read a performance file, a "bus key on_ms off_ms" line per hold, # for
+// comments; false, with the line that is wrong on stderr, if it can not
+bool simLoadPerformance(const char *path, std::vector<SimHold> &holds);
+
+// set the four pots where the sweep has them t ms in: each sweeps up and
+// down around the middle at its own speed, the first in 700 ms
+void simSweepPots(double t);
+
+// run loop() until the virtual clock reaches the given cycle, with the
+// pots sweeping by the clock and moved every 10 ms
+void simRunLoopSweeping(uint64_t untilCycle);
+
+#endif
@@ -0,0 +1,271 @@
+/*
+  bounce_bench - contact bounce corpus for the key debouncing of an organ sketch
+
+  usage: bounce_bench [-p profile]... [-v]
+
+  -p  run only the named profile; may be given more than once
+  -v  list every key hold that did not give exactly one note-on and one
+      note-off
+
+  Every profile plays 64 key holds, one key at a time on alternating
+  manuals.  The contacts bounce the way the profile describes: a number
+  of short opens and closes spread over a window after the first make
+  (press) or the first break (release) edge, and for the dropout profile
+  a short open in the middle of the hold, like a dirty bussbar.  The edge
+  times are pseudo random but the same on every run.
+
+  A hold is correct when it gives exactly one note-on and one note-off.
+  Extra messages are chatter that got through the debouncing.  Latency is
+  measured from the first make edge to the note-on and from the first
+  break edge to the note-off.  The exit status is 1 if any hold is wrong.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+// how the organ sketches map buses to MIDI: lower is channel 1, upper channel 0
+static const uint8_t busChannel[2] = { 1, 0 };
+#define BOUNCE_LOWEST_NOTE 36
+#define BOUNCE_NUM_KEYS 64
+
+#define BOUNCE_HOLDS 64
+// a hold starts every period and lasts hold ms
+#define BOUNCE_PERIOD_MS 100
+#define BOUNCE_HOLD_MS 60
+// idle time before and after each profile
+#define BOUNCE_GAP_MS 300
+
+struct BounceProfile
+{
+  const char *name;
+  const char *description;
+  // bounce window in microseconds and the number of open/close pairs in it
+  uint16_t makeWindow;
+  uint8_t makeChatters;
+  uint16_t breakWindow;
+  uint8_t breakChatters;
+  // length of an open in the middle of the hold, 0 for none
+  uint16_t dropout;
+};
+
+static const BounceProfile profiles[] =
+{
+  { "clean", "no bounce", 0, 0, 0, 0, 0 },
+  { "make", "3 chatters within 1 ms of the press", 1000, 3, 0, 0, 0 },
+  { "break", "4 chatters within 1.5 ms of the release", 0, 0, 1500, 4, 0 },
+  { "both", "4 chatters on press and 5 on release, 2 ms each", 2000, 4, 2000, 5, 0 },
+  { "dropout", "a 300 us open in the middle of the hold", 0, 0, 0, 0, 300 },
+};
+#define BOUNCE_NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+struct BounceHold
+{
+  uint8_t bus;
+  uint8_t key;
+  uint64_t make;
+  uint64_t release;
+  uint64_t end;
+};
+
+static unsigned long bounceRandomState = 54321;
+
+static unsigned long bounceRandom(unsigned long range)
+{
+  bounceRandomState = bounceRandomState * 1103515245UL + 12345UL;
+  return ((bounceRandomState >> 16) & 0x7fff) % range;
+}
+
+// the contact goes to level at the cycle, then bounces away and back
+// chatters times within the window
+static void bounce(const BounceHold &hold, uint64_t cycle, bool level, uint16_t window, uint8_t chatters)
+{
+  HostSim &sim = hostSim();
+  sim.scheduleKey(cycle, hold.bus, hold.key, level);
+
+  std::vector<uint64_t> edges;
+  for (uint8_t i = 0; i < chatters * 2; i++)
+  {
+    edges.push_back(cycle + 1 + bounceRandom(window) * SIM_CYCLES_PER_MICROSECOND);
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size(); i++)
+  {
+    // odd edges go away from the level, even ones come back
+    sim.scheduleKey(edges[i], hold.bus, hold.key, (i % 2) ? level : !level);
+  }
+}
+
+static void play(const BounceProfile &profile, std::vector<BounceHold> &holds, uint64_t start)
+{
+  for (uint8_t i = 0; i < BOUNCE_HOLDS; i++)
+  {
+    BounceHold hold;
+    hold.bus = i % 2;
+    hold.key = (i * 37 + bounceRandom(8)) % BOUNCE_NUM_KEYS;
+    hold.make = start + ms(i * BOUNCE_PERIOD_MS) + bounceRandom(1000) * SIM_CYCLES_PER_MICROSECOND;
+    hold.release = hold.make + ms(BOUNCE_HOLD_MS);
+    hold.end = start + ms((i + 1) * BOUNCE_PERIOD_MS);
+    holds.push_back(hold);
+
+    bounce(hold, hold.make, true, profile.makeWindow, profile.makeChatters);
+    if (profile.dropout)
+    {
+      uint64_t open = hold.make + ms(BOUNCE_HOLD_MS / 2);
+      hostSim().scheduleKey(open, hold.bus, hold.key, false);
+      hostSim().scheduleKey(open + profile.dropout * SIM_CYCLES_PER_MICROSECOND, hold.bus, hold.key, true);
+    }
+    bounce(hold, hold.release, false, profile.breakWindow, profile.breakChatters);
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bounce_bench [-p profile]... [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool selected[BOUNCE_NUM_PROFILES] = { false };
+  bool anySelected = false;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      i++;
+      size_t p;
+      for (p = 0; p < BOUNCE_NUM_PROFILES; p++)
+      {
+        if (!strcmp(argv[i], profiles[p].name))
+        {
+          selected[p] = true;
+          anySelected = true;
+          break;
+        }
+      }
+      if (p == BOUNCE_NUM_PROFILES)
+      {
+        usage();
+      }
+    }
+    else if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+
+  std::vector<BounceHold> holds[BOUNCE_NUM_PROFILES];
+  for (size_t p = 0; p < BOUNCE_NUM_PROFILES; p++)
+  {
+    if (anySelected && !selected[p])
+    {
+      continue;
+    }
+    uint64_t start = sim.cycles() + ms(BOUNCE_GAP_MS);
+    play(profiles[p], holds[p], start);
+    simRunLoop(start + ms(BOUNCE_HOLDS * BOUNCE_PERIOD_MS + BOUNCE_GAP_MS));
+  }
+
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(sim.midiOut.bytes(), messages);
+
+  int failed = 0;
+  for (size_t p = 0; p < BOUNCE_NUM_PROFILES; p++)
+  {
+    if (!holds[p].empty())
+    {
+      printf("%-10s %s\n", profiles[p].name, profiles[p].description);
+    }
+  }
+  printf("\n  %-10s %6s %8s %8s %8s %12s %12s\n", "profile", "holds", "correct", "missed", "chatter", "note-on max", "note-off max");
+  for (size_t p = 0; p < BOUNCE_NUM_PROFILES; p++)
+  {
+    if (holds[p].empty())
+    {
+      continue;
+    }
+    unsigned correct = 0;
+    unsigned missed = 0;
+    unsigned chatter = 0;
+    SimHistogram noteOn;
+    SimHistogram noteOff;
+
+    for (size_t h = 0; h < holds[p].size(); h++)
+    {
+      const BounceHold &hold = holds[p][h];
+      uint8_t channel = busChannel[hold.bus];
+      uint8_t note = BOUNCE_LOWEST_NOTE + hold.key;
+      unsigned ons = 0;
+      unsigned offs = 0;
+
+      // the messages for this key until the next hold starts
+      for (size_t i = 0; i < messages.size(); i++)
+      {
+        const SimMidiMessage &m = messages[i];
+        if (m.start < hold.make || m.start >= hold.end || m.channel() != channel || (m.data[0] & 0x7f) != note)
+        {
+          continue;
+        }
+        if (m.isNoteOn())
+        {
+          if (ons == 0)
+          {
+            noteOn.add(us(m.start - hold.make));
+          }
+          ons++;
+        }
+        else if (m.isNoteOff())
+        {
+          if (offs == 0 && m.start >= hold.release)
+          {
+            noteOff.add(us(m.start - hold.release));
+          }
+          offs++;
+        }
+      }
+
+      if (ons == 1 && offs == 1)
+      {
+        correct++;
+        continue;
+      }
+      if (ons == 0 || offs == 0)
+      {
+        missed++;
+      }
+      chatter += (ons > 1 ? ons - 1 : 0) + (offs > 1 ? offs - 1 : 0);
+      if (verbose)
+      {
+        printf("    %s: bus %u key %2u at %.1f ms gave %u note-ons and %u note-offs\n", profiles[p].name,
+          hold.bus, hold.key, us(hold.make) / 1000.0, ons, offs);
+      }
+    }
+
+    printf("  %-10s %6u %8u %8u %8u %12.1f %12.1f\n", profiles[p].name, (unsigned)holds[p].size(),
+      correct, missed, chatter, noteOn.max(), noteOff.max());
+    if (correct != holds[p].size())
+    {
+      failed = 1;
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,369 @@
+/*
+  Arduino.cpp - host replacement for the Arduino 1.0 core
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "HostSim.h"
+
+// cost of a HardwareSerial::write() that finds room in the buffer
+#define SIM_CYCLES_SERIAL_WRITE 40
+// the Arduino 1.0 transmit and receive buffers
+#define SIM_SERIAL_BUFFER_SIZE 64
+// what the body of the core's USART RX handler takes, store_char() included
+#define SIM_CYCLES_SERIAL_RX_HANDLER 40
+// available() and read(), which copy the ring buffer indices
+#define SIM_CYCLES_SERIAL_AVAILABLE 12
+#define SIM_CYCLES_SERIAL_READ 24
+
+//---------------------------------------------------------------------------------------------//
+// I/O registers
+//---------------------------------------------------------------------------------------------//
+HostRegister PORTB(SIM_REG_PORT, SIM_PORT_B);
+HostRegister PORTC(SIM_REG_PORT, SIM_PORT_C);
+HostRegister PORTD(SIM_REG_PORT, SIM_PORT_D);
+HostRegister DDRB(SIM_REG_DDR, SIM_PORT_B);
+HostRegister DDRC(SIM_REG_DDR, SIM_PORT_C);
+HostRegister DDRD(SIM_REG_DDR, SIM_PORT_D);
+HostRegister PINB(SIM_REG_PIN, SIM_PORT_B);
+HostRegister PINC(SIM_REG_PIN, SIM_PORT_C);
+HostRegister PIND(SIM_REG_PIN, SIM_PORT_D);
+HostRegister SREG(SIM_REG_SREG, 0);
+HostRegister UDR0(SIM_REG_UDR, 0);
+HostRegister TCNT0(SIM_REG_TCNT, 0);
+
+// Timer0 as init() leaves it: fast PWM, clk/64, overflow interrupt for millis()
+volatile uint8_t TCCR0A = _BV(WGM01) | _BV(WGM00);
+volatile uint8_t TCCR0B = _BV(CS01) | _BV(CS00);
+volatile uint8_t OCR0B;
+volatile uint8_t TIMSK0 = _BV(TOIE0);
+volatile uint8_t TIFR0;
+
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint16_t TCNT1;
+volatile uint16_t OCR1A;
+volatile uint8_t TIMSK1;
+volatile uint8_t TIFR1;
+volatile uint8_t TCCR2A;
+volatile uint8_t TCCR2B;
+volatile uint8_t TCNT2;
+volatile uint8_t OCR2A;
+volatile uint8_t TIMSK2;
+volatile uint8_t TIFR2;
+
+uint8_t HostRegister::get() const
+{
+  HostSim &sim = hostSim();
+  switch (_kind)
+  {
+    case SIM_REG_PORT:
+      return sim.portRead(_port);
+    case SIM_REG_DDR:
+      return sim.ddrRead(_port);
+    case SIM_REG_PIN:
+      return sim.pinRead(_port);
+    case SIM_REG_UDR:
+      return sim.usartRead();
+    case SIM_REG_TCNT:
+      return (uint8_t)(sim.cycles() / 64);
+    default:
+      return sim.sreg();
+  }
+}
+
+void HostRegister::set(uint8_t value)
+{
+  HostSim &sim = hostSim();
+  switch (_kind)
+  {
+    case SIM_REG_PORT:
+      sim.portWrite(_port, value);
+      break;
+    case SIM_REG_DDR:
+      sim.ddrWrite(_port, value);
+      break;
+    case SIM_REG_PIN:
+      // writing a one to PINx toggles the output
+      sim.portWrite(_port, sim.portRead(_port) ^ value);
+      break;
+    case SIM_REG_UDR:
+    case SIM_REG_TCNT:
+      break;
+    default:
+      sim.sregWrite(value);
+      break;
+  }
+}
+
+HostRegister::operator uint8_t() const
+{
+  hostSim().advance(SIM_CYCLES_REG_READ);
+  return get();
+}
+
+HostRegister &HostRegister::operator=(uint8_t value)
+{
+  hostSim().advance(SIM_CYCLES_REG_WRITE);
+  set(value);
+  return *this;
+}
+
+HostRegister &HostRegister::operator|=(uint8_t value)
+{
+  hostSim().advance(SIM_CYCLES_REG_MODIFY);
+  set(get() | value);
+  return *this;
+}
+
+HostRegister &HostRegister::operator&=(uint8_t value)
+{
+  hostSim().advance(SIM_CYCLES_REG_MODIFY);
+  set(get() & value);
+  return *this;
+}
+
+HostRegister &HostRegister::operator^=(uint8_t value)
+{
+  hostSim().advance(SIM_CYCLES_REG_MODIFY);
+  set(get() ^ value);
+  return *this;
+}
+
+void simPgmRead(size_t bytes)
+{
+  hostSim().advance(SIM_CYCLES_PGM_READ + SIM_CYCLES_LPM * bytes);
+}
+
+//---------------------------------------------------------------------------------------------//
+// digital and analog I/O
+//---------------------------------------------------------------------------------------------//
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_PIN_MODE);
+  if (mode == INPUT_PULLUP)
+  {
+    sim.setPinMode(pin, 0);
+    sim.writePin(pin, HIGH);
+  }
+  else
+  {
+    sim.setPinMode(pin, mode == OUTPUT);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_DIGITAL_WRITE);
+  sim.writePin(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_DIGITAL_READ);
+  return sim.readPin(pin) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_ANALOG_READ);
+  if (pin >= A0)
+  {
+    pin -= A0;
+  }
+  return sim.analog(pin);
+}
+
+//---------------------------------------------------------------------------------------------//
+// time
+//---------------------------------------------------------------------------------------------//
+unsigned long millis(void)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_MILLIS);
+  return (unsigned long)(sim.cycles() / SIM_CYCLES_PER_MILLISECOND);
+}
+
+unsigned long micros(void)
+{
+  HostSim &sim = hostSim();
+  sim.advance(SIM_CYCLES_MICROS);
+  // timer0 ticks every 64 cycles, so micros() has a 4 us resolution
+  return (unsigned long)(sim.cycles() / 64 * 4);
+}
+
+// delay() watches micros(), so interrupts taken meanwhile do not lengthen it
+void delay(unsigned long ms)
+{
+  HostSim &sim = hostSim();
+  sim.advanceTo(sim.cycles() + ms * SIM_CYCLES_PER_MILLISECOND);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  hostSim().advance(us * SIM_CYCLES_PER_MICROSECOND);
+}
+
+//---------------------------------------------------------------------------------------------//
+// math
+//---------------------------------------------------------------------------------------------//
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+static unsigned long randomState = 1;
+
+void randomSeed(unsigned int seed)
+{
+  if (seed != 0)
+  {
+    randomState = seed;
+  }
+}
+
+long random(long howbig)
+{
+  if (howbig == 0)
+  {
+    return 0;
+  }
+  // same generator on every host so traces are repeatable
+  randomState = randomState * 1103515245UL + 12345UL;
+  return (long)((randomState >> 16) & 0x7fff) % howbig;
+}
+
+long random(long howsmall, long howbig)
+{
+  if (howsmall >= howbig)
+  {
+    return howsmall;
+  }
+  return random(howbig - howsmall) + howsmall;
+}
+
+//---------------------------------------------------------------------------------------------//
+// USART
+//---------------------------------------------------------------------------------------------//
+HardwareSerial Serial;
+
+// the core's receive interrupt: the byte goes into the ring buffer, or is
+// dropped if the buffer is full
+ISR(USART_RX_vect)
+{
+  uint8_t c = UDR0;
+  hostSim().advance(SIM_CYCLES_SERIAL_RX_HANDLER);
+  Serial.received(c);
+}
+
+HardwareSerial::HardwareSerial()
+{
+  _baud = 0;
+  _echo = false;
+  _rxHead = 0;
+  _rxTail = 0;
+  dropped = 0;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  _baud = baud;
+}
+
+void HardwareSerial::end()
+{
+  _baud = 0;
+}
+
+void HardwareSerial::received(uint8_t c)
+{
+  // with the receiver off the interrupt is not enabled
+  if (_baud == 0)
+  {
+    return;
+  }
+  unsigned next = (_rxHead + 1) % SIM_SERIAL_BUFFER_SIZE;
+  if (next == _rxTail)
+  {
+    dropped++;
+    return;
+  }
+  _rxBuffer[_rxHead] = c;
+  _rxHead = next;
+}
+
+int HardwareSerial::available(void)
+{
+  hostSim().advance(SIM_CYCLES_SERIAL_AVAILABLE);
+  return (SIM_SERIAL_BUFFER_SIZE + _rxHead - _rxTail) % SIM_SERIAL_BUFFER_SIZE;
+}
+
+int HardwareSerial::peek(void)
+{
+  if (_rxHead == _rxTail)
+  {
+    return -1;
+  }
+  return _rxBuffer[_rxTail];
+}
+
+int HardwareSerial::read(void)
+{
+  hostSim().advance(SIM_CYCLES_SERIAL_READ);
+  if (_rxHead == _rxTail)
+  {
+    return -1;
+  }
+  uint8_t c = _rxBuffer[_rxTail];
+  _rxTail = (_rxTail + 1) % SIM_SERIAL_BUFFER_SIZE;
+  return c;
+}
+
+void HardwareSerial::flush(void)
+{
+  if (!sent.empty())
+  {
+    hostSim().advanceTo(sent.back().end);
+  }
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  HostSim &sim = hostSim();
+  if (_baud == 0)
+  {
+    return 0;
+  }
+
+  // the interrupt driven driver blocks only when its buffer is full
+  if (sent.size() >= SIM_SERIAL_BUFFER_SIZE)
+  {
+    const SimByte &oldest = sent[sent.size() - SIM_SERIAL_BUFFER_SIZE];
+    if (oldest.end > sim.cycles())
+    {
+      sim.advanceTo(oldest.end);
+    }
+  }
+  sim.advance(SIM_CYCLES_SERIAL_WRITE);
+
+  uint64_t frameCycles = SIM_F_CPU * 10 / _baud;
+  uint64_t start = sim.cycles();
+  if (!sent.empty() && sent.back().end > start)
+  {
+    start = sent.back().end;
+  }
+  SimByte byte = { start, start + frameCycles, c };
+  sent.push_back(byte);
+
+  if (_echo)
+  {
+    fputc(c, stdout);
+  }
+  return 1;
+}
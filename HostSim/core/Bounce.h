@@ -0,0 +1,96 @@
+/*
+  Bounce.h - host replacement for the Bounce 1.x button library
+
+  Same debounce logic as the original, built on the host core.
+
+  This file is in the public domain.
+*/
+
+#ifndef Bounce_h
+#define Bounce_h
+
+#include "Arduino.h"
+
+class Bounce
+{
+  public:
+    Bounce(uint8_t pin, unsigned long interval_millis)
+    {
+      interval(interval_millis);
+      previous_millis = millis();
+      state = digitalRead(pin);
+      this->pin = pin;
+      stateChanged = 0;
+      rebounce_millis = 0;
+    }
+
+    void interval(unsigned long interval_millis)
+    {
+      this->interval_millis = interval_millis;
+      this->rebounce_millis = 0;
+    }
+
+    int update()
+    {
+      if (debounce())
+      {
+        rebounce(0);
+        return stateChanged = 1;
+      }
+      // we need to rebounce, so simulate a state change
+      if (rebounce_millis && (millis() - previous_millis >= rebounce_millis))
+      {
+        previous_millis = millis();
+        rebounce(0);
+        return stateChanged = 1;
+      }
+      return stateChanged = 0;
+    }
+
+    void rebounce(unsigned long interval)
+    {
+      this->rebounce_millis = interval;
+    }
+
+    int read()
+    {
+      return (int)state;
+    }
+
+    void write(int new_state)
+    {
+      this->state = new_state;
+      digitalWrite(pin, state);
+    }
+
+    unsigned long duration()
+    {
+      return millis() - previous_millis;
+    }
+
+    bool risingEdge() { return stateChanged && state; }
+    bool fallingEdge() { return stateChanged && !state; }
+
+  protected:
+    int debounce()
+    {
+      uint8_t newState = digitalRead(pin);
+      if (state != newState)
+      {
+        if (millis() - previous_millis >= interval_millis)
+        {
+          previous_millis = millis();
+          state = newState;
+          return 1;
+        }
+      }
+      return 0;
+    }
+
+    unsigned long previous_millis, interval_millis, rebounce_millis;
+    uint8_t state;
+    uint8_t pin;
+    uint8_t stateChanged;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*
+  EEPROM.h - host replacement for the Arduino EEPROM library
+
+  1 KB like the ATmega328p, erased to 0xff.  A write blocks for the
+  3.3 ms the real part needs.
+
+  This file is in the public domain.
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+#include "HostSim.h"
+
+#define SIM_EEPROM_SIZE 1024
+
+class EEPROMClass
+{
+  public:
+    EEPROMClass()
+    {
+      for (int i = 0; i < SIM_EEPROM_SIZE; i++)
+      {
+        _cells[i] = 0xff;
+      }
+    }
+
+    uint8_t read(int address)
+    {
+      return _cells[address % SIM_EEPROM_SIZE];
+    }
+
+    void write(int address, uint8_t value)
+    {
+      hostSim().advance(SIM_CYCLES_EEPROM_WRITE);
+      _cells[address % SIM_EEPROM_SIZE] = value;
+    }
+
+  private:
+    uint8_t _cells[SIM_EEPROM_SIZE];
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,54 @@
+/*
+  HardwareSerial.h - host replacement for the Arduino 1.0 USART driver
+
+  Transmitted bytes are kept with their virtual timestamps; nothing is
+  printed unless echo is turned on.  Received bytes come from HostSim's
+  USART receiver through the same RX interrupt and 64 byte ring buffer
+  as in the Arduino 1.0 core.
+
+  This file is in the public domain.
+*/
+
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include <stdint.h>
+#include <vector>
+#include "Print.h"
+#include "HostSim.h"
+
+class HardwareSerial : public Print
+{
+  public:
+    HardwareSerial();
+    void begin(unsigned long baud);
+    void end();
+    int available(void);
+    int peek(void);
+    int read(void);
+    void flush(void);
+    virtual size_t write(uint8_t c);
+    using Print::write;
+    operator bool() { return true; }
+
+    // host side
+    long baud() const { return _baud; }
+    void setEcho(bool echo) { _echo = echo; }
+    std::vector<SimByte> sent;
+    // store_char(), called by the RX interrupt
+    void received(uint8_t c);
+    // bytes that came in while the ring buffer was full
+    uint32_t dropped;
+
+  private:
+    long _baud;
+    bool _echo;
+    // the core's SERIAL_BUFFER_SIZE
+    uint8_t _rxBuffer[64];
+    volatile unsigned _rxHead;
+    volatile unsigned _rxTail;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,22 @@
+/*
+  avr/interrupt.h - host replacement
+
+  ISR() defines the vector function with the avr-libc name, HostSim calls
+  it when the interrupt is raised and enabled.
+
+  This file is in the public domain.
+*/
+
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#include "avr/io.h"
+
+#define cli() (SREG &= (uint8_t)~_BV(SREG_I))
+#define sei() (SREG |= _BV(SREG_I))
+
+#define ISR(vector, ...) \
+  extern "C" void vector(void); \
+  extern "C" void vector(void)
+
+#endif
@@ -0,0 +1,149 @@
+/*
+  avr/io.h - host replacement for the ATmega328p I/O registers
+
+  The port registers are small objects that forward every access to the
+  HostSim board and charge the cycles the matching in/out/sbi/cbi would
+  take, so direct port code runs unmodified on the host.
+
+  UDR0 is one of them too: reading it takes a byte out of the receive
+  FIFO of the simulated USART.  Writes to it are not seen, the host
+  HardwareSerial models transmission on its own.
+
+  The timer registers are plain variables.  HostSim looks at them as the
+  virtual clock advances and models CTC mode on OCRnA with its compare
+  match interrupt; writes to TCNTn are not seen.  Timer0 is the one the
+  core keeps millis() with, at clk/64 from power up: TCNT0 is another
+  of the objects above and reads that count from the virtual clock, and
+  its compare match B interrupt is modelled once the timer is put in
+  normal mode.
+
+  This file is in the public domain.
+*/
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define SIM_REG_PORT 0
+#define SIM_REG_DDR 1
+#define SIM_REG_PIN 2
+#define SIM_REG_SREG 3
+#define SIM_REG_UDR 4
+#define SIM_REG_TCNT 5
+
+class HostRegister
+{
+  public:
+    HostRegister(uint8_t kind, uint8_t port) : _kind(kind), _port(port) {}
+    operator uint8_t() const;
+    HostRegister &operator=(uint8_t value);
+    HostRegister &operator|=(uint8_t value);
+    HostRegister &operator&=(uint8_t value);
+    HostRegister &operator^=(uint8_t value);
+
+  private:
+    uint8_t _kind;
+    uint8_t _port;
+    uint8_t get() const;
+    void set(uint8_t value);
+};
+
+extern HostRegister PORTB;
+extern HostRegister PORTC;
+extern HostRegister PORTD;
+extern HostRegister DDRB;
+extern HostRegister DDRC;
+extern HostRegister DDRD;
+extern HostRegister PINB;
+extern HostRegister PINC;
+extern HostRegister PIND;
+extern HostRegister SREG;
+extern HostRegister UDR0;
+extern HostRegister TCNT0;
+
+extern volatile uint8_t TCCR0A;
+extern volatile uint8_t TCCR0B;
+extern volatile uint8_t OCR0B;
+extern volatile uint8_t TIMSK0;
+extern volatile uint8_t TIFR0;
+#define WGM00 0
+#define WGM01 1
+#define CS00 0
+#define CS01 1
+#define TOIE0 0
+#define OCIE0B 2
+#define OCF0B 2
+
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t TIMSK1;
+extern volatile uint8_t TIFR1;
+extern volatile uint8_t TCCR2A;
+extern volatile uint8_t TCCR2B;
+extern volatile uint8_t TCNT2;
+extern volatile uint8_t OCR2A;
+extern volatile uint8_t TIMSK2;
+extern volatile uint8_t TIFR2;
+
+// port bit names
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// global interrupt enable bit in SREG
+#define SREG_I 7
+
+// timer bits
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define OCIE1A 1
+#define OCF1A 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 1
+#define OCIE2A 1
+#define OCF2A 1
+
+// ATmega328p interrupt vectors
+#define TIMER2_COMPA_vect_num 7
+#define TIMER2_COMPA_vect __vector_7
+#define TIMER1_COMPA_vect_num 11
+#define TIMER1_COMPA_vect __vector_11
+#define TIMER0_COMPB_vect_num 15
+#define TIMER0_COMPB_vect __vector_15
+#define SPI_STC_vect_num 17
+#define SPI_STC_vect __vector_17
+#define USART_RX_vect_num 18
+#define USART_RX_vect __vector_18
+#define USART_UDRE_vect_num 19
+#define USART_UDRE_vect __vector_19
+#define USART_TX_vect_num 20
+#define USART_TX_vect __vector_20
+
+#endif
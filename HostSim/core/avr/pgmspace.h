@@ -0,0 +1,59 @@
+/*
+  avr/pgmspace.h - host replacement, flash and RAM are the same thing here
+
+  A read charges the cycles the lpm instructions would take.
+
+  This file is in the public domain.
+*/
+
+#ifndef _AVR_PGMSPACE_H_
+#define _AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// charges a read of this many bytes from flash, in the core
+void simPgmRead(size_t bytes);
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+static inline uint8_t pgm_read_byte(const void *addr)
+{
+  simPgmRead(1);
+  return *(const uint8_t *)addr;
+}
+
+static inline uint16_t pgm_read_word(const void *addr)
+{
+  uint16_t value;
+  simPgmRead(sizeof(value));
+  __builtin_memcpy(&value, addr, sizeof(value));
+  return value;
+}
+
+static inline uint32_t pgm_read_dword(const void *addr)
+{
+  uint32_t value;
+  simPgmRead(sizeof(value));
+  __builtin_memcpy(&value, addr, sizeof(value));
+  return value;
+}
+
+static inline void *pgm_read_ptr(const void *addr)
+{
+  void *value;
+  simPgmRead(2); // the AVR's pointers are a word
+  __builtin_memcpy(&value, addr, sizeof(value));
+  return value;
+}
+// a macro too, as in avr-libc, so #ifndef pgm_read_ptr finds it
+#define pgm_read_ptr pgm_read_ptr
+
+static inline void *memcpy_P(void *dest, const void *src, size_t n)
+{
+  simPgmRead(n);
+  return __builtin_memcpy(dest, src, n);
+}
+
+#endif
@@ -0,0 +1,305 @@
+/*
+  coupler_check - the CouplerEngine library against hand worked coupler tables
+
+  usage: coupler_check [-n steps] [-v]
+
+  -v  print every step of the worked example
+
+  A three division console, great, swell and a 32 note pedalboard an
+  octave below the manuals, with Swell to Great, Great to Pedal, Swell
+  super and sub octave and Great super octave.  Two parts:
+
+  table   a worked example, keys pressed and released and couplers drawn
+          and retracted one step at a time, with the notes each division
+          sounds and the notes that start or stop after every step written
+          out by hand: unison couplers doubling a note that is already
+          sounding, octave couplers running off the ends of the keyboard,
+          a coupler that only moves keys played and not what other
+          couplers add.
+
+  random  n random steps (20000 by default) checked against a note by
+          note model, nested loops over the couplers and the keys held.
+          Every note-on has to be for a note that was not sounding and
+          every note-off for one that was.
+
+  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CouplerEngine.h"
+
+#define GREAT 0
+#define SWELL 1
+#define PEDAL 2
+#define CHECK_DIVISIONS 3
+
+#define B(n) ((uint64_t)1 << (n))
+
+// no board here to charge the flash reads to
+void simPgmRead(size_t bytes)
+{
+}
+
+static const Coupler checkCouplers[] PROGMEM =
+{
+  // Swell to Great
+  { GREAT, SWELL, 0 },
+  // Great to Pedal, the pedals start an octave below the great
+  { PEDAL, GREAT, -12 },
+  // Swell super octave
+  { SWELL, SWELL, 12 },
+  // Swell sub octave
+  { SWELL, SWELL, -12 },
+  // Great super octave
+  { GREAT, GREAT, 12 },
+};
+#define CHECK_COUPLERS (sizeof(checkCouplers) / sizeof(checkCouplers[0]))
+
+static const char *divisionNames[CHECK_DIVISIONS] = { "great", "swell", "pedal" };
+// keys per division
+static const uint8_t divisionKeys[CHECK_DIVISIONS] = { 61, 61, 32 };
+
+struct CheckStep
+{
+  // '+' press, '-' release, 's' draw the couplers in value
+  char action;
+  uint8_t division;
+  uint8_t value;
+  uint64_t sounding[CHECK_DIVISIONS];
+  uint64_t changed[CHECK_DIVISIONS];
+};
+
+// worked out by hand, see the comments for why
+static const CheckStep steps[] =
+{
+  // a key, nothing drawn
+  { '+', GREAT, 0, { B(0), 0, 0 }, { B(0), 0, 0 } },
+  { '+', SWELL, 0, { B(0), B(0), 0 }, { 0, B(0), 0 } },
+  // Swell to Great: great key 0 asks for swell note 0, which already sounds
+  { 's', 0, 0x01, { B(0), B(0), 0 }, { 0, 0, 0 } },
+  { '+', GREAT, 5, { B(0) | B(5), B(0) | B(5), 0 }, { B(5), B(5), 0 } },
+  // swell note 0 keeps sounding from the great key
+  { '-', SWELL, 0, { B(0) | B(5), B(0) | B(5), 0 }, { 0, 0, 0 } },
+  { '-', GREAT, 0, { B(5), B(5), 0 }, { B(0), B(0), 0 } },
+  // Swell super octave, no swell keys held
+  { 's', 0, 0x05, { B(5), B(5), 0 }, { 0, 0, 0 } },
+  // 60 + 12 is off the end of the word
+  { '+', SWELL, 60, { B(5), B(5) | B(60), 0 }, { 0, B(60), 0 } },
+  { '+', SWELL, 3, { B(5), B(3) | B(5) | B(15) | B(60), 0 }, { 0, B(3) | B(15), 0 } },
+  // sub octave too: 60 - 12, and 3 - 12 is off the bottom
+  { 's', 0, 0x0d, { B(5), B(3) | B(5) | B(15) | B(48) | B(60), 0 }, { 0, B(48), 0 } },
+  // Great to Pedal, pedal key 12 is great key 0
+  { 's', 0, 0x0f, { B(5), B(3) | B(5) | B(15) | B(48) | B(60), 0 }, { 0, 0, 0 } },
+  // the coupled great note does not go on to the swell
+  { '+', PEDAL, 12, { B(0) | B(5), B(3) | B(5) | B(15) | B(48) | B(60), B(12) }, { B(0), 0, B(12) } },
+  // pedal key 5 is below the great's compass
+  { '+', PEDAL, 5, { B(0) | B(5), B(3) | B(5) | B(15) | B(48) | B(60), B(5) | B(12) }, { 0, 0, B(5) } },
+  // Great super octave moves great key 5, not the pedal's great note 0
+  { 's', 0, 0x1f, { B(0) | B(5) | B(17), B(3) | B(5) | B(15) | B(48) | B(60), B(5) | B(12) }, { B(17), 0, 0 } },
+  // all in: only the keys held sound
+  { 's', 0, 0x00, { B(5), B(3) | B(60), B(5) | B(12) }, { B(0) | B(17), B(5) | B(15) | B(48), 0 } },
+  { '-', GREAT, 5, { 0, B(3) | B(60), B(5) | B(12) }, { B(5), 0, 0 } },
+  { '-', SWELL, 3, { 0, B(60), B(5) | B(12) }, { 0, B(3), 0 } },
+  { '-', SWELL, 60, { 0, 0, B(5) | B(12) }, { 0, B(60), 0 } },
+  { '-', PEDAL, 5, { 0, 0, B(12) }, { 0, 0, B(5) } },
+  { '-', PEDAL, 12, { 0, 0, 0 }, { 0, 0, B(12) } },
+};
+#define CHECK_STEPS (sizeof(steps) / sizeof(steps[0]))
+
+static unsigned long checkRandomState = 86420;
+
+static unsigned long checkRandom(unsigned long range)
+{
+  checkRandomState = checkRandomState * 1103515245UL + 12345UL;
+  return ((checkRandomState >> 16) & 0x7fff) % range;
+}
+
+static void apply(CouplerEngine<CHECK_DIVISIONS> &engine, char action, uint8_t division, uint8_t value)
+{
+  if (action == 's')
+  {
+    engine.setStops(value);
+  }
+  else
+  {
+    engine.setKey(division, value, action == '+');
+  }
+  engine.update();
+}
+
+static int checkTable(bool verbose)
+{
+  CouplerEngine<CHECK_DIVISIONS> engine(checkCouplers, CHECK_COUPLERS);
+  unsigned wrong = 0;
+
+  for (size_t i = 0; i < CHECK_STEPS; i++)
+  {
+    const CheckStep &step = steps[i];
+    apply(engine, step.action, step.division, step.value);
+    bool ok = true;
+    for (uint8_t d = 0; d < CHECK_DIVISIONS; d++)
+    {
+      if (engine.sounding(d) != step.sounding[d] || engine.changed(d) != step.changed[d])
+      {
+        ok = false;
+      }
+    }
+    if (verbose || !ok)
+    {
+      if (step.action == 's')
+      {
+        printf("  step %2u: couplers %02x", (unsigned)i + 1, step.value);
+      }
+      else
+      {
+        printf("  step %2u: %s key %u %s", (unsigned)i + 1, divisionNames[step.division], step.value,
+          step.action == '+' ? "down" : "up");
+      }
+      printf("%s\n", ok ? "" : "  FAIL");
+      for (uint8_t d = 0; d < CHECK_DIVISIONS; d++)
+      {
+        printf("    %-6s sounding %016llx changed %016llx", divisionNames[d], (unsigned long long)engine.sounding(d),
+          (unsigned long long)engine.changed(d));
+        if (!ok)
+        {
+          printf("  expected %016llx %016llx", (unsigned long long)step.sounding[d],
+            (unsigned long long)step.changed[d]);
+        }
+        printf("\n");
+      }
+    }
+    if (!ok)
+    {
+      wrong++;
+    }
+  }
+  printf("table: %u steps, %u wrong: %s\n", (unsigned)CHECK_STEPS, wrong, wrong ? "FAIL" : "ok");
+  return wrong ? 1 : 0;
+}
+
+static int checkRandomSteps(unsigned count)
+{
+  CouplerEngine<CHECK_DIVISIONS> engine(checkCouplers, CHECK_COUPLERS);
+  bool held[CHECK_DIVISIONS][64];
+  bool sounding[CHECK_DIVISIONS][64];
+  uint8_t stops = 0;
+  unsigned wrong = 0;
+  unsigned noteOns = 0;
+  unsigned noteOffs = 0;
+  unsigned doubled = 0;
+
+  memset(held, 0, sizeof(held));
+  memset(sounding, 0, sizeof(sounding));
+  for (unsigned n = 0; n < count; n++)
+  {
+    uint8_t division = checkRandom(CHECK_DIVISIONS);
+    uint8_t key = checkRandom(divisionKeys[division]);
+    if (checkRandom(8) == 0)
+    {
+      stops = checkRandom(1 << CHECK_COUPLERS);
+      apply(engine, 's', 0, stops);
+    }
+    else
+    {
+      held[division][key] = !held[division][key];
+      apply(engine, held[division][key] ? '+' : '-', division, key);
+    }
+
+    // the model: every key held asks for its own note and one per coupler drawn
+    bool wanted[CHECK_DIVISIONS][64];
+    memset(wanted, 0, sizeof(wanted));
+    for (uint8_t d = 0; d < CHECK_DIVISIONS; d++)
+    {
+      for (uint8_t k = 0; k < 64; k++)
+      {
+        if (!held[d][k])
+        {
+          continue;
+        }
+        wanted[d][k] = true;
+        for (uint8_t c = 0; c < CHECK_COUPLERS; c++)
+        {
+          int target = k + checkCouplers[c].shift;
+          if ((stops & (1 << c)) && checkCouplers[c].from == d && target >= 0 && target < 64)
+          {
+            if (wanted[checkCouplers[c].to][target] && checkCouplers[c].to != d)
+            {
+              doubled++;
+            }
+            wanted[checkCouplers[c].to][target] = true;
+          }
+        }
+      }
+    }
+
+    for (uint8_t d = 0; d < CHECK_DIVISIONS; d++)
+    {
+      for (uint8_t k = 0; k < 64; k++)
+      {
+        bool on = (engine.sounding(d) >> k) & 1;
+        bool changed = (engine.changed(d) >> k) & 1;
+        if (on != wanted[d][k] || changed != (sounding[d][k] != wanted[d][k]))
+        {
+          wrong++;
+        }
+        if (changed)
+        {
+          // a note-on for a note already sounding, or an off for one that is not
+          if (on == sounding[d][k])
+          {
+            wrong++;
+          }
+          if (on)
+          {
+            noteOns++;
+          }
+          else
+          {
+            noteOffs++;
+          }
+        }
+        sounding[d][k] = wanted[d][k];
+      }
+    }
+  }
+  printf("random: %u steps, %u note-ons, %u note-offs, %u notes asked for twice, %u wrong: %s\n", count, noteOns,
+    noteOffs, doubled, wrong, wrong ? "FAIL" : "ok");
+  return wrong ? 1 : 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: coupler_check [-n steps] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned count = 20000;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      count = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  int failed = 0;
+  failed |= checkTable(verbose);
+  failed |= checkRandomSteps(count);
+  return failed;
+}
@@ -0,0 +1,155 @@
+/*
+  display_trace - the VFD bytes an organ sketch sends while a pot sweeps
+
+  usage: display_trace [-s seconds] [-p pot] [-t]
+
+  -s  length of the sweep, 5 seconds by default
+  -p  the pot swept, 0 to 3 (voice, velocity, cutoff, resonance), 2 by
+      default
+  -t  list every VFD byte with its time from the start of the sweep
+
+  Runs the sketch, lets the display settle, and then turns one pot from
+  one end to the other and back in the given time, the others at rest.
+  The table gives the VFD bytes sent during the sweep and after it, until
+  the display is still again, the time the VFD line was busy with them,
+  how many new values the sketch sent the synth for the pot (program
+  changes, channel volumes or NRPN data entries), and how long after the
+  end of the sweep the last byte went out.  Nothing is checked;
+  make display prints it for BASELINE and SKETCH.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+// how often the pot moves, finer than the sketches read it
+#define TRACE_POT_STEP_MS 5
+// idle time before the sweep and the longest the display may take after it
+#define TRACE_SETTLE_MS 1000
+// the sketches read 40 to 960 as 0 to 127
+#define TRACE_POT_LOW 0
+#define TRACE_POT_HIGH 1023
+
+// the pot's position at a time into the sweep: up, then back down
+static int position(double t, double length)
+{
+  double half = length / 2;
+  double x = t < half ? t / half : (length - t) / half;
+  return TRACE_POT_LOW + (int)(x * (TRACE_POT_HIGH - TRACE_POT_LOW) + 0.5);
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: display_trace [-s seconds] [-p pot] [-t]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  double seconds = 5;
+  unsigned pot = 2;
+  bool trace = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc)
+    {
+      seconds = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      pot = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-t"))
+    {
+      trace = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+  if (seconds <= 0 || pot > 3)
+  {
+    usage();
+  }
+
+  // the pot at its low end from the start, the others in the middle
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    sim.setAnalog(i, i == pot ? TRACE_POT_LOW : 512);
+  }
+  setup();
+  simRunLoop(sim.cycles() + ms(TRACE_SETTLE_MS));
+
+  size_t first = sim.vfd.bytes.size();
+  uint64_t start = sim.cycles();
+  uint64_t end = start + ms(seconds * 1000);
+  double length = seconds * 1000;
+  while (sim.cycles() < end)
+  {
+    sim.setAnalog(pot, position(msOf(sim.cycles() - start), length));
+    uint64_t step = sim.cycles() + ms(TRACE_POT_STEP_MS);
+    simRunLoop(step < end ? step : end);
+  }
+  simRunLoop(end + ms(TRACE_SETTLE_MS));
+
+  // the values the pot sent: the message each pot's change ends with
+  std::vector<SimByte> midi;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      midi.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(midi, messages);
+  unsigned values = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (pot == 0 ? m.type() == 0xc0 : m.type() == 0xb0 && m.data[0] == (pot == 1 ? 7 : 6))
+    {
+      values++;
+    }
+  }
+
+  const std::vector<SimByte> &bytes = sim.vfd.bytes;
+  unsigned during = 0;
+  unsigned after = 0;
+  uint64_t busy = 0;
+  uint64_t lastEnd = end;
+  for (size_t i = first; i < bytes.size(); i++)
+  {
+    if (bytes[i].start < end)
+    {
+      during++;
+    }
+    else
+    {
+      after++;
+    }
+    busy += bytes[i].end - bytes[i].start;
+    lastEnd = bytes[i].end > lastEnd ? bytes[i].end : lastEnd;
+    if (trace)
+    {
+      printf("  %10.3f ms  %02x\n", msOf(bytes[i].start - start), bytes[i].value);
+    }
+  }
+
+  printf("  %-8s %8s %8s %8s %8s %10s %10s\n", "sweep s", "values", "during", "after", "total", "busy ms",
+    "settle ms");
+  printf("  %-8.1f %8u %8u %8u %8u %10.1f %10.1f\n", seconds, values, during, after, during + after, msOf(busy),
+    msOf(lastEnd - end));
+  return 0;
+}
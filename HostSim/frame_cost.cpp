@@ -0,0 +1,145 @@
+/*
+  frame_cost - the time an organ sketch takes to draw its status screen
+
+  usage: frame_cost [-v]
+
+  -v  print the screen after the last frame
+
+  Runs the sketch past its start up screen, then draws the whole status
+  screen 256 times, calling updateDisplay() directly with every field
+  marked changed and the settings it shows set to new values from 0 to
+  127 each time, upper and lower in turn.  Between the frames loop()
+  runs for a frame time, so the display takes what was drawn.  The
+  cycles of each call are counted without the interrupts that came in
+  during it; the table gives the least, mean and most in microseconds.
+  Print::print() of a number is charged SIM_CYCLES_PRINT_DIGIT a digit
+  and a read from flash its lpm cycles, so a sketch that draws from
+  tables and one that prints numbers each pay for how they get their
+  characters.  The characters and cursor moves themselves go into the
+  VFD's frame in RAM, the same ones either way, and are free.  A
+  sketch that sends the frame to the display while it draws it, like
+  0.0.4, also has the VFD's bytes in its time.  make frame runs it for
+  BASELINE and SKETCH and lists the code and tables the two sketch
+  objects have for it, in host bytes.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "HostSim.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+typedef uint8_t byte;
+
+// what the status screen shows; weak, not every sketch has them
+extern byte setUpper __attribute__((weak));
+extern byte upperBank __attribute__((weak));
+extern byte lowerBank __attribute__((weak));
+extern byte upperVoice __attribute__((weak));
+extern byte lowerVoice __attribute__((weak));
+extern byte upperVelocity __attribute__((weak));
+extern byte lowerVelocity __attribute__((weak));
+extern byte upperCutoff __attribute__((weak));
+extern byte lowerCutoff __attribute__((weak));
+extern byte upperResonance __attribute__((weak));
+extern byte lowerResonance __attribute__((weak));
+// the fields a sketch that draws what changed will draw
+extern byte displayDirty __attribute__((weak));
+void updateDisplay() __attribute__((weak));
+
+// past the 5 s start up screen
+#define FRAME_STARTUP_MS 6000
+// the sketch's DISPLAY_FRAME_MS, or longer
+#define FRAME_MS 200
+#define FRAME_COUNT 256
+// every field, whatever bits the sketch gives them
+#define FRAME_ALL_FIELDS 0xff
+#define FRAME_COLUMNS 20
+
+static uint64_t interruptCycles()
+{
+  HostSim &sim = hostSim();
+  uint64_t total = 0;
+  for (int i = 0; i < SIM_NUM_VECTORS; i++)
+  {
+    total += sim.interruptCycles[i];
+  }
+  return total;
+}
+
+static void set(byte *setting, byte value)
+{
+  if (setting)
+  {
+    *setting = value;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool verbose = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      fprintf(stderr, "usage: frame_cost [-v]\n");
+      return 2;
+    }
+  }
+
+  if (!updateDisplay)
+  {
+    printf("  no updateDisplay()\n");
+    return 0;
+  }
+
+  setup();
+  simRunLoop(sim.cycles() + ms(FRAME_STARTUP_MS));
+
+  uint64_t least = ~(uint64_t)0;
+  uint64_t most = 0;
+  uint64_t total = 0;
+  for (unsigned frame = 0; frame < FRAME_COUNT; frame++)
+  {
+    // every value from 0 to 127 in each field, one to three digits
+    set(&setUpper, frame & 1);
+    set(&upperBank, frame >> 1 & 1);
+    set(&lowerBank, frame >> 2 & 1);
+    set(&upperVoice, frame * 37 % 128);
+    set(&lowerVoice, frame * 41 % 128);
+    set(&upperVelocity, frame * 43 % 128);
+    set(&lowerVelocity, frame * 47 % 128);
+    set(&upperCutoff, frame * 53 % 128);
+    set(&lowerCutoff, frame * 59 % 128);
+    set(&upperResonance, frame * 61 % 128);
+    set(&lowerResonance, frame * 67 % 128);
+    set(&displayDirty, FRAME_ALL_FIELDS);
+
+    uint64_t start = sim.cycles();
+    uint64_t interrupted = interruptCycles();
+    updateDisplay();
+    uint64_t cycles = sim.cycles() - start - (interruptCycles() - interrupted);
+    least = cycles < least ? cycles : least;
+    most = cycles > most ? cycles : most;
+    total += cycles;
+
+    simRunLoop(sim.cycles() + ms(FRAME_MS));
+  }
+
+  printf("  %d frames, updateDisplay() least %.1f us, mean %.1f us, most %.1f us\n", FRAME_COUNT,
+    least / (double)SIM_CYCLES_PER_MICROSECOND, total / (double)FRAME_COUNT / SIM_CYCLES_PER_MICROSECOND,
+    most / (double)SIM_CYCLES_PER_MICROSECOND);
+  if (verbose)
+  {
+    printf("    |%s|  |%s|\n", sim.vfd.line(0, FRAME_COLUMNS).c_str(), sim.vfd.line(1, FRAME_COLUMNS).c_str());
+  }
+  return 0;
+}
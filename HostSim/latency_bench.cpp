@@ -0,0 +1,526 @@
+/*
+  latency_bench - key contact to MIDI latency of an organ sketch on HostSim
+
+  usage: latency_bench [-p pattern]... [-w] [-g p99_us] [-q | -s]
+
+  -p  run only the named pattern; may be given more than once
+  -w  keep all four pots turning while the patterns play, so controller
+      messages compete with the notes for the MIDI line
+  -g  regression gate: exit 1 if any pattern's note-on p99 exceeds this
+  -q  leave out the histograms
+  -s  summary only: note-on p99/max of each pattern and the worst case
+
+  Each key press is followed through the chain
+    scan wait   contact closes -> the shift register load that sees it
+    dispatch    that load -> first byte of the note-on leaves pin 4
+    wire        first byte -> last byte of the note-on
+  and note-on/note-off are measured from the contact change to the first
+  byte of the message.  Repeated note-ons for a key that is already
+  sounding are counted; they cost wire time and delay everything else.
+
+  The bus scan time is measured from the load pulse to the clock edge that
+  shifts out the last bit.  The note event signature is a hash of the
+  on/off sequence of every channel/note, repeats folded, so two sketches
+  that see the same key states print the same signature.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+// how the organ sketches map buses to MIDI: lower is channel 1, upper channel 0
+#define BENCH_NUM_BUSES 2
+static const uint8_t busChannel[BENCH_NUM_BUSES] = { 1, 0 };
+#define BENCH_LOWEST_NOTE 36
+#define BENCH_NUM_KEYS 64
+
+// idle time before and after each pattern
+#define BENCH_GAP_MS 300
+
+struct BenchKey
+{
+  uint64_t cycle;
+  uint8_t bus;
+  uint8_t key;
+  bool pressed;
+};
+
+//---------------------------------------------------------------------------------------------//
+// patterns
+// times are spread with a fixed pseudo random offset so the presses land
+// on every phase of the scan cycle, and every run is the same
+//---------------------------------------------------------------------------------------------//
+static unsigned long benchRandomState = 12345;
+
+static unsigned long benchRandom(unsigned long range)
+{
+  benchRandomState = benchRandomState * 1103515245UL + 12345UL;
+  return ((benchRandomState >> 16) & 0x7fff) % range;
+}
+
+static void hold(std::vector<BenchKey> &keys, uint64_t on, uint64_t off, uint8_t bus, uint8_t key)
+{
+  BenchKey press = { on, bus, key, true };
+  BenchKey release = { off, bus, key, false };
+  keys.push_back(press);
+  keys.push_back(release);
+}
+
+// pick n different keys
+static void chooseKeys(uint8_t *chosen, uint8_t n)
+{
+  uint64_t used = 0;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    uint8_t key;
+    do
+    {
+      key = benchRandom(BENCH_NUM_KEYS);
+    } while (used & ((uint64_t)1 << key));
+    used |= (uint64_t)1 << key;
+    chosen[i] = key;
+  }
+}
+
+// one key at a time, alternating manuals
+static uint64_t patternSingle(std::vector<BenchKey> &keys, uint64_t start)
+{
+  uint64_t t = start;
+  for (uint8_t i = 0; i < 96; i++)
+  {
+    uint64_t on = t + ms(benchRandom(2000) / 100.0);
+    hold(keys, on, on + ms(120), i % 2, (i * 37) % BENCH_NUM_KEYS);
+    t += ms(250);
+  }
+  return t;
+}
+
+// 10 note chords, alternating manuals
+static uint64_t patternChord(std::vector<BenchKey> &keys, uint64_t start)
+{
+  uint64_t t = start;
+  for (uint8_t i = 0; i < 24; i++)
+  {
+    uint8_t chord[10];
+    chooseKeys(chord, 10);
+    uint64_t on = t + ms(benchRandom(2000) / 100.0);
+    for (uint8_t k = 0; k < 10; k++)
+    {
+      hold(keys, on, on + ms(150), i % 2, chord[k]);
+    }
+    t += ms(400);
+  }
+  return t;
+}
+
+// all 64 keys up and down, overlapping like a real glissando
+static uint64_t patternGlissando(std::vector<BenchKey> &keys, uint64_t start)
+{
+  uint64_t t = start + ms(benchRandom(2000) / 100.0);
+  for (uint8_t pass = 0; pass < 4; pass++)
+  {
+    for (uint8_t k = 0; k < BENCH_NUM_KEYS; k++)
+    {
+      uint8_t key = (pass % 2) ? (BENCH_NUM_KEYS - 1 - k) : k;
+      hold(keys, t, t + ms(40), (pass / 2) % 2, key);
+      t += ms(12);
+    }
+    t += ms(300);
+  }
+  return t;
+}
+
+// a 10 note chord on each manual at the same moment
+static uint64_t patternBoth(std::vector<BenchKey> &keys, uint64_t start)
+{
+  uint64_t t = start;
+  for (uint8_t i = 0; i < 24; i++)
+  {
+    uint8_t lower[10];
+    uint8_t upper[10];
+    chooseKeys(lower, 10);
+    chooseKeys(upper, 10);
+    uint64_t on = t + ms(benchRandom(2000) / 100.0);
+    for (uint8_t k = 0; k < 10; k++)
+    {
+      hold(keys, on, on + ms(200), 0, lower[k]);
+      hold(keys, on, on + ms(200), 1, upper[k]);
+    }
+    t += ms(500);
+  }
+  return t;
+}
+
+struct BenchPattern
+{
+  const char *name;
+  const char *description;
+  uint64_t (*build)(std::vector<BenchKey> &keys, uint64_t start);
+};
+
+static const BenchPattern patterns[] =
+{
+  { "single", "single keys, alternating manuals", patternSingle },
+  { "chord", "10 note chords", patternChord },
+  { "glissando", "glissandi over all 64 keys", patternGlissando },
+  { "both", "10 note chords on both manuals at once", patternBoth },
+};
+#define BENCH_NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+//---------------------------------------------------------------------------------------------//
+// analysis
+//---------------------------------------------------------------------------------------------//
+static std::vector<SimMidiMessage> messages;
+// note-ons and note-offs for each channel/note, in time order
+static std::vector<size_t> noteOns[16][128];
+static std::vector<size_t> noteOffs[16][128];
+
+static void indexMessages()
+{
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (m.isNoteOn())
+    {
+      noteOns[m.channel()][m.data[0] & 0x7f].push_back(i);
+    }
+    else if (m.isNoteOff())
+    {
+      noteOffs[m.channel()][m.data[0] & 0x7f].push_back(i);
+    }
+  }
+}
+
+// first message in the list starting at or after the cycle
+static const SimMidiMessage *firstAfter(const std::vector<size_t> &list, uint64_t cycle)
+{
+  size_t lo = 0;
+  size_t hi = list.size();
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (messages[list[mid]].start < cycle)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo < list.size() ? &messages[list[lo]] : 0;
+}
+
+static size_t countBetween(const std::vector<size_t> &list, uint64_t from, uint64_t to)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    uint64_t start = messages[list[i]].start;
+    if (start > from && start < to)
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+// first shift register load at or after the cycle with the bus driven
+static const SimLoad *latchAfter(uint64_t cycle, uint8_t bus)
+{
+  const std::vector<SimLoad> &loads = hostSim().shiftChain.loads;
+  size_t lo = 0;
+  size_t hi = loads.size();
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (loads[mid].cycle < cycle)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  for (; lo < loads.size(); lo++)
+  {
+    if (loads[lo].busMask & (1 << bus))
+    {
+      return &loads[lo];
+    }
+  }
+  return 0;
+}
+
+struct BenchResult
+{
+  SimHistogram scan;
+  SimHistogram dispatch;
+  SimHistogram wire;
+  SimHistogram noteOn;
+  SimHistogram noteOff;
+  unsigned lost;
+  unsigned repeated;
+};
+
+static void analyze(const std::vector<BenchKey> &keys, BenchResult &result)
+{
+  result.lost = 0;
+  result.repeated = 0;
+
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    const BenchKey &k = keys[i];
+    uint8_t channel = busChannel[k.bus];
+    uint8_t note = BENCH_LOWEST_NOTE + k.key;
+
+    if (!k.pressed)
+    {
+      const SimMidiMessage *off = firstAfter(noteOffs[channel][note], k.cycle);
+      if (off)
+      {
+        result.noteOff.add(us(off->start - k.cycle));
+      }
+      else
+      {
+        result.lost++;
+      }
+      continue;
+    }
+
+    const SimMidiMessage *on = firstAfter(noteOns[channel][note], k.cycle);
+    if (!on)
+    {
+      result.lost++;
+      continue;
+    }
+    result.noteOn.add(us(on->start - k.cycle));
+    result.wire.add(us(on->end - on->start));
+
+    const SimLoad *latch = latchAfter(k.cycle, k.bus);
+    if (latch && latch->cycle <= on->start)
+    {
+      result.scan.add(us(latch->cycle - k.cycle));
+      result.dispatch.add(us(on->start - latch->cycle));
+    }
+
+    // note-ons sent again before the key's note-off
+    const SimMidiMessage *off = firstAfter(noteOffs[channel][note], on->start);
+    uint64_t until = off ? off->start : hostSim().cycles();
+    result.repeated += countBetween(noteOns[channel][note], on->start, until);
+  }
+}
+
+// FNV-1a over the note-on/note-off sequence of every channel/note
+static unsigned long eventSignature()
+{
+  uint32_t hash = 2166136261UL;
+  for (uint8_t channel = 0; channel < 16; channel++)
+  {
+    for (uint8_t note = 0; note < 128; note++)
+    {
+      // merge the two time ordered lists, folding repeats
+      const std::vector<size_t> &ons = noteOns[channel][note];
+      const std::vector<size_t> &offs = noteOffs[channel][note];
+      size_t i = 0;
+      size_t j = 0;
+      int last = -1;
+      while (i < ons.size() || j < offs.size())
+      {
+        int on = (j == offs.size()) || (i < ons.size() && ons[i] < offs[j]);
+        if (on)
+        {
+          i++;
+        }
+        else
+        {
+          j++;
+        }
+        if (on == last)
+        {
+          continue;
+        }
+        last = on;
+        uint8_t event[3] = { channel, note, (uint8_t)on };
+        for (uint8_t k = 0; k < 3; k++)
+        {
+          hash = (hash ^ event[k]) * 16777619UL;
+        }
+      }
+    }
+  }
+  return hash;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: latency_bench [-p pattern]... [-w] [-g p99_us] [-q | -s]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool selected[BENCH_NUM_PATTERNS] = { false };
+  bool anySelected = false;
+  double gate = 0;
+  bool quiet = false;
+  bool summary = false;
+  bool sweep = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      i++;
+      size_t p;
+      for (p = 0; p < BENCH_NUM_PATTERNS; p++)
+      {
+        if (!strcmp(argv[i], patterns[p].name))
+        {
+          selected[p] = true;
+          anySelected = true;
+          break;
+        }
+      }
+      if (p == BENCH_NUM_PATTERNS)
+      {
+        usage();
+      }
+    }
+    else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+    {
+      gate = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-w"))
+    {
+      sweep = true;
+    }
+    else if (!strcmp(argv[i], "-q"))
+    {
+      quiet = true;
+    }
+    else if (!strcmp(argv[i], "-s"))
+    {
+      summary = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+
+  // play every pattern in turn, with quiet time in between
+  std::vector<BenchKey> keys[BENCH_NUM_PATTERNS];
+  for (size_t p = 0; p < BENCH_NUM_PATTERNS; p++)
+  {
+    if (anySelected && !selected[p])
+    {
+      continue;
+    }
+    uint64_t start = sim.cycles() + ms(BENCH_GAP_MS);
+    uint64_t end = patterns[p].build(keys[p], start);
+    for (size_t i = 0; i < keys[p].size(); i++)
+    {
+      sim.scheduleKey(keys[p][i].cycle, keys[p][i].bus, keys[p][i].key, keys[p][i].pressed);
+    }
+    // with -w the pots keep turning
+    if (sweep)
+    {
+      simRunLoopSweeping(end + ms(BENCH_GAP_MS));
+    }
+    else
+    {
+      simRunLoop(end + ms(BENCH_GAP_MS));
+    }
+  }
+
+  simParseMidi(sim.midiOut.bytes(), messages);
+  indexMessages();
+
+  SimHistogram scanTime;
+  const std::vector<SimLoad> &loads = sim.shiftChain.loads;
+  for (size_t i = 0; i < loads.size(); i++)
+  {
+    if (loads[i].shifted)
+    {
+      scanTime.add(us(loads[i].shifted - loads[i].start));
+    }
+  }
+  printf("%u bus scans, note event signature %08lx\n", (unsigned)scanTime.count(), eventSignature());
+  printf("  %-18s %10s %10s %10s\n", "us", "p50", "p99", "max");
+  scanTime.printRow("bus scan");
+  if (summary)
+  {
+    printf("  %-18s %10s %10s %10s\n", "note-on us", "p50", "p99", "max");
+  }
+  else
+  {
+    printf("\n");
+  }
+
+  int failed = 0;
+  double worst = 0;
+  const char *worstPattern = "none";
+  for (size_t p = 0; p < BENCH_NUM_PATTERNS; p++)
+  {
+    if (keys[p].empty())
+    {
+      continue;
+    }
+    BenchResult result;
+    analyze(keys[p], result);
+    if (result.noteOn.max() > worst)
+    {
+      worst = result.noteOn.max();
+      worstPattern = patterns[p].name;
+    }
+
+    if (summary)
+    {
+      result.noteOn.printRow(patterns[p].name);
+    }
+    else
+    {
+      printf("pattern %s: %s\n", patterns[p].name, patterns[p].description);
+      printf("  %u key changes, %u without a MIDI message, %u repeated note-ons\n",
+        (unsigned)keys[p].size(), result.lost, result.repeated);
+      printf("  %-18s %10s %10s %10s\n", "us", "p50", "p99", "max");
+      result.scan.printRow("scan wait");
+      result.dispatch.printRow("dispatch");
+      result.wire.printRow("wire");
+      result.noteOn.printRow("note-on");
+      result.noteOff.printRow("note-off");
+      if (!quiet)
+      {
+        result.noteOn.printHistogram("note-on latency", "us");
+      }
+      printf("\n");
+    }
+
+    if (gate > 0 && result.noteOn.percentile(99) > gate)
+    {
+      printf("FAIL: %s note-on p99 %.1f us is over %.1f us\n\n", patterns[p].name, result.noteOn.percentile(99), gate);
+      failed = 1;
+    }
+    if (result.lost)
+    {
+      printf("FAIL: %s lost %u key changes\n\n", patterns[p].name, result.lost);
+      failed = 1;
+    }
+  }
+  printf("worst case note-on %.1f us (%s)\n", worst, worstPattern);
+  return failed;
+}
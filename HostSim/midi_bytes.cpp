@@ -0,0 +1,160 @@
+/*
+  midi_bytes - MIDI bytes an organ sketch sends for recorded performances
+
+  usage: midi_bytes [-g percent] performance...
+
+  -g  regression gate: exit 1 if running status saves less than this
+      percentage of the bytes on any performance
+
+  A performance file lists key holds, one per line, as
+    bus key on_ms off_ms
+  with bus 0 the lower manual and 1 the upper, times from the start of
+  the performance; lines starting with # are comments.  The ones that
+  come with HostSim are in performances/.
+
+  Each performance is played twice through the sketch, first with the
+  sketch's Fluxamasynth sending every status byte, then with running
+  status.  For both runs the bytes on pin 4 are counted, and the note
+  events decoded from them (note-on velocity 0 taken as note-off) have to
+  be the same.  The exit status is 1 if they are not.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "Fluxamasynth.h"
+
+// the sketch's synth
+extern Fluxamasynth synth;
+
+// idle time before and after each run, long enough for the line to drain
+#define BYTES_GAP_MS 500
+
+struct BytesRun
+{
+  unsigned bytes;
+  unsigned noteEvents;
+  unsigned statusBytes;
+  std::vector<uint32_t> notes;
+};
+
+// play the holds and decode what came out
+static void play(const std::vector<SimHold> &holds, BytesRun &run)
+{
+  HostSim &sim = hostSim();
+  uint64_t start = sim.cycles() + ms(BYTES_GAP_MS);
+  double lastMs = 0;
+  for (size_t i = 0; i < holds.size(); i++)
+  {
+    sim.scheduleKey(start + ms(holds[i].onMs), holds[i].bus, holds[i].key, true);
+    sim.scheduleKey(start + ms(holds[i].offMs), holds[i].bus, holds[i].key, false);
+    if (holds[i].offMs > lastMs)
+    {
+      lastMs = holds[i].offMs;
+    }
+  }
+  simRunLoop(start + ms(lastMs + BYTES_GAP_MS));
+
+  std::vector<SimByte> bytes;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      bytes.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(bytes, messages);
+
+  run.bytes = bytes.size();
+  run.noteEvents = 0;
+  run.statusBytes = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (!m.runningStatus)
+    {
+      run.statusBytes++;
+    }
+    if (m.isNoteOn() || m.isNoteOff())
+    {
+      run.noteEvents++;
+      run.notes.push_back((m.channel() << 8) | (m.data[0] & 0x7f) | (m.isNoteOn() ? 0x80 : 0));
+    }
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: midi_bytes [-g percent] performance...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  double gate = 0;
+  std::vector<const char *> paths;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-g") && i + 1 < argc)
+    {
+      gate = atof(argv[++i]);
+    }
+    else if (argv[i][0] == '-')
+    {
+      usage();
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty())
+  {
+    usage();
+  }
+
+  setup();
+
+  int failed = 0;
+  printf("  %-14s %8s %10s %10s %8s %10s %8s\n", "performance", "notes", "full", "running", "saved", "status", "same");
+  for (size_t p = 0; p < paths.size(); p++)
+  {
+    std::vector<SimHold> holds;
+    if (!simLoadPerformance(paths[p], holds))
+    {
+      return 2;
+    }
+    BytesRun full;
+    BytesRun running;
+    synth.setRunningStatus(0);
+    play(holds, full);
+    synth.setRunningStatus(1);
+    play(holds, running);
+
+    const char *name = strrchr(paths[p], '/') ? strrchr(paths[p], '/') + 1 : paths[p];
+    double saved = full.bytes ? 100.0 * (full.bytes - (double)running.bytes) / full.bytes : 0;
+    bool same = full.notes == running.notes && full.noteEvents == 2 * holds.size();
+    printf("  %-14s %8u %10u %10u %7.1f%% %10u %8s\n", name, full.noteEvents, full.bytes, running.bytes,
+      saved, running.statusBytes, same ? "yes" : "NO");
+    if (!same)
+    {
+      failed = 1;
+    }
+    if (gate > 0 && saved < gate)
+    {
+      printf("FAIL: %s saves %.1f%%, less than %.1f%%\n", name, saved, gate);
+      failed = 1;
+    }
+  }
+  return failed;
+}
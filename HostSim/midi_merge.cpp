@@ -0,0 +1,568 @@
+/*
+  midi_merge - an external controller on MIDI in, merged with the organ's keys
+
+  usage: midi_merge [-g max_us] [-k performance] recording...
+
+  -g  regression gate: exit 1 if a message from MIDI in takes longer than
+      this from its last byte in to its last byte out to the synth
+  -k  the keys played meanwhile, a performance file as for midi_bytes
+      (performances/stabs.txt by default)
+
+  A recording is a standard MIDI file, format 0 or 1; the ones that come
+  with HostSim are in recordings/.  Its channel messages, system common
+  and system exclusive messages are sent into the USART's receive pin at
+  31250 baud and at the times the file gives, using running status the
+  way a controller would, while the performance is played on the keys.
+  The sketch runs as usual.  Notes on channels 0 and 1 are left out of a
+  recording, those are the organ's own.
+
+  The bytes on pin 4 are split into messages.  The ones that are not the
+  organ's notes have to be the recording's messages, whole and in order,
+  except for system exclusive messages too long for the MidiIn buffer,
+  which have to be missing.  The organ's notes have to be the same as
+  when the performance is played with nothing on MIDI in.  The exit
+  status is 1 if either check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "Arduino.h"
+#include "MidiIn.h"
+// Arduino.h's, in the way of SimHistogram::max()
+#undef min
+#undef max
+
+// the organ's channels, upper and lower manual
+#define MERGE_LOCAL_CHANNELS 2
+// idle time before and after each run, long enough for the line to drain
+#define MERGE_GAP_MS 500
+
+// a message of a recording, status byte always included
+struct MergeMessage
+{
+  double ms;
+  std::vector<uint8_t> bytes;
+};
+
+struct MergeRun
+{
+  // the organ's note events and their latency from the key contact
+  std::vector<uint32_t> notes;
+  SimHistogram noteLatency;
+  // the other messages on pin 4, with the end of their last byte
+  std::vector<std::vector<uint8_t> > passed;
+  std::vector<uint64_t> passedEnd;
+};
+
+static const char *baseName(const char *path)
+{
+  return strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+}
+
+//---------------------------------------------------------------------------------------------//
+// standard MIDI files
+//---------------------------------------------------------------------------------------------//
+struct MergeFileEvent
+{
+  uint32_t tick;
+  // 0 for a message, else the new tempo in microseconds a quarter note
+  uint32_t tempo;
+  std::vector<uint8_t> bytes;
+};
+
+static bool eventBefore(const MergeFileEvent &a, const MergeFileEvent &b)
+{
+  return a.tick < b.tick;
+}
+
+class MergeReader
+{
+  public:
+    MergeReader(const std::vector<uint8_t> &data, size_t pos, size_t end) : _data(data), _pos(pos), _end(end) {}
+    bool done() const { return _pos >= _end; }
+    bool byte(uint8_t &value)
+    {
+      if (_pos >= _end)
+      {
+        return false;
+      }
+      value = _data[_pos++];
+      return true;
+    }
+    bool variable(uint32_t &value)
+    {
+      value = 0;
+      for (uint8_t i = 0; i < 4; i++)
+      {
+        uint8_t b;
+        if (!byte(b))
+        {
+          return false;
+        }
+        value = (value << 7) | (b & 0x7f);
+        if (!(b & 0x80))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  private:
+    const std::vector<uint8_t> &_data;
+    size_t _pos;
+    size_t _end;
+};
+
+static uint32_t bigEndian(const std::vector<uint8_t> &data, size_t pos, uint8_t bytes)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < bytes; i++)
+  {
+    value = (value << 8) | data[pos + i];
+  }
+  return value;
+}
+
+static bool readTrack(MergeReader &track, std::vector<MergeFileEvent> &events)
+{
+  uint32_t tick = 0;
+  uint8_t running = 0;
+  while (!track.done())
+  {
+    uint32_t delta;
+    uint8_t status;
+    if (!track.variable(delta) || !track.byte(status))
+    {
+      return false;
+    }
+    tick += delta;
+    MergeFileEvent event;
+    event.tick = tick;
+    event.tempo = 0;
+
+    if (status == 0xff)
+    {
+      uint8_t type;
+      uint32_t length;
+      if (!track.byte(type) || !track.variable(length))
+      {
+        return false;
+      }
+      std::vector<uint8_t> data(length);
+      for (uint32_t i = 0; i < length; i++)
+      {
+        if (!track.byte(data[i]))
+        {
+          return false;
+        }
+      }
+      running = 0;
+      if (type == 0x2f)
+      {
+        return true;
+      }
+      if (type == 0x51 && length == 3)
+      {
+        event.tempo = (data[0] << 16) | (data[1] << 8) | data[2];
+        events.push_back(event);
+      }
+      continue;
+    }
+    if (status == 0xf0 || status == 0xf7)
+    {
+      // F7 escapes can split a message or carry real time bytes, the
+      // recordings do not use them
+      uint32_t length;
+      if (status == 0xf7 || !track.variable(length))
+      {
+        return false;
+      }
+      event.bytes.push_back(0xf0);
+      for (uint32_t i = 0; i < length; i++)
+      {
+        uint8_t b;
+        if (!track.byte(b))
+        {
+          return false;
+        }
+        event.bytes.push_back(b);
+      }
+      running = 0;
+      events.push_back(event);
+      continue;
+    }
+
+    if (status & 0x80)
+    {
+      running = status < 0xf0 ? status : 0;
+      event.bytes.push_back(status);
+      uint8_t need = simMidiDataLength(status);
+      for (uint8_t i = 0; i < need; i++)
+      {
+        uint8_t b;
+        if (!track.byte(b))
+        {
+          return false;
+        }
+        event.bytes.push_back(b);
+      }
+    }
+    else
+    {
+      if (!running)
+      {
+        return false;
+      }
+      // running status, this was the first data byte
+      event.bytes.push_back(running);
+      event.bytes.push_back(status);
+      if (simMidiDataLength(running) == 2)
+      {
+        uint8_t b;
+        if (!track.byte(b))
+        {
+          return false;
+        }
+        event.bytes.push_back(b);
+      }
+    }
+    events.push_back(event);
+  }
+  return false;
+}
+
+static bool loadRecording(const char *path, std::vector<MergeMessage> &messages)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> data;
+  int c;
+  while ((c = fgetc(f)) != EOF)
+  {
+    data.push_back(c);
+  }
+  fclose(f);
+
+  if (data.size() < 14 || memcmp(&data[0], "MThd", 4) || bigEndian(data, 4, 4) < 6)
+  {
+    fprintf(stderr, "%s: not a standard MIDI file\n", path);
+    return false;
+  }
+  uint16_t format = bigEndian(data, 8, 2);
+  uint16_t tracks = bigEndian(data, 10, 2);
+  uint16_t division = bigEndian(data, 12, 2);
+  if (format > 1 || (division & 0x8000) || division == 0)
+  {
+    fprintf(stderr, "%s: only format 0 and 1 with ticks per quarter note\n", path);
+    return false;
+  }
+
+  // all the tracks' events, in time order, tracks in file order at the same tick
+  std::vector<MergeFileEvent> events;
+  size_t pos = 8 + bigEndian(data, 4, 4);
+  for (uint16_t t = 0; t < tracks; t++)
+  {
+    if (pos + 8 > data.size() || memcmp(&data[pos], "MTrk", 4))
+    {
+      fprintf(stderr, "%s: track %u missing\n", path, t);
+      return false;
+    }
+    size_t length = bigEndian(data, pos + 4, 4);
+    if (pos + 8 + length > data.size())
+    {
+      fprintf(stderr, "%s: track %u cut short\n", path, t);
+      return false;
+    }
+    MergeReader track(data, pos + 8, pos + 8 + length);
+    if (!readTrack(track, events))
+    {
+      fprintf(stderr, "%s: track %u has an event this reader does not take\n", path, t);
+      return false;
+    }
+    pos += 8 + length;
+  }
+  std::stable_sort(events.begin(), events.end(), eventBefore);
+
+  // ticks to milliseconds through the tempo changes, 120 beats a minute to start with
+  double msPerTick = 500.0 / division;
+  double atMs = 0;
+  uint32_t atTick = 0;
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    atMs += (events[i].tick - atTick) * msPerTick;
+    atTick = events[i].tick;
+    if (events[i].tempo)
+    {
+      msPerTick = events[i].tempo / 1000.0 / division;
+      continue;
+    }
+    const std::vector<uint8_t> &bytes = events[i].bytes;
+    if ((bytes[0] & 0xe0) == 0x80 && (bytes[0] & 0x0f) < MERGE_LOCAL_CHANNELS)
+    {
+      fprintf(stderr, "%s: notes on channel %u, the organ's own\n", path, bytes[0] & 0x0f);
+      return false;
+    }
+    MergeMessage message = { atMs, bytes };
+    messages.push_back(message);
+  }
+  return true;
+}
+
+//---------------------------------------------------------------------------------------------//
+// the runs
+//---------------------------------------------------------------------------------------------//
+
+// send the messages into the USART as a controller would, with running
+// status; wire gets the number of bytes each took
+static void sendRecording(uint64_t start, const std::vector<MergeMessage> &messages, std::vector<size_t> &wire)
+{
+  HostSim &sim = hostSim();
+  uint8_t running = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const std::vector<uint8_t> &bytes = messages[i].bytes;
+    size_t first = 0;
+    if (bytes[0] < 0xf0 && bytes[0] == running)
+    {
+      first = 1;
+    }
+    running = bytes[0] < 0xf0 ? bytes[0] : 0;
+    for (size_t b = first; b < bytes.size(); b++)
+    {
+      sim.midiIn.schedule(start + ms(messages[i].ms), bytes[b]);
+    }
+    wire.push_back(bytes.size() - first);
+  }
+}
+
+static void play(const std::vector<SimHold> &holds, const std::vector<MergeMessage> &messages,
+  std::vector<uint64_t> &inEnd, MergeRun &run)
+{
+  HostSim &sim = hostSim();
+  uint64_t start = sim.cycles() + ms(MERGE_GAP_MS);
+
+  // the key contacts, in time order, to match the note events with
+  std::vector<SimKeyEvent> contacts;
+  double lastMs = 0;
+  for (size_t i = 0; i < holds.size(); i++)
+  {
+    SimKeyEvent on = { start + ms(holds[i].onMs), holds[i].bus, holds[i].key, true };
+    SimKeyEvent off = { start + ms(holds[i].offMs), holds[i].bus, holds[i].key, false };
+    sim.scheduleKey(on.cycle, on.bus, on.key, true);
+    sim.scheduleKey(off.cycle, off.bus, off.key, false);
+    contacts.push_back(on);
+    contacts.push_back(off);
+    lastMs = std::max(lastMs, holds[i].offMs);
+  }
+  if (!messages.empty())
+  {
+    lastMs = std::max(lastMs, messages.back().ms);
+  }
+
+  size_t firstIn = sim.midiIn.bytes.size();
+  std::vector<size_t> wire;
+  sendRecording(start, messages, wire);
+  simRunLoop(start + ms(lastMs + MERGE_GAP_MS));
+
+  // the end of the last byte of each message at the receive pin
+  size_t at = firstIn;
+  for (size_t i = 0; i < wire.size(); i++)
+  {
+    at += wire[i];
+    inEnd.push_back(sim.midiIn.bytes[at - 1].end);
+  }
+
+  std::vector<SimByte> bytes;
+  std::map<uint64_t, size_t> index;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      index[all[i].start] = bytes.size();
+      bytes.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> out;
+  simParseMidi(bytes, out);
+
+  std::vector<bool> matched(contacts.size(), false);
+  for (size_t i = 0; i < out.size(); i++)
+  {
+    const SimMidiMessage &m = out[i];
+    if ((m.isNoteOn() || m.isNoteOff()) && m.channel() < MERGE_LOCAL_CHANNELS)
+    {
+      run.notes.push_back((m.channel() << 8) | (m.data[0] & 0x7f) | (m.isNoteOn() ? 0x80 : 0));
+      // the sketch plays the upper manual on channel 0, the lower on 1, from note 36
+      uint8_t bus = m.channel() == 0 ? 1 : 0;
+      for (size_t c = 0; c < contacts.size(); c++)
+      {
+        if (!matched[c] && contacts[c].bus == bus && contacts[c].key + 36 == m.data[0]
+          && contacts[c].pressed == m.isNoteOn() && contacts[c].cycle <= m.start)
+        {
+          matched[c] = true;
+          run.noteLatency.add(us(m.start - contacts[c].cycle));
+          break;
+        }
+      }
+      continue;
+    }
+
+    // put the message back together, status included
+    std::vector<uint8_t> whole;
+    if (m.status == 0xf0)
+    {
+      size_t first = index[m.start];
+      for (size_t b = first; b < first + m.length; b++)
+      {
+        whole.push_back(bytes[b].value);
+      }
+    }
+    else
+    {
+      whole.push_back(m.status);
+      for (uint8_t d = 0; d < simMidiDataLength(m.status); d++)
+      {
+        whole.push_back(m.data[d]);
+      }
+    }
+    run.passed.push_back(whole);
+    run.passedEnd.push_back(m.end);
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: midi_merge [-g max_us] [-k performance] recording...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  double gate = 0;
+  const char *performance = "performances/stabs.txt";
+  std::vector<const char *> paths;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-g") && i + 1 < argc)
+    {
+      gate = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+    {
+      performance = argv[++i];
+    }
+    else if (argv[i][0] == '-')
+    {
+      usage();
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty())
+  {
+    usage();
+  }
+
+  std::vector<SimHold> holds;
+  if (!simLoadPerformance(performance, holds))
+  {
+    return 2;
+  }
+
+  setup();
+
+  // the keys alone, the notes every merged run has to reproduce
+  std::vector<MergeMessage> none;
+  std::vector<uint64_t> noneEnd;
+  MergeRun alone;
+  play(holds, none, noneEnd, alone);
+
+  int failed = 0;
+  printf("keys: %s, %u note events\n\n", baseName(performance), (unsigned)alone.notes.size());
+  printf("  %-14s %8s %8s %8s %10s %10s %10s %10s %10s %6s\n", "recording", "messages", "passed", "dropped",
+    "merge p50", "merge p99", "merge max", "keys p99", "keys max", "same");
+  printf("  %-14s %8s %8s %8s %10s %10s %10s %10.1f %10.1f %6s\n", "(none)", "-", "-", "-", "-", "-", "-",
+    alone.noteLatency.percentile(99), alone.noteLatency.max(), "-");
+
+  for (size_t p = 0; p < paths.size(); p++)
+  {
+    std::vector<MergeMessage> messages;
+    if (!loadRecording(paths[p], messages))
+    {
+      return 2;
+    }
+    uint32_t lostBefore = Serial.dropped + sim.midiIn.overruns;
+    std::vector<uint64_t> inEnd;
+    MergeRun merged;
+    play(holds, messages, inEnd, merged);
+
+    // what has to come out: everything but what MidiIn can not hold
+    std::vector<std::vector<uint8_t> > expected;
+    std::vector<uint64_t> expectedIn;
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+      if (messages[i].bytes.size() <= MIDI_IN_BUFFER_SIZE)
+      {
+        expected.push_back(messages[i].bytes);
+        expectedIn.push_back(inEnd[i]);
+      }
+    }
+
+    SimHistogram latency;
+    bool whole = merged.passed == expected;
+    if (whole)
+    {
+      for (size_t i = 0; i < expected.size(); i++)
+      {
+        latency.add(us(merged.passedEnd[i] - expectedIn[i]));
+      }
+    }
+    unsigned dropped = messages.size() - merged.passed.size();
+    unsigned lost = Serial.dropped + sim.midiIn.overruns - lostBefore;
+    bool same = merged.notes == alone.notes;
+    printf("  %-14s %8u %8u %8u %10.1f %10.1f %10.1f %10.1f %10.1f %6s\n", baseName(paths[p]),
+      (unsigned)messages.size(), (unsigned)merged.passed.size(), dropped, latency.percentile(50),
+      latency.percentile(99), latency.max(), merged.noteLatency.percentile(99), merged.noteLatency.max(),
+      same ? "yes" : "NO");
+
+    if (!whole || lost)
+    {
+      printf("FAIL: %s: the messages passed on are not the recording's (%u bytes lost on the way in)\n",
+        baseName(paths[p]), lost);
+      failed = 1;
+    }
+    if (!same)
+    {
+      printf("FAIL: %s: the organ's notes changed\n", baseName(paths[p]));
+      failed = 1;
+    }
+    if (gate > 0 && latency.max() > gate)
+    {
+      printf("FAIL: %s: a message took %.1f us to pass through, more than %.1f us\n", baseName(paths[p]),
+        latency.max(), gate);
+      failed = 1;
+    }
+  }
+  return failed;
+}
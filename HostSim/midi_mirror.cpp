@@ -0,0 +1,177 @@
+/*
+  midi_mirror - the MIDI an organ sketch sends out of the USART next to the synth's
+
+  usage: midi_mirror [-b baud]... performance...
+
+  -b  USART speed to try, 31250 (MIDI out jack) and 115200 (serial-MIDI
+      bridge) by default
+
+  Each performance (see midi_bytes) is played through the sketch at each
+  speed, with all four pots turning, so the stream has notes, the
+  controller messages priority scheduling lets out in between and NRPNs.
+  The sketch sends everything to the Fluxamasynth on pin 4 and mirrors it
+  to Serial.
+
+  The two streams have to be the same bytes.  For each byte, the time its
+  start bit went out on the USART is compared with the time it did on pin
+  4: the USART copy must not start more than a bit time of the synth's
+  line after it, so a computer recording it hears nothing later than the
+  synth plays it, and at 31250 baud, where both lines carry the same
+  number of bytes a second, not more than one byte time before it.  The
+  exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "Arduino.h"
+// Arduino.h's, in the way of SimHistogram::max()
+#undef min
+#undef max
+
+// idle time before and after each run, long enough for the lines to drain
+#define MIRROR_GAP_MS 500
+// one bit and one byte on the synth's line
+#define MIRROR_SYNTH_BIT_CYCLES (SIM_F_CPU / SIM_MIDI_BAUD)
+#define MIRROR_SYNTH_FRAME_CYCLES (10 * MIRROR_SYNTH_BIT_CYCLES)
+
+static void usage()
+{
+  fprintf(stderr, "usage: midi_mirror [-b baud]... performance...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  std::vector<long> bauds;
+  std::vector<const char *> paths;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-b") && i + 1 < argc)
+    {
+      long baud = atol(argv[++i]);
+      if (baud < 300)
+      {
+        usage();
+      }
+      bauds.push_back(baud);
+    }
+    else if (argv[i][0] == '-')
+    {
+      usage();
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty())
+  {
+    usage();
+  }
+  if (bauds.empty())
+  {
+    bauds.push_back(31250);
+    bauds.push_back(115200);
+  }
+
+  setup();
+  // setup() does not wait for its MIDI to go out, let it drain first
+  simRunLoop(sim.cycles() + ms(MIRROR_GAP_MS));
+
+  int failed = 0;
+  printf("  %-14s %8s %8s %8s %6s %12s %12s %12s\n", "performance", "baud", "synth", "usart", "same",
+    "lead min us", "lead p50 us", "lead max us");
+  for (size_t b = 0; b < bauds.size(); b++)
+  {
+    // what the sketch's setup() would do with MIDI_USART_BAUD set to this
+    Serial.begin(bauds[b]);
+    for (size_t p = 0; p < paths.size(); p++)
+    {
+      std::vector<SimHold> holds;
+      if (!simLoadPerformance(paths[p], holds))
+      {
+        return 2;
+      }
+      size_t synthFirst = sim.midiOut.bytes().size();
+      size_t usartFirst = Serial.sent.size();
+      uint64_t start = sim.cycles() + ms(MIRROR_GAP_MS);
+      double lastMs = 0;
+      for (size_t i = 0; i < holds.size(); i++)
+      {
+        sim.scheduleKey(start + ms(holds[i].onMs), holds[i].bus, holds[i].key, true);
+        sim.scheduleKey(start + ms(holds[i].offMs), holds[i].bus, holds[i].key, false);
+        if (holds[i].offMs > lastMs)
+        {
+          lastMs = holds[i].offMs;
+        }
+      }
+      simRunLoopSweeping(start + ms(lastMs));
+      // pots at rest, let both lines drain
+      simRunLoop(sim.cycles() + ms(MIRROR_GAP_MS));
+
+      const std::vector<SimByte> &synth = sim.midiOut.bytes();
+      size_t synthCount = synth.size() - synthFirst;
+      size_t usartCount = Serial.sent.size() - usartFirst;
+      bool same = synthCount == usartCount;
+      SimHistogram lead;
+      int64_t leadMin = 0;
+      bool late = false;
+      bool early = false;
+      for (size_t i = 0; same && i < synthCount; i++)
+      {
+        const SimByte &s = synth[synthFirst + i];
+        const SimByte &u = Serial.sent[usartFirst + i];
+        if (s.value != u.value)
+        {
+          same = false;
+          break;
+        }
+        // how long before the synth's line the USART started the byte
+        int64_t ahead = (int64_t)s.start - (int64_t)u.start;
+        if (i == 0 || ahead < leadMin)
+        {
+          leadMin = ahead;
+        }
+        lead.add(us(ahead));
+        if (ahead < -(int64_t)MIRROR_SYNTH_BIT_CYCLES)
+        {
+          late = true;
+        }
+        if (bauds[b] == SIM_MIDI_BAUD && ahead > (int64_t)MIRROR_SYNTH_FRAME_CYCLES)
+        {
+          early = true;
+        }
+      }
+
+      const char *name = strrchr(paths[p], '/') ? strrchr(paths[p], '/') + 1 : paths[p];
+      printf("  %-14s %8ld %8u %8u %6s %12.1f %12.1f %12.1f\n", name, bauds[b], (unsigned)synthCount,
+        (unsigned)usartCount, same ? "yes" : "NO", us(leadMin), lead.percentile(50), lead.max());
+      if (!same)
+      {
+        printf("FAIL: %s at %ld baud: the USART did not get the synth's bytes\n", name, bauds[b]);
+        failed = 1;
+      }
+      if (late)
+      {
+        printf("FAIL: %s at %ld baud: a byte went out of the USART after the synth's line\n", name, bauds[b]);
+        failed = 1;
+      }
+      if (early)
+      {
+        printf("FAIL: %s at %ld baud: a byte went out of the USART over a byte time early\n", name, bauds[b]);
+        failed = 1;
+      }
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,225 @@
+/*
+  midi_stall - how long sending a chord holds up the main loop of an organ sketch
+
+  usage: midi_stall [-n notes]
+
+  Two measurements, for a chord of n notes (10 by default):
+
+  api   the n noteOn() calls made back to back on the sketch's Fluxamasynth
+        object, then the n noteOff() calls.  For each burst: the time until
+        the calls return (the stall), the time until the last byte has left
+        pin 4, and the longest stretch with interrupts disabled.  loop() is
+        not run between and after the bursts, only the interrupts that send
+        the bytes: no key holds these notes, and a sketch's stuck note
+        guard would end them before the noteOff() calls.
+  loop  the chord played on the lower manual's keys with the sketch running
+        as usual.  The longest loop() iteration and the longest stretch with
+        interrupts disabled, first while nothing is played and then while
+        the chord's note-ons and note-offs go out.
+  pots  what one step of all four pots makes getPots() send (program
+        change, channel volume, TVF cutoff and TVF resonance for the upper
+        manual), called right before the chord's noteOn() calls, with the
+        sketch running as usual afterwards.  The time from the first call
+        to the first and to the last note-on byte on pin 4: how long the
+        notes wait behind the controller messages.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "Fluxamasynth.h"
+// Arduino.h's, in the way of SimHistogram::max()
+#undef min
+#undef max
+
+// the sketch's synth
+extern Fluxamasynth synth;
+
+// the lower manual plays on channel 1, from note 36 up, the upper on channel 0
+#define STALL_BUS_LOWER 0
+#define STALL_CHANNEL 1
+#define STALL_CHANNEL_UPPER 0
+#define STALL_LOWEST_NOTE 36
+#define STALL_MAX_NOTES 64
+
+#define STALL_SETTLE_MS 300
+#define STALL_IDLE_MS 500
+#define STALL_HOLD_MS 200
+
+// spread the chord over the keyboard, every 5th key from the bottom
+static uint8_t chordKey(uint8_t i)
+{
+  return (i * 5) % STALL_MAX_NOTES;
+}
+
+// the end of the last byte on the MIDI line
+static uint64_t wireEnd()
+{
+  const std::vector<SimByte> &bytes = hostSim().midiOut.bytes();
+  return bytes.empty() ? 0 : bytes.back().end;
+}
+
+// wait for the MIDI line to go quiet, then run loop() a little more
+static void settle()
+{
+  HostSim &sim = hostSim();
+  simRunLoop(sim.cycles() + ms(STALL_SETTLE_MS));
+}
+
+// the calls, then the interrupts alone until the bytes are out
+static void apiBurst(const char *name, uint8_t notes, bool on)
+{
+  HostSim &sim = hostSim();
+  sim.longestCli = 0;
+  uint64_t start = sim.cycles();
+  for (uint8_t i = 0; i < notes; i++)
+  {
+    uint8_t note = STALL_LOWEST_NOTE + chordKey(i);
+    if (on)
+    {
+      synth.noteOn(STALL_CHANNEL, note, 127);
+    }
+    else
+    {
+      synth.noteOff(STALL_CHANNEL, note);
+    }
+  }
+  uint64_t returned = sim.cycles();
+  uint64_t longestCli = sim.longestCli;
+  // let the bytes that are still queued go out, without loop()
+  sim.advanceTo(returned + ms(STALL_SETTLE_MS));
+  uint64_t end = wireEnd();
+  printf("  %-10s %10.1f %10.1f %12.1f\n", name, us(returned - start), end > start ? us(end - start) : 0.0,
+    us(longestCli));
+}
+
+// controller messages for a pot step, then the chord
+static void potsBurst(uint8_t notes)
+{
+  HostSim &sim = hostSim();
+  settle();
+  uint64_t start = sim.cycles();
+  synth.programChange(0, STALL_CHANNEL_UPPER, 20);
+  synth.setChannelVolume(STALL_CHANNEL_UPPER, 90);
+  synth.setTVFCutoff(STALL_CHANNEL_UPPER, 70);
+  synth.setTVFResonance(STALL_CHANNEL_UPPER, 50);
+  for (uint8_t i = 0; i < notes; i++)
+  {
+    synth.noteOn(STALL_CHANNEL, STALL_LOWEST_NOTE + chordKey(i), 127);
+  }
+  simRunLoop(sim.cycles() + ms(STALL_SETTLE_MS));
+
+  std::vector<SimByte> bytes;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      bytes.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(bytes, messages);
+  uint64_t first = 0;
+  uint64_t last = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    if (messages[i].isNoteOn() && messages[i].channel() == STALL_CHANNEL)
+    {
+      if (!first)
+      {
+        first = messages[i].start;
+      }
+      last = messages[i].start;
+    }
+  }
+  printf("  %-10s %12.1f %12.1f %10u\n", "pots+chord", us(first - start), us(last - start), (unsigned)bytes.size());
+}
+
+// run loop() call by call, noting the longest call
+static void runLoops(uint64_t until, SimHistogram &durations)
+{
+  HostSim &sim = hostSim();
+  while (sim.cycles() < until)
+  {
+    uint64_t start = sim.cycles();
+    loop();
+    durations.add(us(sim.cycles() - start));
+    sim.advance(SIM_CYCLES_LOOP_CALL);
+  }
+}
+
+static void loopRow(const char *name, SimHistogram &durations, uint64_t longestCli)
+{
+  printf("  %-10s %10u %10.1f %10.1f %12.1f\n", name, (unsigned)durations.count(), durations.percentile(50),
+    durations.max(), us(longestCli));
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: midi_stall [-n notes]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  uint8_t notes = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      int n = atoi(argv[++i]);
+      if (n < 1 || n > STALL_MAX_NOTES)
+      {
+        usage();
+      }
+      notes = n;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+
+  printf("api: %u notes sent back to back\n", notes);
+  printf("\n  %-10s %10s %10s %12s\n", "us", "stall", "on wire", "longest cli");
+  settle();
+  apiBurst("noteOn", notes, true);
+  apiBurst("noteOff", notes, false);
+
+  printf("\nloop: a %u note chord on the lower manual\n", notes);
+  printf("\n  %-10s %10s %10s %10s %12s\n", "us", "loops", "loop p50", "loop max", "longest cli");
+  settle();
+  SimHistogram idle;
+  sim.longestCli = 0;
+  runLoops(sim.cycles() + ms(STALL_IDLE_MS), idle);
+  loopRow("idle", idle, sim.longestCli);
+
+  uint64_t press = sim.cycles() + ms(1);
+  for (uint8_t i = 0; i < notes; i++)
+  {
+    sim.scheduleKey(press, STALL_BUS_LOWER, chordKey(i), true);
+    sim.scheduleKey(press + ms(STALL_HOLD_MS), STALL_BUS_LOWER, chordKey(i), false);
+  }
+  SimHistogram chord;
+  sim.longestCli = 0;
+  runLoops(press + ms(2 * STALL_HOLD_MS), chord);
+  loopRow("chord", chord, sim.longestCli);
+
+  printf("\npots: a pot step's controller messages, then a %u note chord\n", notes);
+  printf("\n  %-10s %12s %12s %10s\n", "us", "first note", "last note", "bytes");
+  potsBurst(notes);
+  return 0;
+}
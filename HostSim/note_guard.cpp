@@ -0,0 +1,404 @@
+/*
+  note_guard - injects lost note-offs and checks the sketch ends the notes
+
+  usage: note_guard [-n faults] [-v]
+
+  -v  list every fault with the time its note hung
+
+  Runs the sketch and plays n (40 by default) scenes of 800 ms: a chord
+  of 3 to 6 keys held on both manuals for the whole scene, and one more
+  key pressed and released in the middle, with one of two faults:
+
+  release  the key's release is taken out of the key event queue before
+           loop() sees it, as a bus glitch or a bug between the scan and
+           the couplers would lose it; the sketch never hears the key
+           come up.  Needs a sketch with the event queue.
+  note-off the key is released as usual, then the note is started again
+           behind the sketch's back with a bare noteOn() on the synth, as
+           if the note-off had been lost on the way out.
+
+  A note on channel 0 below the keyboards comes in on MIDI in for the
+  whole run and is only released after the last scene; the guard must
+  leave it sounding until then, it is not the keys' to end.  Sketches
+  that do not merge MIDI in skip that check.
+
+  Every stuck note has to end with a note-off before its scene is over,
+  no note may get a note-off while its key is down (a guard that corrects
+  what is right), and the note-ons and note-offs of each note have to
+  alternate, so only the one missing note-off is sent.  The table gives
+  how long the stuck notes hung after the fault, and the note-offs sent
+  beyond one per key hold.  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "KeyEventQueue.h"
+#include "Fluxamasynth.h"
+#undef min
+#undef max
+
+// the sketch's synth and queue, the queue missing in sketches from before it had one
+extern Fluxamasynth synth;
+extern KeyEventQueue keyEvents __attribute__((weak));
+
+// how the organ sketches map buses to MIDI: lower is channel 1, upper channel 0
+static const uint8_t busChannel[2] = { 1, 0 };
+#define GUARD_LOWEST_NOTE 36
+#define GUARD_NUM_KEYS 64
+
+#define GUARD_SCENE_MS 800
+#define GUARD_FAULT_ON_MS 200
+#define GUARD_FAULT_OFF_MS 300
+// after the release, when the note-off has gone out
+#define GUARD_STRAY_MS 350
+#define GUARD_GAP_MS 500
+
+// the note held on MIDI in, on the upper manual's channel below its keys
+#define GUARD_MIDI_IN_CHANNEL 0
+#define GUARD_MIDI_IN_NOTE 30
+#define GUARD_MIDI_IN_ON_MS 5
+
+#define FAULT_RELEASE 0
+#define FAULT_NOTE_OFF 1
+
+struct GuardHold
+{
+  uint8_t bus;
+  uint8_t key;
+  uint64_t on;
+  uint64_t off;
+};
+
+struct GuardFault
+{
+  uint8_t type;
+  uint8_t bus;
+  uint8_t key;
+  // when the note should have stopped
+  uint64_t at;
+  // the note-off that ended it, 0 for none
+  uint64_t ended;
+};
+
+static unsigned long guardRandomState = 11223;
+
+static unsigned long guardRandom(unsigned long range)
+{
+  guardRandomState = guardRandomState * 1103515245UL + 12345UL;
+  return ((guardRandomState >> 16) & 0x7fff) % range;
+}
+
+// takes the release of bus/key out of the queue if it is there; true if it was
+static bool dropRelease(uint8_t bus, uint8_t key)
+{
+  std::vector<KeyEvent> kept;
+  KeyEvent event;
+  bool dropped = false;
+
+  while (keyEvents.pop(event))
+  {
+    if (!dropped && event.manual() == bus && event.key() == key && !event.on())
+    {
+      dropped = true;
+      continue;
+    }
+    kept.push_back(event);
+  }
+  for (size_t i = 0; i < kept.size(); i++)
+  {
+    keyEvents.push(kept[i].key(), kept[i].manual(), kept[i].on(), kept[i].time);
+  }
+  return dropped;
+}
+
+// loop() until the given cycle, with the fault of a scene armed
+static void run(uint64_t until, const GuardFault *fault, uint64_t strayAt)
+{
+  HostSim &sim = hostSim();
+  bool armed = fault != 0;
+  while (sim.cycles() < until)
+  {
+    loop();
+    sim.advance(SIM_CYCLES_LOOP_CALL);
+    if (!armed)
+    {
+      continue;
+    }
+    if (fault->type == FAULT_RELEASE && dropRelease(fault->bus, fault->key))
+    {
+      armed = false;
+    }
+    else if (fault->type == FAULT_NOTE_OFF && sim.cycles() >= strayAt)
+    {
+      synth.noteOn(busChannel[fault->bus], GUARD_LOWEST_NOTE + fault->key, 100);
+      armed = false;
+    }
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: note_guard [-n faults] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  unsigned count = 40;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      count = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+  uint64_t start = sim.cycles() + ms(GUARD_GAP_MS);
+  simRunLoop(start);
+
+  // the MIDI in note, held through every scene
+  uint64_t midiInOff = start + ms((double)count * GUARD_SCENE_MS);
+  const uint8_t midiInOn[3] = { 0x90 | GUARD_MIDI_IN_CHANNEL, GUARD_MIDI_IN_NOTE, 100 };
+  const uint8_t midiInRelease[3] = { 0x80 | GUARD_MIDI_IN_CHANNEL, GUARD_MIDI_IN_NOTE, 0 };
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    sim.midiIn.schedule(start + ms(GUARD_MIDI_IN_ON_MS), midiInOn[i]);
+  }
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    sim.midiIn.schedule(midiInOff, midiInRelease[i]);
+  }
+
+  std::vector<GuardHold> holds;
+  std::vector<GuardFault> faults;
+  for (unsigned n = 0; n < count; n++)
+  {
+    uint64_t scene = start + ms((double)n * GUARD_SCENE_MS);
+    bool used[2][GUARD_NUM_KEYS];
+    memset(used, 0, sizeof(used));
+
+    // the chord, held through the scene
+    uint8_t keys = 3 + guardRandom(4);
+    for (uint8_t i = 0; i < keys; i++)
+    {
+      GuardHold hold = { (uint8_t)guardRandom(2), (uint8_t)guardRandom(GUARD_NUM_KEYS), scene + ms(10),
+        scene + ms(GUARD_SCENE_MS - 100) };
+      if (used[hold.bus][hold.key])
+      {
+        continue;
+      }
+      used[hold.bus][hold.key] = true;
+      holds.push_back(hold);
+      sim.scheduleKey(hold.on, hold.bus, hold.key, true);
+      sim.scheduleKey(hold.off, hold.bus, hold.key, false);
+    }
+
+    // the key that loses its note-off
+    GuardFault fault;
+    fault.type = &keyEvents ? n % 2 : FAULT_NOTE_OFF;
+    do
+    {
+      fault.bus = guardRandom(2);
+      fault.key = guardRandom(GUARD_NUM_KEYS);
+    } while (used[fault.bus][fault.key]);
+    GuardHold hold = { fault.bus, fault.key, scene + ms(GUARD_FAULT_ON_MS), scene + ms(GUARD_FAULT_OFF_MS) };
+    holds.push_back(hold);
+    sim.scheduleKey(hold.on, hold.bus, hold.key, true);
+    sim.scheduleKey(hold.off, hold.bus, hold.key, false);
+    fault.at = fault.type == FAULT_RELEASE ? hold.off : scene + ms(GUARD_STRAY_MS);
+    fault.ended = 0;
+
+    run(scene + ms(GUARD_SCENE_MS), &fault, fault.at);
+    faults.push_back(fault);
+  }
+  uint64_t end = start + ms((double)count * GUARD_SCENE_MS + GUARD_GAP_MS);
+  run(end, 0, 0);
+
+  // the notes on pin 4, each note's on/off sequence in time
+  std::vector<SimByte> bytes;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      bytes.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(bytes, messages);
+
+  unsigned wrong = 0;
+  unsigned falseOffs = 0;
+  unsigned noteOffs = 0;
+  bool midiInMerged = false;
+  uint64_t midiInEnded = 0;
+  bool sounding[16][128];
+  memset(sounding, 0, sizeof(sounding));
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (!m.isNoteOn() && !m.isNoteOff())
+    {
+      continue;
+    }
+    uint8_t channel = m.channel();
+    uint8_t note = m.data[0];
+    // on after on, or off after off: more than the one note-off needed
+    if (m.isNoteOn() == sounding[channel][note])
+    {
+      wrong++;
+    }
+    sounding[channel][note] = m.isNoteOn();
+    if (channel == GUARD_MIDI_IN_CHANNEL && note == GUARD_MIDI_IN_NOTE)
+    {
+      midiInMerged = true;
+      if (m.isNoteOff() && !midiInEnded)
+      {
+        midiInEnded = m.start;
+      }
+    }
+    if (!m.isNoteOff())
+    {
+      continue;
+    }
+    noteOffs++;
+    for (size_t h = 0; h < holds.size(); h++)
+    {
+      const GuardHold &hold = holds[h];
+      // a little after the press, the note-on may still be on its way
+      if (busChannel[hold.bus] == channel && GUARD_LOWEST_NOTE + hold.key == note && m.start > hold.on + ms(20)
+        && m.start < hold.off)
+      {
+        falseOffs++;
+      }
+    }
+    for (size_t f = 0; f < faults.size(); f++)
+    {
+      GuardFault &fault = faults[f];
+      if (busChannel[fault.bus] == channel && GUARD_LOWEST_NOTE + fault.key == note && m.start >= fault.at
+        && !fault.ended)
+      {
+        fault.ended = m.start;
+        break;
+      }
+    }
+  }
+  unsigned stuck = 0;
+  for (uint8_t c = 0; c < 16; c++)
+  {
+    for (uint16_t n = 0; n < 128; n++)
+    {
+      stuck += sounding[c][n];
+    }
+  }
+
+  int failed = 0;
+  printf("  %-9s %7s %7s %10s %10s %10s\n", "fault", "faults", "ended", "hang p50", "hang max", "state");
+  for (uint8_t type = 0; type < 2; type++)
+  {
+    SimHistogram hang;
+    unsigned injected = 0;
+    unsigned ended = 0;
+    bool late = false;
+    for (size_t f = 0; f < faults.size(); f++)
+    {
+      const GuardFault &fault = faults[f];
+      if (fault.type != type)
+      {
+        continue;
+      }
+      injected++;
+      uint64_t scene = start + ms((double)f * GUARD_SCENE_MS);
+      if (fault.ended && fault.ended < scene + ms(GUARD_SCENE_MS))
+      {
+        ended++;
+        hang.add((fault.ended - fault.at) / (double)SIM_CYCLES_PER_MILLISECOND);
+      }
+      else if (fault.ended)
+      {
+        late = true;
+      }
+      if (verbose)
+      {
+        printf("    scene %3u: %-8s bus %u key %2u ", (unsigned)f, type == FAULT_RELEASE ? "release" : "note-off",
+          fault.bus, fault.key);
+        if (fault.ended)
+        {
+          printf("ended after %.1f ms\n", (fault.ended - fault.at) / (double)SIM_CYCLES_PER_MILLISECOND);
+        }
+        else
+        {
+          printf("never ended\n");
+        }
+      }
+    }
+    const char *name = type == FAULT_RELEASE ? "release" : "note-off";
+    if (injected == 0)
+    {
+      printf("  %-9s %7s %7s %10s %10s %10s\n", name, "-", "-", "-", "-", "-");
+      continue;
+    }
+    bool ok = ended == injected && !late;
+    printf("  %-9s %7u %7u %10.1f %10.1f %10s\n", name, injected, ended, ended ? hang.percentile(50) : 0.0,
+      ended ? hang.max() : 0.0, ok ? "ok" : "FAIL");
+    if (!ok)
+    {
+      failed = 1;
+    }
+  }
+  // the MIDI in note has to last until its own note-off came in
+  if (!midiInMerged)
+  {
+    printf("  %-9s %7s %7s %10s %10s %10s\n", "midi in", "-", "-", "-", "-", "-");
+  }
+  else
+  {
+    bool kept = !midiInEnded || midiInEnded >= midiInOff;
+    printf("  %-9s %7s %7s %10s %10s %10s", "midi in", "1", "-", "-", "-", kept ? "ok" : "FAIL");
+    if (!kept)
+    {
+      printf("  ended %.1f ms before its note-off came in",
+        midiInEnded ? (midiInOff - midiInEnded) / (double)SIM_CYCLES_PER_MILLISECOND : 0.0);
+    }
+    printf("\n");
+    if (!kept)
+    {
+      failed = 1;
+    }
+  }
+  // one note-off per hold, one more for each note started behind the sketch's back, and the MIDI in note's
+  unsigned expectedOffs = holds.size() + midiInMerged;
+  for (size_t f = 0; f < faults.size(); f++)
+  {
+    expectedOffs += faults[f].type == FAULT_NOTE_OFF;
+  }
+  printf("note-offs: %u for %u holds and faults, %u while the key was down, %u out of turn, %u notes left sounding: %s\n",
+    noteOffs, expectedOffs, falseOffs, wrong, stuck,
+    noteOffs == expectedOffs && falseOffs == 0 && wrong == 0 && stuck == 0 ? "ok" : "FAIL");
+  if (noteOffs != expectedOffs || falseOffs || wrong || stuck)
+  {
+    failed = 1;
+  }
+  return failed;
+}
@@ -0,0 +1,341 @@
+/*
+  nrpn_check - decodes what Fluxamasynth sends and checks the synth ends up
+  with the parameters the calls asked for
+
+  usage: nrpn_check [-n calls]
+
+  The sketch's Fluxamasynth object is driven directly, setup() is not run.
+  For every combination of running status, priority scheduling and NRPN
+  caching it makes n random calls (2000 by default) on a few channels:
+  TVF cutoff and resonance, envelope attack and the special synth controls
+  (all NRPNs), pitch bend range (an RPN, which takes over data entry from
+  the NRPN), program change, channel volume, notes, NRPNs from an external
+  controller passed through, and now and then a reset.  Then it sweeps the cutoff of one channel through all 128 values.
+
+  The bytes on pin 4 are fed to a model of the synth's side: a parameter
+  number register per channel set by the NRPN (63h/62h) and RPN (65h/64h)
+  controllers, data entry (06h) writing to whichever was selected last, and
+  a reset clearing everything.  At the end its parameters have to be the
+  ones the calls set, and no data entry may arrive with nothing selected.
+  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "Fluxamasynth.h"
+
+// the sketch's synth
+extern Fluxamasynth synth;
+
+#define CHECK_CHANNELS 4
+#define CHECK_SWEEP_CHANNEL 0
+// time between calls, up to
+#define CHECK_GAP_US 2000
+// time for everything to go out at the end
+#define CHECK_DRAIN_MS 500
+
+// what a parameter is, for the maps of expected and decoded values
+#define CHECK_NRPN 0
+#define CHECK_RPN 1
+#define CHECK_VOLUME 2
+#define CHECK_BANK 3
+#define CHECK_PROGRAM 4
+
+typedef std::map<uint32_t, uint8_t> CheckState;
+
+static uint32_t parameter(uint8_t kind, uint8_t channel, uint16_t number)
+{
+  return ((uint32_t)kind << 24) | ((uint32_t)channel << 16) | number;
+}
+
+static unsigned long checkRandomState = 97531;
+
+static unsigned long checkRandom(unsigned long range)
+{
+  checkRandomState = checkRandomState * 1103515245UL + 12345UL;
+  return ((checkRandomState >> 16) & 0x7fff) % range;
+}
+
+// let the clock run, giving the scheduler its chances as loop() would
+static void wait(uint64_t cycles)
+{
+  HostSim &sim = hostSim();
+  uint64_t until = sim.cycles() + cycles;
+  while (sim.cycles() < until)
+  {
+    synth.update();
+    sim.advance(SIM_CYCLES_PER_MICROSECOND * 20);
+  }
+}
+
+//---------------------------------------------------------------------------------------------//
+// the synth's side
+//---------------------------------------------------------------------------------------------//
+struct CheckSynth
+{
+  // selected parameter number per channel, 0xff where not set
+  uint8_t nrpnMsb[16];
+  uint8_t nrpnLsb[16];
+  uint8_t rpnMsb[16];
+  uint8_t rpnLsb[16];
+  bool rpnSelected[16];
+  CheckState state;
+  unsigned unselected;
+
+  void reset()
+  {
+    memset(nrpnMsb, 0xff, sizeof(nrpnMsb));
+    memset(nrpnLsb, 0xff, sizeof(nrpnLsb));
+    memset(rpnMsb, 0xff, sizeof(rpnMsb));
+    memset(rpnLsb, 0xff, sizeof(rpnLsb));
+    memset(rpnSelected, 0, sizeof(rpnSelected));
+    state.clear();
+  }
+
+  void controller(uint8_t channel, uint8_t number, uint8_t value)
+  {
+    switch (number)
+    {
+      case 0x00:
+        state[parameter(CHECK_BANK, channel, 0)] = value;
+        break;
+      case 0x07:
+        state[parameter(CHECK_VOLUME, channel, 0)] = value;
+        break;
+      case 0x63:
+        nrpnMsb[channel] = value;
+        rpnSelected[channel] = false;
+        break;
+      case 0x62:
+        nrpnLsb[channel] = value;
+        rpnSelected[channel] = false;
+        break;
+      case 0x65:
+        rpnMsb[channel] = value;
+        rpnSelected[channel] = true;
+        break;
+      case 0x64:
+        rpnLsb[channel] = value;
+        rpnSelected[channel] = true;
+        break;
+      case 0x06:
+        if (rpnSelected[channel] && rpnMsb[channel] != 0xff && rpnLsb[channel] != 0xff)
+        {
+          state[parameter(CHECK_RPN, channel, (rpnMsb[channel] << 7) | rpnLsb[channel])] = value;
+        }
+        else if (!rpnSelected[channel] && nrpnMsb[channel] != 0xff && nrpnLsb[channel] != 0xff)
+        {
+          state[parameter(CHECK_NRPN, channel, (nrpnMsb[channel] << 7) | nrpnLsb[channel])] = value;
+        }
+        else
+        {
+          unselected++;
+        }
+        break;
+    }
+  }
+
+  void decode(const std::vector<SimByte> &bytes)
+  {
+    std::vector<SimMidiMessage> messages;
+    simParseMidi(bytes, messages);
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+      const SimMidiMessage &m = messages[i];
+      if (m.status == 0xff)
+      {
+        reset();
+      }
+      else if (m.type() == 0xb0)
+      {
+        controller(m.channel(), m.data[0], m.data[1]);
+      }
+      else if (m.type() == 0xc0)
+      {
+        state[parameter(CHECK_PROGRAM, m.channel(), 0)] = m.data[0];
+      }
+    }
+  }
+};
+
+//---------------------------------------------------------------------------------------------//
+// the calls
+//---------------------------------------------------------------------------------------------//
+static void randomCall(CheckState &expected)
+{
+  uint8_t channel = checkRandom(CHECK_CHANNELS);
+  uint8_t value = checkRandom(128);
+  switch (checkRandom(20))
+  {
+    case 0:
+    case 1:
+    case 2:
+      synth.setTVFCutoff(channel, value);
+      expected[parameter(CHECK_NRPN, channel, (0x01 << 7) | 0x20)] = value;
+      break;
+    case 3:
+    case 4:
+    case 5:
+      synth.setTVFResonance(channel, value);
+      expected[parameter(CHECK_NRPN, channel, (0x01 << 7) | 0x21)] = value;
+      break;
+    case 6:
+    case 7:
+      synth.setEnvAttack(channel, value);
+      expected[parameter(CHECK_NRPN, channel, (0x01 << 7) | 0x63)] = value;
+      break;
+    case 8:
+    case 9:
+    {
+      uint8_t control = checkRandom(4);
+      synth.setSpecialSynthControl(channel, control, value);
+      expected[parameter(CHECK_NRPN, channel, (0x37 << 7) | control)] = value;
+      break;
+    }
+    case 10:
+      synth.pitchBendRange(channel, value);
+      expected[parameter(CHECK_RPN, channel, 0)] = value;
+      break;
+    case 11:
+      synth.programChange(127 * checkRandom(2), channel, value);
+      break;
+    case 12:
+      synth.setChannelVolume(channel, value);
+      expected[parameter(CHECK_VOLUME, channel, 0)] = value;
+      break;
+    case 14:
+    {
+      // a controller on MIDI in selecting one of the NRPNs the library uses
+      uint8_t lsb = checkRandom(2) ? 0x20 : 0x21;
+      uint8_t select[3] = { 0xb0 | channel, 0x63, 0x01 };
+      synth.passThrough(select, 3);
+      select[1] = 0x62;
+      select[2] = lsb;
+      synth.passThrough(select, 3);
+      select[1] = 0x06;
+      select[2] = value;
+      synth.passThrough(select, 3);
+      expected[parameter(CHECK_NRPN, channel, (0x01 << 7) | lsb)] = value;
+      break;
+    }
+    case 13:
+      if (checkRandom(50) == 0)
+      {
+        synth.midiReset();
+        expected.clear();
+        break;
+      }
+      // fall through
+    default:
+      synth.noteOn(channel, 36 + value % 64, 100);
+      synth.noteOff(channel, 36 + value % 64);
+      break;
+  }
+}
+
+// program change is a pair of messages, the bank select and the program;
+// compare only what the calls above can predict
+static void dropPrograms(CheckState &state)
+{
+  for (CheckState::iterator i = state.begin(); i != state.end();)
+  {
+    uint8_t kind = i->first >> 24;
+    if (kind == CHECK_BANK || kind == CHECK_PROGRAM)
+    {
+      state.erase(i++);
+    }
+    else
+    {
+      ++i;
+    }
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: nrpn_check [-n calls]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  unsigned calls = 2000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      calls = atoi(argv[++i]);
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  int failed = 0;
+  printf("  %-8s %-10s %-8s %8s %8s %12s %11s %10s\n", "running", "scheduling", "caching", "calls", "bytes",
+    "sweep bytes", "unselected", "state");
+  for (uint8_t mode = 0; mode < 8; mode++)
+  {
+    bool running = mode & 4;
+    bool scheduling = mode & 2;
+    bool caching = mode & 1;
+
+    // start from a reset synth
+    synth.setPriorityScheduling(0);
+    synth.setRunningStatus(running);
+    synth.setNrpnCaching(caching);
+    synth.midiReset();
+    synth.setPriorityScheduling(scheduling);
+    wait(SIM_CYCLES_PER_MILLISECOND * CHECK_DRAIN_MS);
+    size_t first = sim.midiOut.bytes().size();
+
+    CheckState expected;
+    for (unsigned c = 0; c < calls; c++)
+    {
+      randomCall(expected);
+      wait(SIM_CYCLES_PER_MICROSECOND * checkRandom(CHECK_GAP_US));
+    }
+    synth.setPriorityScheduling(0);
+    wait(SIM_CYCLES_PER_MILLISECOND * CHECK_DRAIN_MS);
+    size_t sweepFirst = sim.midiOut.bytes().size();
+
+    // a pot turned all the way, one step at a time
+    synth.setPriorityScheduling(scheduling);
+    for (uint8_t value = 0; value < 128; value++)
+    {
+      synth.setTVFCutoff(CHECK_SWEEP_CHANNEL, value);
+      expected[parameter(CHECK_NRPN, CHECK_SWEEP_CHANNEL, (0x01 << 7) | 0x20)] = value;
+      wait(SIM_CYCLES_PER_MILLISECOND * 10);
+    }
+    synth.setPriorityScheduling(0);
+    wait(SIM_CYCLES_PER_MILLISECOND * CHECK_DRAIN_MS);
+
+    const std::vector<SimByte> &all = sim.midiOut.bytes();
+    std::vector<SimByte> bytes(all.begin() + first, all.end());
+    CheckSynth decoded;
+    decoded.reset();
+    decoded.unselected = 0;
+    decoded.decode(bytes);
+    dropPrograms(decoded.state);
+
+    bool ok = decoded.state == expected && decoded.unselected == 0;
+    printf("  %-8s %-10s %-8s %8u %8u %12.2f %11u %10s\n", running ? "on" : "off", scheduling ? "on" : "off",
+      caching ? "on" : "off", calls, (unsigned)(sweepFirst - first), (all.size() - sweepFirst) / 128.0,
+      decoded.unselected, ok ? "ok" : "FAIL");
+    if (!ok)
+    {
+      failed = 1;
+    }
+  }
+  return failed;
+}
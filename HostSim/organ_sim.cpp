@@ -0,0 +1,92 @@
+/*
+  organ_sim - runs an organ sketch on the HostSim virtual board
+
+  usage: organ_sim [-s seconds] [-k bus,key,on_ms,off_ms]... [-t]
+
+  -s  how long to run after setup() returns, in virtual seconds (default 10)
+  -k  hold a key; may be given more than once
+  -t  dump the MIDI and VFD byte traces
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HostSim.h"
+#include "SimSketch.h"
+
+static void usage()
+{
+  fprintf(stderr, "usage: organ_sim [-s seconds] [-k bus,key,on_ms,off_ms]... [-t]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  double seconds = 10;
+  bool trace = false;
+
+  struct KeyHold
+  {
+    int bus, key;
+    double onMs, offMs;
+  };
+  KeyHold holds[64];
+  int numHolds = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc)
+    {
+      seconds = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-k") && i + 1 < argc && numHolds < 64)
+    {
+      KeyHold &h = holds[numHolds++];
+      if (sscanf(argv[++i], "%d,%d,%lf,%lf", &h.bus, &h.key, &h.onMs, &h.offMs) != 4)
+      {
+        usage();
+      }
+    }
+    else if (!strcmp(argv[i], "-t"))
+    {
+      trace = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+  uint64_t start = sim.cycles();
+
+  // key times are relative to the end of setup()
+  for (int i = 0; i < numHolds; i++)
+  {
+    sim.scheduleKey(start + (uint64_t)(holds[i].onMs * SIM_CYCLES_PER_MILLISECOND), holds[i].bus, holds[i].key, true);
+    sim.scheduleKey(start + (uint64_t)(holds[i].offMs * SIM_CYCLES_PER_MILLISECOND), holds[i].bus, holds[i].key, false);
+  }
+
+  simRunLoop(start + (uint64_t)(seconds * SIM_F_CPU));
+
+  const std::vector<SimByte> &midi = sim.midiOut.bytes();
+  printf("setup() took %.3f ms\n", start / (double)SIM_CYCLES_PER_MILLISECOND);
+  printf("ran %.3f s, %u shift register loads\n", seconds, (unsigned)sim.shiftChain.loads.size());
+  printf("MIDI out: %u bytes, VFD: %u bytes\n", (unsigned)midi.size(), (unsigned)sim.vfd.bytes.size());
+
+  if (trace)
+  {
+    for (size_t i = 0; i < midi.size(); i++)
+    {
+      printf("midi %12.1f us  %02x\n", midi[i].start / (double)SIM_CYCLES_PER_MICROSECOND, midi[i].value);
+    }
+    for (size_t i = 0; i < sim.vfd.bytes.size(); i++)
+    {
+      printf("vfd  %12.1f us  %02x\n", sim.vfd.bytes[i].start / (double)SIM_CYCLES_PER_MICROSECOND, sim.vfd.bytes[i].value);
+    }
+  }
+  return 0;
+}
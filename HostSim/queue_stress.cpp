@@ -0,0 +1,276 @@
+/*
+  queue_stress - floods the key event queue of an organ sketch with chord storms
+
+  usage: queue_stress [-s storms]
+
+  Two parts:
+
+  queue  a producer thread pushes bursts of up to 128 events (every key of
+         both manuals changing in one scan) into a KeyEventQueue while a
+         consumer thread pops them.  Every event carries a sequence number,
+         so the consumer checks that the events it gets are exactly the
+         ones that were accepted, in order, and the producer checks that
+         every refused push was counted as an overflow.
+
+  storm  the sketch itself runs on HostSim while chord storms hit both
+         manuals: every 40 ms between 24 and 64 keys per manual go down
+         together and come up together 20 ms later.  That is far more than
+         the queue holds and the MIDI line can carry.  Afterwards no note may
+         be left sounding, and for every channel/note the note-ons and
+         note-offs have to alternate.  Holds that never made it out are
+         counted, they are expected under this load.
+
+  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "KeyEventQueue.h"
+
+// the sketch's queue, missing in sketches from before it had one
+extern KeyEventQueue keyEvents __attribute__((weak));
+
+// how the organ sketches map buses to MIDI: lower is channel 1, upper channel 0
+static const uint8_t busChannel[2] = { 1, 0 };
+#define STRESS_LOWEST_NOTE 36
+#define STRESS_NUM_KEYS 64
+
+#define STRESS_QUEUE_EVENTS 2000000
+#define STRESS_STORM_PERIOD_MS 40
+#define STRESS_STORM_HOLD_MS 20
+// idle time after the last storm, long enough for the backlog to drain
+#define STRESS_DRAIN_MS 2000
+
+static unsigned long stressRandomState = 24680;
+
+static unsigned long stressRandom(unsigned long range)
+{
+  stressRandomState = stressRandomState * 1103515245UL + 12345UL;
+  return ((stressRandomState >> 16) & 0x7fff) % range;
+}
+
+//---------------------------------------------------------------------------------------------//
+// queue: two threads on a queue of its own
+// like on the AVR the queue relies on the CPU not reordering stores, which
+// holds on x86 hosts
+//---------------------------------------------------------------------------------------------//
+
+// the sequence number is split over the key, manual, on and time fields
+static void encode(uint32_t sequence, uint8_t &key, uint8_t &manual, bool &on, uint16_t &time)
+{
+  key = sequence & KeyEvent::KEY_MASK;
+  manual = (sequence >> 6) & 3;
+  on = (sequence >> 8) & 1;
+  time = sequence >> 9;
+}
+
+static uint32_t decode(const KeyEvent &event)
+{
+  return event.key() | (event.manual() << 6) | (event.on() << 8) | ((uint32_t)event.time << 9);
+}
+
+static int stressQueue()
+{
+  static KeyEventQueue queue;
+  std::atomic<bool> done(false);
+  uint32_t accepted = 0;
+  uint32_t refused = 0;
+  uint32_t popped = 0;
+  uint32_t outOfOrder = 0;
+
+  std::thread consumer([&]()
+  {
+    KeyEvent event;
+    uint32_t expected = 0;
+    while (true)
+    {
+      bool finished = done;
+      if (!queue.pop(event))
+      {
+        if (finished)
+        {
+          break;
+        }
+        continue;
+      }
+      // the sequence wraps at 25 bits
+      if (decode(event) != (expected & 0x1ffffff))
+      {
+        outOfOrder++;
+      }
+      expected = decode(event) + 1;
+      popped++;
+    }
+  });
+
+  uint32_t sequence = 0;
+  unsigned long random = 1;
+  while (accepted + refused < STRESS_QUEUE_EVENTS)
+  {
+    // a storm of 1 to 128 key changes in one go
+    random = random * 1103515245UL + 12345UL;
+    uint8_t burst = 1 + ((random >> 16) & 0x7f);
+    for (uint8_t i = 0; i < burst; i++)
+    {
+      uint8_t key;
+      uint8_t manual;
+      bool on;
+      uint16_t time;
+      encode(sequence, key, manual, on, time);
+      if (queue.push(key, manual, on, time))
+      {
+        accepted++;
+        sequence++;
+      }
+      else
+      {
+        refused++;
+      }
+    }
+    // sometimes give the consumer a moment to catch up
+    if (((random >> 24) & 7) == 0)
+    {
+      std::this_thread::yield();
+    }
+  }
+  done = true;
+  consumer.join();
+
+  bool ok = popped == accepted && outOfOrder == 0 && queue.overflows() == (refused & 0xffff)
+    && queue.highWater() <= KEY_EVENT_QUEUE_SIZE;
+  printf("queue: %u pushes, %u accepted, %u popped, %u out of order, %u refused, %u overflows counted, high water %u of %u: %s\n",
+    (unsigned)(accepted + refused), (unsigned)accepted, (unsigned)popped, (unsigned)outOfOrder, (unsigned)refused,
+    (unsigned)queue.overflows(), (unsigned)queue.highWater(), (unsigned)KEY_EVENT_QUEUE_SIZE, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+//---------------------------------------------------------------------------------------------//
+// storm: the sketch under chord storms
+//---------------------------------------------------------------------------------------------//
+static int stressStorm(unsigned storms)
+{
+  HostSim &sim = hostSim();
+
+  setup();
+  if (&keyEvents)
+  {
+    keyEvents.clearStatistics();
+  }
+
+  // the key changes of every storm
+  uint64_t start = sim.cycles() + ms(100);
+  unsigned holds = 0;
+  for (unsigned s = 0; s < storms; s++)
+  {
+    uint64_t on = start + ms(s * STRESS_STORM_PERIOD_MS);
+    uint64_t off = on + ms(STRESS_STORM_HOLD_MS);
+    for (uint8_t bus = 0; bus < 2; bus++)
+    {
+      uint8_t n = 24 + stressRandom(STRESS_NUM_KEYS - 24 + 1);
+      uint8_t first = stressRandom(STRESS_NUM_KEYS - n + 1);
+      for (uint8_t k = first; k < first + n; k++)
+      {
+        sim.scheduleKey(on, bus, k, true);
+        sim.scheduleKey(off, bus, k, false);
+        holds++;
+      }
+    }
+  }
+  simRunLoop(start + ms(storms * STRESS_STORM_PERIOD_MS + STRESS_DRAIN_MS));
+
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(sim.midiOut.bytes(), messages);
+
+  // walk the note messages, tracking what is sounding
+  bool sounding[2][STRESS_NUM_KEYS] = { { false } };
+  unsigned noteOns = 0;
+  unsigned doubled = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (!m.isNoteOn() && !m.isNoteOff())
+    {
+      continue;
+    }
+    int note = (m.data[0] & 0x7f) - STRESS_LOWEST_NOTE;
+    uint8_t bus = m.channel() == busChannel[0] ? 0 : 1;
+    if (note < 0 || note >= STRESS_NUM_KEYS || m.channel() != busChannel[bus])
+    {
+      continue;
+    }
+    bool on = m.isNoteOn();
+    if (on == sounding[bus][note])
+    {
+      doubled++;
+    }
+    sounding[bus][note] = on;
+    if (on)
+    {
+      noteOns++;
+    }
+  }
+  unsigned stuck = 0;
+  for (uint8_t bus = 0; bus < 2; bus++)
+  {
+    for (uint8_t k = 0; k < STRESS_NUM_KEYS; k++)
+    {
+      if (sounding[bus][k])
+      {
+        stuck++;
+      }
+    }
+  }
+
+  bool ok = stuck == 0 && doubled == 0;
+  printf("storm: %u storms, %u key holds, %u made it out, %u dropped under the load\n",
+    storms, holds, noteOns, holds - noteOns);
+  if (&keyEvents)
+  {
+    printf("storm: queue overflows %u, high water %u of %u\n",
+      (unsigned)keyEvents.overflows(), (unsigned)keyEvents.highWater(), (unsigned)KEY_EVENT_QUEUE_SIZE);
+  }
+  else
+  {
+    printf("storm: the sketch has no key event queue\n");
+  }
+  printf("storm: %u notes left sounding, %u note-ons or note-offs out of turn: %s\n",
+    stuck, doubled, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: queue_stress [-s storms]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned storms = 100;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc)
+    {
+      storms = atoi(argv[++i]);
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  int failed = stressQueue();
+  failed |= stressStorm(storms);
+  return failed;
+}
@@ -0,0 +1,216 @@
+/*
+  scan_jitter - keyboard scan period and its jitter under load
+
+  usage: scan_jitter [-w workload]... [-g jitter_us]
+
+  -w  run only the named workload; may be given more than once
+  -g  regression gate: exit 1 if any workload's worst jitter exceeds this
+
+  The sketch runs on HostSim through a series of workloads, each for 5
+  virtual seconds: nothing at all, chords on both manuals, all four pots
+  turning (MIDI controller sends and display updates), the upper/lower
+  button pressed twice a second (display updates), and all of it at once.
+
+  The scan period is the time from one shift register load on the lower
+  bus to the next.  Jitter is how far a period is from the median period,
+  so the report does not need to know the rate the sketch aims for.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimStats.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+// the organ's controls
+#define JITTER_BUTTON_RANK 3
+#define JITTER_BUS_LOWER 0
+
+#define JITTER_RUN_MS 5000
+// workload inputs change at this step
+#define JITTER_STEP_MS 10
+
+struct JitterWorkload
+{
+  const char *name;
+  const char *description;
+  bool keys;
+  bool pots;
+  bool buttons;
+};
+
+static const JitterWorkload workloads[] =
+{
+  { "idle", "nothing happening", false, false, false },
+  { "keys", "10 note chords on both manuals", true, false, false },
+  { "pots", "all four pots turning", false, true, false },
+  { "buttons", "upper/lower button twice a second", false, false, true },
+  { "all", "keys, pots and buttons at once", true, true, true },
+};
+#define JITTER_NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static unsigned long jitterRandomState = 13579;
+
+static unsigned long jitterRandom(unsigned long range)
+{
+  jitterRandomState = jitterRandomState * 1103515245UL + 12345UL;
+  return ((jitterRandomState >> 16) & 0x7fff) % range;
+}
+
+// a 10 note chord on each manual every 100 ms, held for 50 ms
+static void scheduleChords(uint64_t start)
+{
+  HostSim &sim = hostSim();
+  for (uint64_t t = 0; t + 100 <= JITTER_RUN_MS; t += 100)
+  {
+    for (uint8_t bus = 0; bus < 2; bus++)
+    {
+      uint64_t used = 0;
+      for (uint8_t i = 0; i < 10; i++)
+      {
+        uint8_t key;
+        do
+        {
+          key = jitterRandom(64);
+        } while (used & ((uint64_t)1 << key));
+        used |= (uint64_t)1 << key;
+        sim.scheduleKey(start + ms(t), bus, key, true);
+        sim.scheduleKey(start + ms(t + 50), bus, key, false);
+      }
+    }
+  }
+}
+
+static void run(const JitterWorkload &workload)
+{
+  HostSim &sim = hostSim();
+  uint64_t start = sim.cycles();
+
+  if (workload.keys)
+  {
+    scheduleChords(start);
+  }
+  for (uint32_t t = 0; t < JITTER_RUN_MS; t += JITTER_STEP_MS)
+  {
+    if (workload.pots)
+    {
+      simSweepPots(t);
+    }
+    if (workload.buttons)
+    {
+      // buttons are active low, held for 100 ms of every 500
+      sim.setInput(JITTER_BUTTON_RANK, (t % 500) < 100 ? 0 : 1);
+    }
+    simRunLoop(start + ms(t + JITTER_STEP_MS));
+  }
+  sim.releaseInput(JITTER_BUTTON_RANK);
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: scan_jitter [-w workload]... [-g jitter_us]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool selected[JITTER_NUM_WORKLOADS] = { false };
+  bool anySelected = false;
+  double gate = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-w") && i + 1 < argc)
+    {
+      i++;
+      size_t w;
+      for (w = 0; w < JITTER_NUM_WORKLOADS; w++)
+      {
+        if (!strcmp(argv[i], workloads[w].name))
+        {
+          selected[w] = true;
+          anySelected = true;
+          break;
+        }
+      }
+      if (w == JITTER_NUM_WORKLOADS)
+      {
+        usage();
+      }
+    }
+    else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+    {
+      gate = atof(argv[++i]);
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  setup();
+
+  int failed = 0;
+  for (size_t w = 0; w < JITTER_NUM_WORKLOADS; w++)
+  {
+    if (!anySelected || selected[w])
+    {
+      printf("%-10s %s\n", workloads[w].name, workloads[w].description);
+    }
+  }
+  printf("\n  %-10s %8s %10s %10s %10s %10s %10s\n", "us", "scans", "period p50", "min", "max", "jitter p99", "jitter max");
+  for (size_t w = 0; w < JITTER_NUM_WORKLOADS; w++)
+  {
+    if (anySelected && !selected[w])
+    {
+      continue;
+    }
+    size_t first = sim.shiftChain.loads.size();
+    run(workloads[w]);
+    const std::vector<SimLoad> &loads = sim.shiftChain.loads;
+
+    // periods between loads of the lower bus
+    std::vector<double> periods;
+    uint64_t last = 0;
+    for (size_t i = first; i < loads.size(); i++)
+    {
+      if (!(loads[i].busMask & (1 << JITTER_BUS_LOWER)))
+      {
+        continue;
+      }
+      if (last)
+      {
+        periods.push_back(us(loads[i].start - last));
+      }
+      last = loads[i].start;
+    }
+
+    SimHistogram period;
+    for (size_t i = 0; i < periods.size(); i++)
+    {
+      period.add(periods[i]);
+    }
+    double median = period.percentile(50);
+    SimHistogram jitter;
+    for (size_t i = 0; i < periods.size(); i++)
+    {
+      jitter.add(fabs(periods[i] - median));
+    }
+
+    printf("  %-10s %8u %10.1f %10.1f %10.1f %10.1f %10.1f\n", workloads[w].name, (unsigned)period.count(),
+      median, period.percentile(0), period.max(), jitter.percentile(99), jitter.max());
+    if (gate > 0 && jitter.max() > gate)
+    {
+      printf("FAIL: %s scan jitter %.1f us is over %.1f us\n", workloads[w].name, jitter.max(), gate);
+      failed = 1;
+    }
+  }
+  return failed;
+}
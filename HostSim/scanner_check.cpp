@@ -0,0 +1,332 @@
+/*
+  scanner_check - the KeyboardScanner template in several configurations
+
+  usage: scanner_check [-n scans]
+
+  Instantiates KeyboardScanner for shift chains of 1 to 8 chips on 1 to 4
+  buses, each bus a division of the organ (a manual or the pedalboard),
+  up to the 4 x 8 of a three manual console with pedals, and drives each
+  one directly on the virtual board (setup() is not run).  The buses are on pins 9, 10 and 8 (PB1, PB2, PB0) and 5 (PD5).
+
+  For n scans (5000 by default) random contacts on every bus open and
+  close, some of them for a single scan like chatter, and after each scan
+  the events in the queue are checked against a model of the debouncing:
+  a key goes down on the first scan that reads it closed and up on the
+  third scan in a row that reads it open.  Every load has to have exactly
+  the bus being read driven low.
+
+  The table gives the longest scan and the cycles of a scan and of each
+  bus in it.  The first two configurations, one bus of 1 and of 4 chips,
+  give the cycles of a chip and of the bus select and load; every other
+  configuration has to take exactly that many per bus, which is what the
+  unrolling is for: the chain length and the bus count add code, not
+  time, and the scan grows linearly with the number of divisions.  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HostSim.h"
+#include "Arduino.h"
+#include "KeyboardScanner.h"
+
+// the scanner's load pulse, as in the organ sketches
+#define CHECK_LOAD_PULSE_USEC 5
+// keys that change on a scan, at most, so the queue never fills
+#define CHECK_CHANGES_PER_SCAN 4
+
+// the chain on the organ's pins, up to four buses on two ports
+struct CheckPins
+{
+  static const uint8_t LOAD_PULSE_USEC = CHECK_LOAD_PULSE_USEC;
+
+  static void selectBus(uint8_t bus)
+  {
+    const uint8_t portBBuses = _BV(PB1) | _BV(PB2) | _BV(PB0);
+    switch (bus)
+    {
+      case 0:
+        DDRD &= ~_BV(PD5);
+        DDRB = (DDRB & ~portBBuses) | _BV(PB1);
+        break;
+      case 1:
+        DDRD &= ~_BV(PD5);
+        DDRB = (DDRB & ~portBBuses) | _BV(PB2);
+        break;
+      case 2:
+        DDRD &= ~_BV(PD5);
+        DDRB = (DDRB & ~portBBuses) | _BV(PB0);
+        break;
+      default:
+        DDRB &= ~portBBuses;
+        DDRD |= _BV(PD5);
+        break;
+    }
+  }
+  static void loadLow() { PORTB &= ~_BV(PB5); }
+  static void loadHigh() { PORTB |= _BV(PB5); }
+  static uint8_t data() { return PINB & _BV(PB3); }
+  static void clock()
+  {
+    PORTB |= _BV(PB4);
+    PORTB &= ~_BV(PB4);
+  }
+};
+
+static const uint8_t busPins[SIM_MAX_BUSES] = { 9, 10, 8, 5 };
+
+// cycles of one chip and of the rest of a bus (select, load), from the
+// first two configurations checked
+static uint8_t calibrated = 0;
+static double firstBus;
+static uint8_t firstChips;
+static double chipCost;
+static double busCost;
+
+static unsigned long checkRandomState = 13579;
+
+static unsigned long checkRandom(unsigned long range)
+{
+  checkRandomState = checkRandomState * 1103515245UL + 12345UL;
+  return ((checkRandomState >> 16) & 0x7fff) % range;
+}
+
+static void wireBoard(uint8_t chips, uint8_t buses)
+{
+  HostSim &sim = hostSim();
+
+  sim.shiftChain.configure(13, 12, 11, chips);
+  for (uint8_t bus = 0; bus < SIM_MAX_BUSES; bus++)
+  {
+    sim.shiftChain.setBusPin(bus, bus < buses ? busPins[bus] : SIM_NO_PIN);
+    sim.shiftChain.keys[bus] = 0;
+    // all buses released, the port bits low
+    pinMode(busPins[bus], INPUT);
+    digitalWrite(busPins[bus], LOW);
+  }
+  pinMode(13, OUTPUT);
+  digitalWrite(13, HIGH);
+  pinMode(12, OUTPUT);
+  digitalWrite(12, LOW);
+  pinMode(11, INPUT);
+  sim.shiftChain.loads.clear();
+}
+
+template <class SCANNER>
+static int check(unsigned scans)
+{
+  HostSim &sim = hostSim();
+  static SCANNER scanner;
+  static KeyEventQueue queue;
+  const uint8_t buses = SCANNER::BUS_COUNT;
+  const uint8_t keys = SCANNER::KEY_COUNT;
+  const uint64_t keyMask = keys == 64 ? ~(uint64_t)0 : ((uint64_t)1 << keys) - 1;
+
+  // the model: debounced state and the scans in a row each key read open
+  uint64_t down[SIM_MAX_BUSES] = { 0 };
+  uint8_t open[SIM_MAX_BUSES][64];
+  memset(open, 0, sizeof(open));
+
+  wireBoard(SCANNER::CHIP_COUNT, buses);
+
+  unsigned events = 0;
+  unsigned wrong = 0;
+  unsigned badLoads = 0;
+  uint64_t scanCycles = 0;
+  uint64_t maxScan = 0;
+  for (unsigned n = 0; n < scans; n++)
+  {
+    // a few contacts change, now and then a key that only closes for this scan
+    uint64_t chatter[SIM_MAX_BUSES] = { 0 };
+    uint8_t changes = checkRandom(CHECK_CHANGES_PER_SCAN + 1);
+    for (uint8_t i = 0; i < changes; i++)
+    {
+      uint8_t bus = checkRandom(buses);
+      uint8_t key = checkRandom(keys);
+      if (checkRandom(4) == 0)
+      {
+        chatter[bus] |= (uint64_t)1 << key;
+      }
+      else
+      {
+        sim.shiftChain.keys[bus] ^= (uint64_t)1 << key;
+      }
+    }
+    uint64_t held[SIM_MAX_BUSES];
+    for (uint8_t bus = 0; bus < buses; bus++)
+    {
+      held[bus] = sim.shiftChain.keys[bus];
+      sim.shiftChain.keys[bus] |= chatter[bus];
+    }
+
+    size_t firstLoad = sim.shiftChain.loads.size();
+    uint64_t start = sim.cycles();
+    scanner.scan(queue, n);
+    uint64_t cycles = sim.cycles() - start;
+    scanCycles += cycles;
+    maxScan = cycles > maxScan ? cycles : maxScan;
+
+    // what the model expects from this scan
+    uint64_t read[SIM_MAX_BUSES];
+    uint64_t toggled[SIM_MAX_BUSES];
+    for (uint8_t bus = 0; bus < buses; bus++)
+    {
+      read[bus] = sim.shiftChain.keys[bus] & keyMask;
+      toggled[bus] = 0;
+      for (uint8_t key = 0; key < keys; key++)
+      {
+        uint64_t bit = (uint64_t)1 << key;
+        if (read[bus] & bit)
+        {
+          open[bus][key] = 0;
+          if (!(down[bus] & bit))
+          {
+            toggled[bus] |= bit;
+          }
+        }
+        else if (down[bus] & bit && ++open[bus][key] == 3)
+        {
+          open[bus][key] = 0;
+          toggled[bus] |= bit;
+        }
+      }
+      down[bus] ^= toggled[bus];
+      sim.shiftChain.keys[bus] = held[bus];
+    }
+
+    // the events, the buses in order, the last chip of each first as it
+    // comes out of the chain, and the lowest key of each chip first
+    KeyEvent event;
+    for (uint8_t bus = 0; bus < buses; bus++)
+    {
+      for (uint8_t i = 0; i < keys; i++)
+      {
+        uint8_t key = (keys - 8 - (i & ~7)) | (i & 7);
+        uint64_t bit = (uint64_t)1 << key;
+        if (!(toggled[bus] & bit))
+        {
+          continue;
+        }
+        events++;
+        if (!queue.pop(event) || event.manual() != bus || event.key() != key || event.on() != ((down[bus] & bit) != 0)
+          || event.time != (uint16_t)n)
+        {
+          wrong++;
+        }
+      }
+      for (uint8_t chip = 0; chip < SCANNER::CHIP_COUNT; chip++)
+      {
+        if (scanner.keys(bus, chip) != (uint8_t)(down[bus] >> (chip * 8)))
+        {
+          wrong++;
+        }
+      }
+    }
+    while (queue.pop(event))
+    {
+      wrong++;
+    }
+
+    // one load per bus, with only that bus driven
+    const std::vector<SimLoad> &loads = sim.shiftChain.loads;
+    if (loads.size() - firstLoad != buses)
+    {
+      badLoads++;
+    }
+    for (size_t i = firstLoad; i < loads.size(); i++)
+    {
+      if (loads[i].busMask != 1 << (i - firstLoad) || loads[i].shifted == 0)
+      {
+        badLoads++;
+      }
+    }
+    // the scan interval, the clock has to move for the loads to be apart
+    sim.advance(SIM_CYCLES_PER_MILLISECOND);
+  }
+
+  // the first two configurations give the cost model, the others have to fit it
+  double perBus = scanCycles / (double)scans / buses;
+  double predicted = -1;
+  if (calibrated == 0)
+  {
+    firstBus = perBus;
+    firstChips = SCANNER::CHIP_COUNT;
+    calibrated = 1;
+  }
+  else if (calibrated == 1)
+  {
+    chipCost = (perBus - firstBus) / (SCANNER::CHIP_COUNT - firstChips);
+    busCost = firstBus - firstChips * chipCost;
+    calibrated = 2;
+  }
+  else
+  {
+    predicted = busCost + SCANNER::CHIP_COUNT * chipCost;
+  }
+
+  bool ok = wrong == 0 && badLoads == 0 && (predicted < 0 || perBus == predicted);
+  printf("  %5u x %-5u %8u %8u %9.1f %9.1f %9.1f ", buses, SCANNER::CHIP_COUNT, scans, events,
+    maxScan / (double)SIM_CYCLES_PER_MICROSECOND, scanCycles / (double)scans, perBus);
+  if (predicted < 0)
+  {
+    printf("%9s", "-");
+  }
+  else
+  {
+    printf("%9.1f", predicted);
+  }
+  printf(" %6s\n", ok ? "ok" : "FAIL");
+  if (wrong)
+  {
+    printf("FAIL: %u x %u: %u events or key states differ from the model\n", buses, SCANNER::CHIP_COUNT, wrong);
+  }
+  if (badLoads)
+  {
+    printf("FAIL: %u x %u: %u loads with the wrong bus driven\n", buses, SCANNER::CHIP_COUNT, badLoads);
+  }
+  if (predicted >= 0 && perBus != predicted)
+  {
+    printf("FAIL: %u x %u: a bus takes %.1f cycles, not the %.1f of its chips and the load\n", buses,
+      SCANNER::CHIP_COUNT, perBus, predicted);
+  }
+  return ok ? 0 : 1;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: scanner_check [-n scans]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned scans = 5000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      scans = atoi(argv[++i]);
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  int failed = 0;
+  printf("  %-13s %8s %8s %9s %9s %9s %9s %6s\n", "buses x chips", "scans", "events", "max us", "cycles",
+    "bus cyc", "predicted", "state");
+  // one bus of 1 and of 4 chips first, for the cost model
+  failed |= check<KeyboardScanner<1, 1, CheckPins> >(scans);
+  failed |= check<KeyboardScanner<4, 1, CheckPins> >(scans);
+  // 1 to 4 divisions of 8 chips, and a shorter chain
+  failed |= check<KeyboardScanner<8, 1, CheckPins> >(scans);
+  failed |= check<KeyboardScanner<8, 2, CheckPins> >(scans);
+  failed |= check<KeyboardScanner<8, 3, CheckPins> >(scans);
+  failed |= check<KeyboardScanner<8, 4, CheckPins> >(scans);
+  failed |= check<KeyboardScanner<6, 3, CheckPins> >(scans);
+  return failed;
+}
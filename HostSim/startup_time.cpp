@@ -0,0 +1,112 @@
+/*
+  startup_time - how long an organ sketch takes from power up to playing
+
+  usage: startup_time [-t]
+
+  -t  list every VFD byte of the first second with its time
+
+  Holds a key on the lower manual from power up, runs setup() and then
+  loop() for 7 virtual seconds, and reports when setup() returned, when
+  the first shift register load went out, when the held key's note-on
+  started on the MIDI line, and when the last VFD byte of the first
+  second was done, which is when the start up screen is complete.  The
+  VFD bytes still to go when setup() returned are counted too: a sketch
+  that waits on the display sends them all before.  Nothing is checked;
+  make startup prints it for BASELINE and SKETCH.
+
+  The EEPROM is blank on the host, so the sketches also write their
+  defaults to it, as on the first start of a new chip.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+
+// the key held from power up, bus 0 is the lower manual
+#define STARTUP_KEY 30
+// how long the sketch runs, past the 5 s start up screen of the sketches
+#define STARTUP_RUN_MS 7000
+// the start up screen's bytes are the ones sent in this time
+#define STARTUP_SCREEN_MS 1000
+
+static void print(const char *what, bool seen, uint64_t cycle)
+{
+  if (seen)
+  {
+    printf("  %-28s %10.1f ms\n", what, msOf(cycle));
+  }
+  else
+  {
+    printf("  %-28s %13s\n", what, "never");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool trace = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-t"))
+    {
+      trace = true;
+    }
+    else
+    {
+      fprintf(stderr, "usage: startup_time [-t]\n");
+      return 2;
+    }
+  }
+
+  sim.scheduleKey(0, 0, STARTUP_KEY, true);
+  setup();
+  uint64_t setupEnd = sim.cycles();
+  size_t vfdAtSetupEnd = sim.vfd.bytes.size();
+  simRunLoop(ms(STARTUP_RUN_MS));
+
+  bool scanned = !sim.shiftChain.loads.empty();
+  uint64_t firstScan = scanned ? sim.shiftChain.loads[0].start : 0;
+
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(sim.midiOut.bytes(), messages);
+  bool played = false;
+  uint64_t noteOn = 0;
+  for (size_t i = 0; i < messages.size() && !played; i++)
+  {
+    if (messages[i].isNoteOn())
+    {
+      played = true;
+      noteOn = messages[i].start;
+    }
+  }
+
+  const std::vector<SimByte> &bytes = sim.vfd.bytes;
+  bool drawn = false;
+  uint64_t screen = 0;
+  unsigned screenBytes = 0;
+  unsigned queued = 0;
+  for (size_t i = 0; i < bytes.size() && bytes[i].end <= ms(STARTUP_SCREEN_MS); i++)
+  {
+    drawn = true;
+    screen = bytes[i].end;
+    screenBytes++;
+    queued += i >= vfdAtSetupEnd;
+    if (trace)
+    {
+      printf("  %10.3f ms  %02x\n", msOf(bytes[i].start), bytes[i].value);
+    }
+  }
+
+  print("setup() returned", true, setupEnd);
+  print("first key scan", scanned, firstScan);
+  print("held key's note-on", played, noteOn);
+  print("start up screen complete", drawn, screen);
+  printf("  %-28s %10u of %u\n", "VFD bytes after setup()", queued, screenBytes);
+  return 0;
+}
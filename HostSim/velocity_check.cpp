@@ -0,0 +1,311 @@
+/*
+  velocity_check - the sketch's note-on velocities for key strokes of known travel
+
+  usage: velocity_check [-n strokes] [-v]
+
+  -v  list every stroke with its travel time and the note-ons it gave
+
+  Runs a sketch built with VELOCITY_SENSING 1 (make velocity builds it)
+  on a board with two contacts under every key, the second contacts on
+  buses of their own (pins 8 and 5), and plays n strokes (2000 by
+  default) on both manuals, about 8 keys going down at a time.  Their
+  travel times, from the first contact closing to the second, go from
+  0.3 to 40 ms, spread evenly on a log scale, with the contacts closing
+  anywhere between two scans.  One stroke in 8 is partial: the key is
+  let up before it reaches the second contact.
+
+  The notes on pin 4 are matched with the strokes.  Every full stroke
+  has to give exactly one note-on, after its second contact closed and
+  within CHECK_LATENCY_MS of it, at a velocity the sketch's own curve
+  gives for a travel time no further off than two scan intervals (both
+  contacts are timed by the scan that sees them); no partial stroke may
+  give one, nor may a note-on come without a stroke.  The table gives
+  the velocities and the latency by travel time, and the Timer1 scan
+  interrupt's share of the 0.5 ms interval, which may not miss a compare
+  match.  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "KeyVelocity.h"
+#undef min
+#undef max
+
+// the sketch's stroke timer and its curve, missing in a sketch built without velocity sensing
+extern KeyVelocity<16> keyVelocity __attribute__((weak));
+
+// how the organ sketches map buses to MIDI: lower is channel 1, upper channel 0
+static const uint8_t busChannel[2] = { 1, 0 };
+#define CHECK_LOWEST_NOTE 36
+#define CHECK_DIVISIONS 2
+#define CHECK_KEYS 64
+
+// the 2 kHz scan of a sketch with VELOCITY_SENSING
+#define CHECK_SCAN_USEC 500
+#define CHECK_AT_ONCE 8
+// the key held down after the second contact, and the second contact
+// opening before the first on the way up
+#define CHECK_HOLD_MS 60
+#define CHECK_LIFT_MS 1
+// longest from the second contact closing to the start of the note-on
+#define CHECK_LATENCY_MS 5
+#define CHECK_GAP_MS 500
+
+struct Stroke
+{
+  uint8_t division;
+  uint8_t key;
+  bool full;
+  // first contact closes, second closes (full strokes), first opens
+  uint64_t first;
+  uint64_t second;
+  uint64_t up;
+  double travelMs;
+  // the note-ons it gave, the velocity of the last and how long after
+  // the second contact it started
+  unsigned noteOns;
+  uint8_t velocity;
+  double latencyMs;
+};
+
+// the travel time buckets of the table, in ms
+static const double bucketEdges[] = { 0.3, 1, 2, 4, 8, 16, 40.01 };
+#define CHECK_BUCKETS 6
+
+static unsigned long checkRandomState = 24680;
+
+static unsigned long checkRandom(unsigned long range)
+{
+  checkRandomState = checkRandomState * 1103515245UL + 12345UL;
+  return ((checkRandomState >> 16) & 0x7fff) % range;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: velocity_check [-n strokes] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  unsigned count = 2000;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      count = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  if (!&keyVelocity)
+  {
+    printf("the sketch has no keyVelocity, build it with VELOCITY_SENSING 1: FAIL\n");
+    return 1;
+  }
+
+  setup();
+  uint64_t start = sim.cycles() + ms(CHECK_GAP_MS);
+  simRunLoop(start);
+
+  // the strokes, each on a key no other stroke is using at the time
+  std::vector<Stroke> strokes;
+  uint64_t busy[CHECK_DIVISIONS][CHECK_KEYS];
+  memset(busy, 0, sizeof(busy));
+  uint64_t at = start;
+  for (unsigned n = 0; n < count; n++)
+  {
+    Stroke stroke;
+    do
+    {
+      stroke.division = checkRandom(CHECK_DIVISIONS);
+      stroke.key = checkRandom(CHECK_KEYS);
+    } while (busy[stroke.division][stroke.key] > at);
+    stroke.full = checkRandom(8) != 0;
+    stroke.travelMs = 0.3 * pow(40 / 0.3, checkRandom(10000) / 9999.0);
+    // anywhere between two scans, to the microsecond
+    stroke.first = at + ms(checkRandom(CHECK_SCAN_USEC) / 1000.0);
+    stroke.second = stroke.first + ms(stroke.travelMs);
+    stroke.up = stroke.full ? stroke.second + ms(CHECK_HOLD_MS) : stroke.second;
+    stroke.noteOns = 0;
+    stroke.velocity = 0;
+    stroke.latencyMs = 0;
+    // free again once the release has been debounced and its note-off sent
+    busy[stroke.division][stroke.key] = stroke.up + ms(20);
+    strokes.push_back(stroke);
+
+    sim.scheduleKey(stroke.first, stroke.division, stroke.key, true);
+    if (stroke.full)
+    {
+      sim.scheduleKey(stroke.second, CHECK_DIVISIONS + stroke.division, stroke.key, true);
+      sim.scheduleKey(stroke.up - ms(CHECK_LIFT_MS), CHECK_DIVISIONS + stroke.division, stroke.key, false);
+    }
+    sim.scheduleKey(stroke.up, stroke.division, stroke.key, false);
+    // about CHECK_AT_ONCE strokes on their way down at a time
+    at += ms(checkRandom(2 * 40000 / CHECK_AT_ONCE) / 1000.0);
+  }
+  uint64_t end = at + ms(200);
+  uint8_t scanVector = sim.timer1.vector();
+  uint32_t scansBefore = sim.interrupts[scanVector];
+  uint64_t scanCyclesBefore = sim.interruptCycles[scanVector];
+  simRunLoop(end);
+
+  // the note-ons on pin 4, each given to the stroke of its key that was
+  // under way when it started
+  std::vector<SimByte> bytes;
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].start >= start)
+    {
+      bytes.push_back(all[i]);
+    }
+  }
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(bytes, messages);
+  unsigned strays = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (!m.isNoteOn())
+    {
+      continue;
+    }
+    int s = -1;
+    for (size_t j = 0; j < strokes.size(); j++)
+    {
+      const Stroke &stroke = strokes[j];
+      if (busChannel[stroke.division] == m.channel() && CHECK_LOWEST_NOTE + stroke.key == m.data[0]
+        && m.start >= stroke.first && m.start < stroke.up + ms(CHECK_LATENCY_MS))
+      {
+        s = j;
+        break;
+      }
+    }
+    if (s < 0)
+    {
+      strays++;
+      if (verbose)
+      {
+        printf("    note-on channel %u note %u velocity %u at %.3f ms without a stroke\n", m.channel(), m.data[0],
+          m.data[1], msOf(m.start - start));
+      }
+      continue;
+    }
+    strokes[s].noteOns++;
+    strokes[s].velocity = m.data[1];
+    strokes[s].latencyMs = msOf((int64_t)(m.start - strokes[s].second));
+  }
+
+  // how far off the sketch's timing of a stroke may be: the scan that
+  // sees each contact is up to an interval after it
+  double slack = 2 * CHECK_SCAN_USEC / 1000.0;
+
+  // the table, by travel time
+  int failed = 0;
+  unsigned wrong = 0;
+  printf("  %-12s %7s %7s %7s %7s %7s %9s %6s\n", "travel ms", "strokes", "struck", "partial", "v min", "v max",
+    "lat max", "state");
+  for (uint8_t b = 0; b <= CHECK_BUCKETS; b++)
+  {
+    unsigned total = 0;
+    unsigned struck = 0;
+    unsigned partial = 0;
+    unsigned bad = 0;
+    uint8_t vMin = 127;
+    uint8_t vMax = 0;
+    double latencyMax = 0;
+    for (size_t i = 0; i < strokes.size(); i++)
+    {
+      const Stroke &stroke = strokes[i];
+      // the last row is the partial strokes
+      if (b == CHECK_BUCKETS ? stroke.full
+                             : !stroke.full || stroke.travelMs < bucketEdges[b] || stroke.travelMs >= bucketEdges[b + 1])
+      {
+        continue;
+      }
+      total++;
+      bool ok;
+      if (!stroke.full)
+      {
+        partial++;
+        ok = stroke.noteOns == 0;
+      }
+      else
+      {
+        // the slack either way, and the curve never rises with the time
+        double slow = stroke.travelMs + slack;
+        double fast = stroke.travelMs - slack;
+        uint8_t softest = keyVelocity.velocity((uint16_t)(slow * 1000 / 4));
+        uint8_t loudest = keyVelocity.velocity(fast > 0 ? (uint16_t)(fast * 1000 / 4) : 0);
+        ok = stroke.noteOns == 1 && stroke.latencyMs >= 0 && stroke.latencyMs < CHECK_LATENCY_MS
+          && stroke.velocity >= softest && stroke.velocity <= loudest;
+        struck += stroke.noteOns;
+        latencyMax = stroke.latencyMs > latencyMax ? stroke.latencyMs : latencyMax;
+        vMin = stroke.velocity < vMin ? stroke.velocity : vMin;
+        vMax = stroke.velocity > vMax ? stroke.velocity : vMax;
+      }
+      if (!ok)
+      {
+        bad++;
+      }
+      if (verbose || !ok)
+      {
+        printf("    %s stroke %4u: division %u key %2u travel %6.2f ms, %u note-ons, latency %6.2f ms, velocity %3u%s\n",
+          stroke.full ? "full   " : "partial", (unsigned)i, stroke.division, stroke.key, stroke.travelMs,
+          stroke.noteOns, stroke.latencyMs, stroke.velocity, ok ? "" : "  FAIL");
+      }
+    }
+    char name[16];
+    if (b == CHECK_BUCKETS)
+    {
+      snprintf(name, sizeof(name), "partial");
+    }
+    else
+    {
+      snprintf(name, sizeof(name), "%.1f-%.0f", bucketEdges[b], bucketEdges[b + 1]);
+    }
+    if (b == CHECK_BUCKETS || struck == 0)
+    {
+      printf("  %-12s %7u %7u %7u %7s %7s %9s %6s\n", name, total, struck, partial, "-", "-", "-", bad ? "FAIL" : "ok");
+    }
+    else
+    {
+      printf("  %-12s %7u %7u %7u %7u %7u %9.2f %6s\n", name, total, struck, partial, vMin, vMax, latencyMax,
+        bad ? "FAIL" : "ok");
+    }
+    wrong += bad;
+  }
+
+  uint32_t scans = sim.interrupts[scanVector] - scansBefore;
+  double scanUs = scans ? (sim.interruptCycles[scanVector] - scanCyclesBefore) / (double)scans
+    / SIM_CYCLES_PER_MICROSECOND : 0;
+  bool fits = scans > 0 && sim.timer1.missed == 0;
+  printf("scan interrupt: %u runs, %.1f us mean of the %u us interval, %.0f%% load, %u compare matches missed: %s\n",
+    scans, scanUs, CHECK_SCAN_USEC, 100 * scanUs / CHECK_SCAN_USEC, sim.timer1.missed, fits ? "ok" : "FAIL");
+  printf("note-ons without a stroke: %u: %s\n", strays, strays ? "FAIL" : "ok");
+  if (wrong || strays || !fits)
+  {
+    failed = 1;
+  }
+  return failed;
+}
@@ -0,0 +1,255 @@
+/*
+  vfd_check - what an organ sketch puts on the VFD, as the display takes it
+
+  usage: vfd_check [-v]
+
+  -v  print the screen after every scene
+
+  Runs the sketch through a few scenes: start up, each pot turned to a
+  new place, the rank and bank buttons pressed, and a pot swept while
+  chords are played on both keyboards.  After each scene the display is
+  left to settle and the screen the VFD receiver decoded from the line is
+  compared with the status line the sketch's settings call for.  The
+  receiver also checks every clock phase, the data setup and hold times
+  and that no command starts while the display is still executing the
+  one before; any of those errors, or a screen that does not match,
+  fails the check.
+
+  The table gives the VFD bytes, commands and characters of each scene
+  and the longest loop() took in it.  Under it is the time the VFD's
+  compare match interrupt took per byte, 0 for a sketch that clocks the
+  bytes out itself.  A sketch without the status screen's settings, like
+  0.0.3, is only checked for timing.  make vfd runs it for BASELINE and
+  SKETCH.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "HostSim.h"
+#include "SimSketch.h"
+#include "SimTest.h"
+#include "avr/io.h"
+
+typedef uint8_t byte;
+
+// the settings the status screen shows; weak, not every sketch has them
+extern byte setUpper __attribute__((weak));
+extern byte upperBank __attribute__((weak));
+extern byte lowerBank __attribute__((weak));
+extern byte upperVoice __attribute__((weak));
+extern byte lowerVoice __attribute__((weak));
+extern byte upperVelocity __attribute__((weak));
+extern byte lowerVelocity __attribute__((weak));
+extern byte upperCutoff __attribute__((weak));
+extern byte lowerCutoff __attribute__((weak));
+extern byte upperResonance __attribute__((weak));
+extern byte lowerResonance __attribute__((weak));
+
+// the organ's buttons, and the time they are held
+#define CHECK_BUTTON_BANK 2
+#define CHECK_BUTTON_RANK 3
+#define CHECK_PRESS_MS 100
+// how long a pot takes to turn, in steps of
+#define CHECK_TURN_MS 500
+#define CHECK_POT_STEP_MS 5
+// the time the display is given to catch up after a scene, and after
+// start up, where the start up screen may stay up for 5 seconds with
+// the sketch already running
+#define CHECK_SETTLE_MS 1000
+#define CHECK_STARTUP_MS 6000
+// the busy scene: a chord every so often, so many notes on each keyboard
+#define CHECK_BUSY_MS 2000
+#define CHECK_CHORD_MS 100
+#define CHECK_CHORD_NOTES 5
+#define CHECK_COLUMNS 20
+
+// the longest loop() call since the last scene
+static uint64_t longestLoop;
+
+// simRunLoop, timing each loop()
+static void runLoop(uint64_t untilCycle)
+{
+  HostSim &sim = hostSim();
+  while (sim.cycles() < untilCycle)
+  {
+    uint64_t start = sim.cycles();
+    loop();
+    if (sim.cycles() - start > longestLoop)
+    {
+      longestLoop = sim.cycles() - start;
+    }
+    sim.advance(SIM_CYCLES_LOOP_CALL);
+  }
+}
+
+// turn a pot from where it is to value
+static void turnPot(uint8_t pot, int value)
+{
+  HostSim &sim = hostSim();
+  int from = sim.analog(pot);
+  for (int step = 1; step * CHECK_POT_STEP_MS <= CHECK_TURN_MS; step++)
+  {
+    sim.setAnalog(pot, from + (value - from) * step * CHECK_POT_STEP_MS / CHECK_TURN_MS);
+    runLoop(sim.cycles() + ms(CHECK_POT_STEP_MS));
+  }
+}
+
+static void pressButton(uint8_t pin)
+{
+  HostSim &sim = hostSim();
+  sim.setInput(pin, 0);
+  runLoop(sim.cycles() + ms(CHECK_PRESS_MS));
+  sim.releaseInput(pin);
+}
+
+// a pot swept up and down while chords come and go on both keyboards
+static void busy()
+{
+  HostSim &sim = hostSim();
+  uint64_t start = sim.cycles();
+  for (unsigned chord = 0; chord * CHECK_CHORD_MS < CHECK_BUSY_MS; chord++)
+  {
+    uint64_t at = start + ms(chord * CHECK_CHORD_MS);
+    for (uint8_t bus = 0; bus < 2; bus++)
+    {
+      for (uint8_t note = 0; note < CHECK_CHORD_NOTES; note++)
+      {
+        uint8_t key = (chord * 7 + note * 5 + bus * 3) % 61;
+        sim.scheduleKey(at, bus, key, true);
+        sim.scheduleKey(at + ms(CHECK_CHORD_MS * 3 / 4), bus, key, false);
+      }
+    }
+  }
+  for (unsigned step = 0; step * CHECK_POT_STEP_MS < CHECK_BUSY_MS; step++)
+  {
+    unsigned phase = step * CHECK_POT_STEP_MS % 1000;
+    sim.setAnalog(2, phase < 500 ? phase * 2 : (1000 - phase) * 2);
+    runLoop(start + ms((step + 1) * CHECK_POT_STEP_MS));
+  }
+}
+
+// the status screen the sketch's settings call for
+static void expected(std::string &top, std::string &bottom)
+{
+  bool upper = setUpper == 1;
+  char line[CHECK_COLUMNS + 8];
+  snprintf(line, sizeof(line), "B%u P%3u V%3u", upper ? upperBank : lowerBank, upper ? upperVoice : lowerVoice,
+    upper ? upperVelocity : lowerVelocity);
+  top = line;
+  snprintf(line, sizeof(line), "%c  F%3u Q%3u", upper ? 'U' : 'L', upper ? upperCutoff : lowerCutoff,
+    upper ? upperResonance : lowerResonance);
+  bottom = line;
+  top.resize(CHECK_COLUMNS, ' ');
+  bottom.resize(CHECK_COLUMNS, ' ');
+}
+
+int main(int argc, char **argv)
+{
+  HostSim &sim = hostSim();
+  bool verbose = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      fprintf(stderr, "usage: vfd_check [-v]\n");
+      return 2;
+    }
+  }
+
+  bool screen = &setUpper && &upperBank && &lowerBank && &upperVoice && &lowerVoice && &upperVelocity
+    && &lowerVelocity && &upperCutoff && &lowerCutoff && &upperResonance && &lowerResonance;
+  unsigned mismatches = 0;
+  size_t bytes = 0;
+  uint32_t commands = 0;
+  uint32_t characters = 0;
+
+  printf("  %-10s %8s %8s %8s %10s  %s\n", "scene", "bytes", "commands", "chars", "loop max us", "screen");
+  for (unsigned scene = 0; scene < 8; scene++)
+  {
+    const char *name;
+    longestLoop = 0;
+    switch (scene)
+    {
+      case 0:
+        name = "startup";
+        setup();
+        break;
+      case 1:
+        name = "voice";
+        turnPot(0, 800);
+        break;
+      case 2:
+        name = "velocity";
+        turnPot(1, 300);
+        break;
+      case 3:
+        name = "cutoff";
+        turnPot(2, 100);
+        break;
+      case 4:
+        name = "resonance";
+        turnPot(3, 900);
+        break;
+      case 5:
+        name = "rank";
+        pressButton(CHECK_BUTTON_RANK);
+        turnPot(0, 200);
+        break;
+      case 6:
+        name = "bank";
+        pressButton(CHECK_BUTTON_BANK);
+        break;
+      default:
+        name = "busy";
+        busy();
+        break;
+    }
+    runLoop(sim.cycles() + ms(scene == 0 ? CHECK_STARTUP_MS : CHECK_SETTLE_MS));
+
+    std::string top = sim.vfd.line(0, CHECK_COLUMNS);
+    std::string bottom = sim.vfd.line(1, CHECK_COLUMNS);
+    const char *result = "-";
+    std::string wantTop;
+    std::string wantBottom;
+    if (screen)
+    {
+      expected(wantTop, wantBottom);
+      result = top == wantTop && bottom == wantBottom ? "ok" : "WRONG";
+      mismatches += result[0] == 'W';
+    }
+    printf("  %-10s %8zu %8u %8u %10.0f  %s\n", name, sim.vfd.bytes.size() - bytes, sim.vfd.commands - commands,
+      sim.vfd.characters - characters, longestLoop / (double)SIM_CYCLES_PER_MICROSECOND, result);
+    if (verbose || result[0] == 'W')
+    {
+      printf("    |%s|  |%s|\n", top.c_str(), bottom.c_str());
+    }
+    if (result[0] == 'W')
+    {
+      printf("    wanted |%s|  |%s|\n", wantTop.c_str(), wantBottom.c_str());
+    }
+    bytes = sim.vfd.bytes.size();
+    commands = sim.vfd.commands;
+    characters = sim.vfd.characters;
+  }
+
+  double perByte = bytes ? sim.interruptCycles[TIMER0_COMPB_vect_num] / (double)bytes / SIM_CYCLES_PER_MICROSECOND : 0;
+  printf("  %zu bytes, interrupt %.1f us a byte\n", bytes, perByte);
+  printf("  %u timing errors, %u commands while busy, %u unknown bytes", sim.vfd.timingErrors, sim.vfd.busyErrors,
+    sim.vfd.unknownBytes);
+  if (!sim.vfd.firstError.empty())
+  {
+    printf(", first: %s", sim.vfd.firstError.c_str());
+  }
+  printf("\n");
+
+  bool failed = mismatches || sim.vfd.timingErrors || sim.vfd.busyErrors || sim.vfd.unknownBytes;
+  printf("%s\n", failed ? "FAIL" : "PASS");
+  return failed ? 1 : 0;
+}
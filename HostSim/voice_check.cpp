@@ -0,0 +1,420 @@
+/*
+  voice_check - Fluxamasynth's polyphony budget on dense passages
+
+  usage: voice_check [-v]
+
+  -v  print the first call that comes out wrong in each run
+
+  The sketch's Fluxamasynth object is driven directly, setup() is not run,
+  with running status on as in the organ sketches.  Four passages, each
+  played untracked (setPolyphony(0)) and then with budgets of 8, 16 and 32
+  voices, stealing the oldest note and the quietest:
+
+  chords  block chords of 6 to 10 notes on both manuals' channels every
+          250 ms, each held 0.3 to 1.5 s, so several overlap
+  gliss   glissandi over 61 keys on both channels, every note held a second
+  full    every key of both manuals down at once, three times
+  midi in a keyboard on channels 2 and 3 through passThrough(), velocities
+          20 to 127, note-offs as 8n and as 9n with velocity 0, notes struck
+          again while they sound
+
+  The notes on pin 4 are decoded and replayed on the synth's side: the
+  notes sounding never go over the budget, and none is left sounding once
+  every key is up.  Every call is then matched against the messages it
+  caused, in order: a note-on gives its note-on, after a note-off for the
+  note it ends if the budget is used up (the oldest, or the quietest and
+  the oldest of those) or if the same note still sounds; a note-off gives
+  its note-off only if the note was not stolen.  So a call costs at most
+  one extra message.  The table gives the notes played, the notes stolen,
+  the most sounding at once and the bytes per note against the untracked
+  run.  The exit status is 1 if a check fails.
+
+  This file is in the public domain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "HostSim.h"
+#include "SimMidi.h"
+#include "Fluxamasynth.h"
+
+// the sketch's synth
+extern Fluxamasynth synth;
+// where it counts the notes here, the sketch may not have one
+static FluxamasynthVoices checkVoices;
+
+// time for everything to go out at the end
+#define CHECK_DRAIN_MS 500
+
+static unsigned long checkRandomState = 24680;
+
+static unsigned long checkRandom(unsigned long range)
+{
+  checkRandomState = checkRandomState * 1103515245UL + 12345UL;
+  return ((checkRandomState >> 16) & 0x7fff) % range;
+}
+
+// let the clock run, giving the scheduler its chances as loop() would
+static void wait(uint64_t cycles)
+{
+  HostSim &sim = hostSim();
+  uint64_t until = sim.cycles() + cycles;
+  while (sim.cycles() < until)
+  {
+    synth.update();
+    sim.advance(SIM_CYCLES_PER_MICROSECOND * 20);
+  }
+}
+
+//---------------------------------------------------------------------------------------------//
+// the passages
+//---------------------------------------------------------------------------------------------//
+struct CheckCall
+{
+  uint32_t ms;
+  bool on;
+  uint8_t channel;
+  uint8_t note;
+  uint8_t velocity;
+  // sent with passThrough(), and for a note-off as 8n rather than 9n vv 00
+  bool passed;
+  bool statusOff;
+
+  bool operator<(const CheckCall &other) const { return ms < other.ms; }
+};
+
+typedef std::vector<CheckCall> CheckPassage;
+
+static void hold(CheckPassage &passage, uint32_t ms, uint32_t length, uint8_t channel, uint8_t note,
+  uint8_t velocity, bool passed)
+{
+  CheckCall call = { ms, true, channel, note, velocity, passed, false };
+  passage.push_back(call);
+  call.ms = ms + length;
+  call.on = false;
+  call.velocity = 0;
+  call.statusOff = passed && checkRandom(2);
+  passage.push_back(call);
+}
+
+static void chords(CheckPassage &passage)
+{
+  for (uint8_t c = 0; c < 40; c++)
+  {
+    uint8_t notes = 6 + checkRandom(5);
+    uint32_t length = 300 + checkRandom(1200);
+    for (uint8_t n = 0; n < notes; n++)
+    {
+      hold(passage, c * 250 + checkRandom(3), length, c & 1, 36 + checkRandom(61), 100, false);
+    }
+  }
+}
+
+static void gliss(CheckPassage &passage)
+{
+  for (uint8_t run = 0; run < 3; run++)
+  {
+    for (uint8_t key = 0; key < 61; key++)
+    {
+      uint32_t ms = run * 1500 + key * 15;
+      uint8_t note = run & 1 ? 96 - key : 36 + key;
+      hold(passage, ms, 1000, 0, note, 100, false);
+      hold(passage, ms, 1000, 1, note + 12 <= 127 ? note + 12 : note, 100, false);
+    }
+  }
+}
+
+static void full(CheckPassage &passage)
+{
+  for (uint8_t time = 0; time < 3; time++)
+  {
+    for (uint8_t key = 0; key < 64; key++)
+    {
+      hold(passage, time * 1000, 500, 0, 36 + key, 100, false);
+      hold(passage, time * 1000, 500, 1, 36 + key, 100, false);
+    }
+  }
+}
+
+static void midiIn(CheckPassage &passage)
+{
+  uint32_t ms = 0;
+  for (unsigned n = 0; n < 600; n++)
+  {
+    ms += checkRandom(40);
+    // a narrow range, so notes come back while they still sound
+    hold(passage, ms, 50 + checkRandom(1950), 2 + checkRandom(2), 48 + checkRandom(36), 20 + checkRandom(108), true);
+  }
+}
+
+static void play(const CheckPassage &passage)
+{
+  HostSim &sim = hostSim();
+  uint64_t start = sim.cycles();
+  for (size_t i = 0; i < passage.size(); i++)
+  {
+    const CheckCall &call = passage[i];
+    uint64_t at = start + (uint64_t)call.ms * SIM_CYCLES_PER_MILLISECOND;
+    if (sim.cycles() < at)
+    {
+      wait(at - sim.cycles());
+    }
+    if (call.passed)
+    {
+      uint8_t message[3] = { (uint8_t)(0x90 | call.channel), call.note, call.velocity };
+      if (call.statusOff)
+      {
+        message[0] = 0x80 | call.channel;
+        message[2] = 64;
+      }
+      synth.passThrough(message, 3);
+    }
+    else if (call.on)
+    {
+      synth.noteOn(call.channel, call.note, call.velocity);
+    }
+    else
+    {
+      synth.noteOff(call.channel, call.note);
+    }
+  }
+  wait(SIM_CYCLES_PER_MILLISECOND * CHECK_DRAIN_MS);
+}
+
+//---------------------------------------------------------------------------------------------//
+// the checks
+//---------------------------------------------------------------------------------------------//
+struct CheckVoice
+{
+  uint8_t channel;
+  uint8_t note;
+  uint8_t velocity;
+};
+
+struct CheckResult
+{
+  unsigned notes;
+  unsigned steals;
+  unsigned mostSounding;
+  unsigned stuck;
+  unsigned bytes;
+  bool matched;
+};
+
+static int find(const std::vector<CheckVoice> &voices, uint8_t channel, uint8_t note)
+{
+  for (size_t i = 0; i < voices.size(); i++)
+  {
+    if (voices[i].channel == channel && voices[i].note == note)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool isNote(const SimMidiMessage &m, bool on, uint8_t channel, uint8_t note)
+{
+  return (on ? m.isNoteOn() : m.isNoteOff()) && m.channel() == channel && m.data[0] == note;
+}
+
+// the notes on the synth's side: never more than the budget, none left at the end
+static void replay(const std::vector<SimMidiMessage> &messages, CheckResult &result)
+{
+  bool sounding[16][128];
+  unsigned count = 0;
+
+  memset(sounding, 0, sizeof(sounding));
+  result.mostSounding = 0;
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const SimMidiMessage &m = messages[i];
+    if (m.isNoteOn() && !sounding[m.channel()][m.data[0]])
+    {
+      sounding[m.channel()][m.data[0]] = true;
+      count++;
+    }
+    else if (m.isNoteOff() && sounding[m.channel()][m.data[0]])
+    {
+      sounding[m.channel()][m.data[0]] = false;
+      count--;
+    }
+    if (count > result.mostSounding)
+    {
+      result.mostSounding = count;
+    }
+  }
+  result.stuck = count;
+}
+
+// the messages each call has to give, in order; false at the first that does not fit
+static bool match(const CheckPassage &passage, const std::vector<SimMidiMessage> &messages, uint8_t budget,
+  bool quietest, bool verbose, CheckResult &result)
+{
+  std::vector<CheckVoice> voices;
+  size_t m = 0;
+
+  result.steals = 0;
+  for (size_t i = 0; i < passage.size(); i++)
+  {
+    const CheckCall &call = passage[i];
+    size_t first = m;
+    bool ok = true;
+    if (budget == 0)
+    {
+      // untracked, every call is one message
+      ok = m < messages.size() && isNote(messages[m++], call.on, call.channel, call.note);
+    }
+    else if (call.on)
+    {
+      int sounding = find(voices, call.channel, call.note);
+      int ended = sounding;
+      if (ended < 0 && voices.size() == budget)
+      {
+        ended = 0;
+        for (size_t v = 1; quietest && v < voices.size(); v++)
+        {
+          if (voices[v].velocity < voices[ended].velocity)
+          {
+            ended = v;
+          }
+        }
+        result.steals++;
+      }
+      if (ended >= 0)
+      {
+        ok = m < messages.size() && isNote(messages[m++], false, voices[ended].channel, voices[ended].note);
+        voices.erase(voices.begin() + ended);
+      }
+      ok = ok && m < messages.size() && isNote(messages[m], true, call.channel, call.note)
+        && messages[m++].data[1] == call.velocity;
+      CheckVoice voice = { call.channel, call.note, call.velocity };
+      voices.push_back(voice);
+    }
+    else
+    {
+      int sounding = find(voices, call.channel, call.note);
+      if (sounding >= 0)
+      {
+        ok = m < messages.size() && isNote(messages[m++], false, call.channel, call.note);
+        voices.erase(voices.begin() + sounding);
+      }
+    }
+    if (!ok)
+    {
+      if (verbose)
+      {
+        printf("    call %u at %u ms: %s %u/%u, message %u", (unsigned)i, call.ms, call.on ? "on" : "off",
+          call.channel, call.note, (unsigned)first);
+        if (first < messages.size())
+        {
+          printf(" is %02x %02x %02x", messages[first].status, messages[first].data[0], messages[first].data[1]);
+        }
+        printf("\n");
+      }
+      return false;
+    }
+  }
+  return m == messages.size();
+}
+
+static int check(const char *name, const CheckPassage &passage, uint8_t budget, bool quietest, bool verbose,
+  unsigned untrackedBytes)
+{
+  HostSim &sim = hostSim();
+  CheckResult result;
+
+  // start from a reset synth
+  synth.setPolyphony(0);
+  synth.setRunningStatus(1);
+  synth.midiReset();
+  wait(SIM_CYCLES_PER_MILLISECOND * CHECK_DRAIN_MS);
+  synth.setPolyphony(budget);
+  synth.setVoiceStealing(quietest ? Fluxamasynth::STEAL_QUIETEST : Fluxamasynth::STEAL_OLDEST);
+  size_t first = sim.midiOut.bytes().size();
+
+  play(passage);
+
+  const std::vector<SimByte> &all = sim.midiOut.bytes();
+  std::vector<SimByte> bytes(all.begin() + first, all.end());
+  std::vector<SimMidiMessage> messages;
+  simParseMidi(bytes, messages);
+
+  result.notes = passage.size() / 2;
+  result.bytes = bytes.size();
+  replay(messages, result);
+  result.matched = match(passage, messages, budget, quietest, verbose, result);
+
+  bool ok = result.matched && result.stuck == 0 && (budget == 0 || result.mostSounding <= budget);
+  char voices[8] = "-";
+  char change[16] = "-";
+  if (budget)
+  {
+    snprintf(voices, sizeof(voices), "%u", budget);
+    snprintf(change, sizeof(change), "%+.1f%%", 100.0 * ((double)result.bytes - untrackedBytes) / untrackedBytes);
+  }
+  printf("  %-8s %6s %-9s %6u %7u %9u %7u %10.2f %9s %6u %6s\n", name, voices,
+    budget ? (quietest ? "quietest" : "oldest") : "untracked", result.notes, result.steals, result.mostSounding,
+    result.bytes, result.bytes / (double)result.notes, change, result.stuck, ok ? "ok" : "FAIL");
+  return ok ? (int)result.bytes : -1;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: voice_check [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-v"))
+    {
+      verbose = true;
+    }
+    else
+    {
+      usage();
+    }
+  }
+
+  const char *names[] = { "chords", "gliss", "full", "midi in" };
+  void (*passages[])(CheckPassage &) = { chords, gliss, full, midiIn };
+  const uint8_t budgets[] = { 8, 16, 32 };
+
+  synth.trackVoices(checkVoices);
+  int failed = 0;
+  printf("  %-8s %6s %-9s %6s %7s %9s %7s %10s %9s %6s %6s\n", "passage", "voices", "stealing", "notes", "stolen",
+    "most on", "bytes", "bytes/note", "vs untr.", "stuck", "state");
+  for (uint8_t p = 0; p < 4; p++)
+  {
+    CheckPassage passage;
+    passages[p](passage);
+    std::stable_sort(passage.begin(), passage.end());
+
+    int untracked = check(names[p], passage, 0, false, verbose, 0);
+    if (untracked < 0)
+    {
+      failed = 1;
+      untracked = 0;
+    }
+    for (uint8_t b = 0; b < 3; b++)
+    {
+      for (uint8_t quietest = 0; quietest < 2; quietest++)
+      {
+        if (check(names[p], passage, budgets[b], quietest, verbose, untracked) < 0)
+        {
+          failed = 1;
+        }
+      }
+    }
+  }
+  synth.setPolyphony(0);
+  return failed;
+}
@@ -3,6 +3,26 @@
 
   Originally created 25 March 2011
 
+  Buffered mode: with setBuffered(true), print(), setCursor(), clear(),
+  home() and the icon methods only change a copy of the display kept in
+  RAM, and update(), called from the main loop, sends the cells that
+  changed, one command or one chained character per call.  update() never
+  waits for the display: while the previous command is still executing it
+  returns straight away.  The other commands are sent as they are called.
+
+  Transport: the bytes are clocked out by the caller, each one holding it
+  up for 450 us, or after transmitThrough(tx) queued for a transmitter the
+  sketch declares, e.g. a TimerVfdTx from the library of that name, which
+  clocks them out from Timer0's compare match B interrupt.  Each command
+  then goes into the queue with the time the display takes to execute it,
+  and the queue holds the next one back until the display is done, so no
+  call waits on the display, begin() and its reset included.  The text
+  chaining window is counted from the end of the last byte on the line,
+  and buffered update() only sends a command once the queue is empty.
+  The display only knows it as an HpDecVfdTransmitter, so a sketch that
+  does not include TimerVfdTx.h does not compile its queue or take
+  Timer0's compare match B interrupt.
+
   This file is in the public domain.  
 */
 
@@ -13,6 +33,7 @@ HpDecVfd::HpDecVfd(uint8_t clockPin, uint8_t dataPin)
 {
   _clockPin = clockPin;
   _dataPin = dataPin;
+  _transmitter = 0;
  
   // Zero out icon state.
   for (uint8_t i=0; i<ICON_STATE_SIZE; i++)
@@ -28,6 +49,10 @@ HpDecVfd::HpDecVfd(uint8_t clockPin, uint8_t dataPin)
   _desiredCursorAddress = 0;
   _actualCursorAddress = 0;
 
+  _buffered = false;
+  clearFrame();
+  _iconsDirty = false;
+
   // Configure pins.
   digitalWrite(clockPin, HIGH);
   pinMode(clockPin, OUTPUT);
@@ -42,6 +67,12 @@ HpDecVfd::~HpDecVfd()
   
 void HpDecVfd::begin(bool clearDisplay)
 {
+  // Not in the constructor: init() sets Timer0 up after it has run.
+  if (_transmitter)
+  {
+    _transmitter->begin(_clockPin, _dataPin);
+  }
+
   // Reset the display.
   resetDisplay();
   
@@ -59,10 +90,27 @@ void HpDecVfd::begin(bool clearDisplay)
   
 void HpDecVfd::clear()
 {
+  if (_buffered)
+  {
+    // Blank every cell that is not blank yet.
+    for (uint8_t row=0; row<FRAME_ROWS; row++)
+    {
+      for (uint8_t column=0; column<FRAME_COLUMNS; column++)
+      {
+        if (_frame[row][column] != ' ')
+        {
+          _frame[row][column] = ' ';
+          _dirtyCells[row] |= (uint32_t)1 << column;
+        }
+      }
+    }
+    home();
+    return;
+  }
+
   // Send clear command.
   beginCommand(COMMAND_EXTENDED_COMMANDS);
   sendByte(EXTENDED_COMMAND_CLEAR);
-  endCommand();
   
   // Clear does home the cursor but the display 
   // starts on the bottom line so we correct for that 
@@ -72,6 +120,13 @@ void HpDecVfd::clear()
   
 void HpDecVfd::home()
 {
+  if (_buffered)
+  {
+    _frameColumn = 0;
+    _frameRow = 0;
+    return;
+  }
+
   setCursorAddress(0b01000000); // Display uses bottom row as first row so invert to be normal.
 }
   
@@ -79,18 +134,23 @@ void HpDecVfd::noDisplay()
 {
   beginCommand(COMMAND_EXTENDED_COMMANDS);
   sendByte(EXTENDED_COMMAND_BLANK_DISPLAY);
-  endCommand();
 }
   
 void HpDecVfd::display()
 {
   beginCommand(COMMAND_EXTENDED_COMMANDS);
   sendByte(EXTENDED_COMMAND_UNBLANK_DISPLAY);
-  endCommand();
 }
   
 void HpDecVfd::setCursor(uint8_t column, uint8_t row)
 {
+  if (_buffered)
+  {
+    _frameColumn = column;
+    _frameRow = row;
+    return;
+  }
+
   uint8_t address = row * 64 + column; // Compute address.
   address ^= 0b01000000; // Display uses bottom row as first row so invert to be normal.
 
@@ -101,6 +161,21 @@ void HpDecVfd::setCursor(uint8_t column, uint8_t row)
 /*virtual*/ 
 size_t HpDecVfd::write(uint8_t character)
 {
+  if (_buffered)
+  {
+    // Only a cell that changes has to be sent.
+    if (_frameRow < FRAME_ROWS && _frameColumn < FRAME_COLUMNS && _frame[_frameRow][_frameColumn] != character)
+    {
+      _frame[_frameRow][_frameColumn] = character;
+      _dirtyCells[_frameRow] |= (uint32_t)1 << _frameColumn;
+    }
+    if (_frameColumn < 0xff)
+    {
+      _frameColumn++;
+    }
+    return 1;
+  }
+
   if (_sendingText && timingOkToChainCharacter())
   {
     // Chain onto the current draw text command.
@@ -128,12 +203,18 @@ size_t HpDecVfd::write(uint8_t character)
     // Set flag so next character can chain.
     _sendingText = true;
   }  
+
+  return 1;
+}
+
+void HpDecVfd::transmitThrough(HpDecVfdTransmitter &transmitter)
+{
+  _transmitter = &transmitter;
 }
 
 void HpDecVfd::resetDisplay()
 {
-  beginCommand(COMMAND_RESET_DISPLAY);
-  endCommand(RESET_COMMAND_EXECUTION_TIME_IN_MICROSECONDS);
+  beginCommand(COMMAND_RESET_DISPLAY, RESET_COMMAND_EXECUTION_TIME_IN_MICROSECONDS);
 }
 
 void HpDecVfd::setBrightness(uint8_t level) // Level is 0 to 15.
@@ -144,7 +225,6 @@ void HpDecVfd::setBrightness(uint8_t level) // Level is 0 to 15.
   }
   
   beginCommand(COMMAND_SET_BRIGHTNESS | level);
-  endCommand();
 }
 
 void HpDecVfd::clearIcons()
@@ -154,6 +234,12 @@ void HpDecVfd::clearIcons()
     _iconState[i] = 0;
   }
 
+  if (_buffered)
+  {
+    _iconsDirty = true;
+    return;
+  }
+
   sendIconState();  
 }
 
@@ -171,6 +257,12 @@ void HpDecVfd::setIcon(Icon icon, bool enable)
     _iconState[stateIndex] &= ~bitMask;
   }
   
+  if (_buffered)
+  {
+    _iconsDirty = true;
+    return;
+  }
+
   sendIconState();
 }
   
@@ -183,6 +275,127 @@ bool HpDecVfd::isIconSet(Icon icon)
 }
 
 
+void HpDecVfd::setBuffered(bool buffered)
+{
+  if (buffered && !_buffered)
+  {
+    // The display is blank, and a text command left open is ended by
+    // the first command update() sends.
+    clearFrame();
+    _iconsDirty = false;
+    _frameColumn = 0;
+    _frameRow = 0;
+  }
+  else if (!buffered && _buffered)
+  {
+    // Whatever is still to send goes now, waiting as the commands do.
+    while (update())
+    {
+      waitForPreviousCommandToExecute();
+    }
+    _buffered = false;
+    setCursor(_frameColumn, _frameRow);
+    return;
+  }
+  _buffered = buffered;
+}
+
+bool HpDecVfd::update()
+{
+  uint8_t row;
+  uint8_t column;
+
+  if (!_buffered)
+  {
+    return false;
+  }
+
+  bool more = nextDirtyCell(row, column);
+
+  if (_sendingText)
+  {
+    // A changed cell a little further on the same row chains onto the
+    // draw text command, the cells in between drawn again as they are:
+    // cheaper than a new cursor and text command, and no waiting.
+    uint8_t cursor = _actualCursorAddress ^ 0b01000000;
+    uint8_t cursorRow = cursor >> 6;
+    uint8_t cursorColumn = cursor & 0b00111111;
+    if (more && !_iconsDirty && row == cursorRow && column >= cursorColumn
+      && column - cursorColumn <= MAX_CHAIN_GAP && timingOkToChainCharacter())
+    {
+      sendByte(_frame[cursorRow][cursorColumn]);
+      _dirtyCells[cursorRow] &= ~((uint32_t)1 << cursorColumn);
+      _desiredCursorAddress = _actualCursorAddress = (_actualCursorAddress + 1) & 0b01111111;
+      return true;
+    }
+    endText();
+    return more || _iconsDirty;
+  }
+
+  // The display is still busy with the last command, or the queue still
+  // holds it, come back later: a cell that changes again meanwhile is
+  // sent once.
+  if (!previousCommandExecuted() || (_transmitter && _transmitter->pending()))
+  {
+    return more || _iconsDirty;
+  }
+
+  if (_iconsDirty)
+  {
+    _iconsDirty = false;
+    sendIconState();
+    return true;
+  }
+
+  if (!more)
+  {
+    return false;
+  }
+
+  uint8_t address = (row * 64 + column) ^ 0b01000000; // Bottom row first, as in setCursor.
+  if (address != _actualCursorAddress)
+  {
+    setCursorAddress(address);
+    return true;
+  }
+
+  // Start text and draw the first character.
+  beginCommand(COMMAND_DRAW_TEXT);
+  sendByte(_frame[row][column]);
+  _dirtyCells[row] &= ~((uint32_t)1 << column);
+  _desiredCursorAddress = _actualCursorAddress = (_actualCursorAddress + 1) & 0b01111111;
+  _sendingText = true;
+  return true;
+}
+
+void HpDecVfd::clearFrame()
+{
+  for (uint8_t row=0; row<FRAME_ROWS; row++)
+  {
+    for (uint8_t column=0; column<FRAME_COLUMNS; column++)
+    {
+      _frame[row][column] = ' ';
+    }
+    _dirtyCells[row] = 0;
+  }
+}
+
+// The first cell still to send, top row first and left to right.
+bool HpDecVfd::nextDirtyCell(uint8_t &row, uint8_t &column)
+{
+  for (row=0; row<FRAME_ROWS; row++)
+  {
+    if (_dirtyCells[row])
+    {
+      column = __builtin_ctzl(_dirtyCells[row]);
+      return true;
+    }
+  }
+  row = 0;
+  column = 0;
+  return false;
+}
+
 uint8_t HpDecVfd::getIconBitMask(Icon icon, uint8_t &iconStateIndexOut)
 {
   if (icon >= 0 && icon < NUM_ICONS)
@@ -215,7 +428,6 @@ void HpDecVfd::sendIconState()
   {
     sendByte(_iconState[i]);
   }
-  endCommand();
 }
 
 void HpDecVfd::setCursorAddress(uint8_t address)
@@ -224,49 +436,75 @@ void HpDecVfd::setCursorAddress(uint8_t address)
 
   beginCommand(COMMAND_EXTENDED_COMMANDS);
   sendByte(EXTENDED_COMMAND_SET_CURSOR | address);
-  endCommand();
   
   _desiredCursorAddress = _actualCursorAddress = address;
 }
 
-void HpDecVfd::beginCommand(uint8_t command)
+void HpDecVfd::beginCommand(uint8_t command, unsigned long executionTimeInMicroseconds)
 {
   if (_sendingText)
   {
     endText();
   }
  
+  if (_transmitter)
+  {
+    // The queue holds the command back until the display is ready.
+    _transmitter->writeCommand(command, executionTimeInMicroseconds / 1000);
+    return;
+  }
+
   waitForPreviousCommandToExecute();
   
   sendByte(command);
-}
-
-void HpDecVfd::endCommand(unsigned long executionTimeInMicroseconds)
-{
   _lastCommandExecuteTimeInMicroseconds = executionTimeInMicroseconds;  
 }
 
 
 bool HpDecVfd::timingOkToChainCharacter()
 {
+  if (_transmitter)
+  {
+    // A byte still on its way is followed straight on by the next.
+    if (_transmitter->pending())
+    {
+      return true;
+    }
+    _lastSendTime = _transmitter->lastSendTime();
+  }
   return ((micros() - _lastSendTime) < MAX_TEXT_CHAIN_TIME_IN_MICROSECONDS);
 }
 
 void HpDecVfd::endText()
 {
   _sendingText = false;
-  endCommand();
 }
   
 void HpDecVfd::waitForPreviousCommandToExecute()
 {
-  while ( (micros() - _lastSendTime) < _lastCommandExecuteTimeInMicroseconds )
+  while (!previousCommandExecuted())
+  {
+  }
+}
+
+bool HpDecVfd::previousCommandExecuted()
+{
+  // The queue does the waiting.
+  if (_transmitter)
   {
+    return true;
   }
+  return (micros() - _lastSendTime) >= _lastCommandExecuteTimeInMicroseconds;
 }
 
 void HpDecVfd::sendByte(uint8_t byteToSend)
 {
+  if (_transmitter)
+  {
+    _transmitter->write(byteToSend);
+    return;
+  }
+
   for (uint8_t mask = 0x80; mask; mask>>=1)
   {
     digitalWrite(_dataPin, (byteToSend & mask) ? HIGH : LOW);
@@ -3,6 +3,26 @@
   
   Originally created 25 March 2011
 
+  Buffered mode: with setBuffered(true), print(), setCursor(), clear(),
+  home() and the icon methods only change a copy of the display kept in
+  RAM, and update(), called from the main loop, sends the cells that
+  changed, one command or one chained character per call.  update() never
+  waits for the display: while the previous command is still executing it
+  returns straight away.  The other commands are sent as they are called.
+
+  Transport: the bytes are clocked out by the caller, each one holding it
+  up for 450 us, or after transmitThrough(tx) queued for a transmitter the
+  sketch declares, e.g. a TimerVfdTx from the library of that name, which
+  clocks them out from Timer0's compare match B interrupt.  Each command
+  then goes into the queue with the time the display takes to execute it,
+  and the queue holds the next one back until the display is done, so no
+  call waits on the display, begin() and its reset included.  The text
+  chaining window is counted from the end of the last byte on the line,
+  and buffered update() only sends a command once the queue is empty.
+  The display only knows it as an HpDecVfdTransmitter, so a sketch that
+  does not include TimerVfdTx.h does not compile its queue or take
+  Timer0's compare match B interrupt.
+
   This file is in the public domain.  
 */
 
@@ -12,6 +32,23 @@
 #include <inttypes.h>
 #include "Print.h"
 
+// Clocks the bytes out to the display in place of the delay loop, for
+// HpDecVfd::transmitThrough().
+class HpDecVfdTransmitter
+{
+public:
+  // The pins are set up as outputs, clock high, by the caller.
+  virtual void begin(uint8_t clockPin, uint8_t dataPin) = 0;
+  // The first byte of a command the display takes executeTime ms over.
+  virtual void writeCommand(uint8_t command, uint8_t executeTime) = 0;
+  // A byte of the command last written.
+  virtual size_t write(uint8_t byte) = 0;
+  // Bytes written and not yet out on the line.
+  virtual uint8_t pending() = 0;
+  // The micros() at which the last byte was complete.
+  virtual unsigned long lastSendTime() = 0;
+};
+
 // API is designed to be as close to the standard LiquidCrystal library as possible.
 class HpDecVfd : public Print {
 
@@ -62,12 +99,26 @@ public:
   size_t write(uint8_t character);
 
   // Methods new to our class.
+  // The bytes are queued for transmitter instead of clocked out with
+  // delayMicroseconds(); before begin().
+  void transmitThrough(HpDecVfdTransmitter &transmitter);
   void resetDisplay();
   void setBrightness(uint8_t level); // Level is 0 to 15.
   
   void clearIcons();
   void setIcon(Icon icon, bool enable);
   bool isIconSet(Icon icon);
+
+  // Buffered mode.  The frame starts out blank, so turn it on with the
+  // display blank, after begin() or clear().
+  void setBuffered(bool buffered);
+  // Sends the next changed cells or the icons; returns true while there
+  // is more to send.
+  bool update();
+
+  // Columns held in the frame, per row; buffered text beyond is dropped.
+  static const uint8_t FRAME_COLUMNS = 20;
+  static const uint8_t FRAME_ROWS = 2;
     
   // These LiquidCrystal methods are not implemented.
 //  void noBlink();
@@ -104,8 +155,13 @@ private:
 
   static const uint8_t ICON_STATE_SIZE = 3;
 
+  // Buffered mode chains over up to this many unchanged cells to the next
+  // changed one; a new cursor and text command is 3 bytes and two waits.
+  static const uint8_t MAX_CHAIN_GAP = 3;
+
   uint8_t _clockPin;
   uint8_t _dataPin;
+  HpDecVfdTransmitter *_transmitter; // 0 for the delay loop
   
   uint8_t _iconState[ICON_STATE_SIZE];
 
@@ -119,18 +175,30 @@ private:
   bool _sendingText;
   uint8_t _desiredCursorAddress;
   uint8_t _actualCursorAddress;
+
+  // Buffered mode: the text the display should show, a bit per cell for
+  // the ones it does not show yet, and where the next character goes.
+  bool _buffered;
+  uint8_t _frame[FRAME_ROWS][FRAME_COLUMNS];
+  uint32_t _dirtyCells[FRAME_ROWS];
+  bool _iconsDirty;
+  uint8_t _frameColumn;
+  uint8_t _frameRow;
   
   uint8_t getIconBitMask(Icon icon, uint8_t &iconStateIndexOut);
   void sendIconState();
 
   void setCursorAddress(uint8_t address);
   
-  void beginCommand(uint8_t command);
-  void endCommand(unsigned long executionTimeInMicroseconds = DEFAULT_COMMAND_EXECUTION_TIME_IN_MICROSECONDS);
+  void beginCommand(uint8_t command, unsigned long executionTimeInMicroseconds = DEFAULT_COMMAND_EXECUTION_TIME_IN_MICROSECONDS);
   void sendByte(uint8_t byteToSend);
   void endText();
   void waitForPreviousCommandToExecute();
+  bool previousCommandExecuted();
   bool timingOkToChainCharacter();  
+
+  void clearFrame();
+  bool nextDirtyCell(uint8_t &row, uint8_t &column);
 };
 
 #endif // HP_DEC_VFD_H
@@ -0,0 +1,96 @@
+/*
+  KeyEventQueue Library - Implementation
+
+  This file is in the public domain.
+*/
+
+#include "KeyEventQueue.h"
+#include "Arduino.h"
+
+// Keeps the compiler from moving memory accesses across it.
+#define KEY_EVENT_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+KeyEventQueue::KeyEventQueue()
+{
+  _head = 0;
+  _tail = 0;
+  _overflows = 0;
+  _highWater = 0;
+}
+
+bool KeyEventQueue::push(uint8_t key, uint8_t manual, bool on, uint16_t time)
+{
+  uint8_t head = _head;
+  uint8_t fill = head - _tail;
+
+  if (fill >= KEY_EVENT_QUEUE_SIZE)
+  {
+    _overflows++;
+    return false;
+  }
+
+  KeyEvent &event = _events[head & INDEX_MASK];
+  event.code = key & KeyEvent::KEY_MASK;
+  event.bus = manual;
+  if (on)
+  {
+    event.code |= KeyEvent::ON;
+  }
+  event.time = time;
+
+  // The event has to be in place before the consumer can see it.
+  KEY_EVENT_BARRIER();
+  _head = head + 1;
+
+  if (fill + 1 > _highWater)
+  {
+    _highWater = fill + 1;
+  }
+  return true;
+}
+
+bool KeyEventQueue::pop(KeyEvent &event)
+{
+  uint8_t tail = _tail;
+
+  if (tail == _head)
+  {
+    return false;
+  }
+
+  // Read the event before handing its slot back to the producer.
+  KEY_EVENT_BARRIER();
+  event = _events[tail & INDEX_MASK];
+  KEY_EVENT_BARRIER();
+  _tail = tail + 1;
+  return true;
+}
+
+uint8_t KeyEventQueue::available()
+{
+  return (uint8_t)(_head - _tail);
+}
+
+uint16_t KeyEventQueue::overflows()
+{
+  // Two bytes the producer may change in between.
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t overflows = _overflows;
+  SREG = oldSREG;
+  return overflows;
+}
+
+uint8_t KeyEventQueue::highWater()
+{
+  return _highWater;
+}
+
+void KeyEventQueue::clearStatistics()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  _overflows = 0;
+  _highWater = 0;
+  SREG = oldSREG;
+}
@@ -0,0 +1,75 @@
+/*
+  KeyEventQueue Library - Declaration file
+
+  A fixed size queue of key changes from the keyboard scan to the code
+  that sends them.  One side may push and the other pop at the same time,
+  from an interrupt and the main loop, without turning interrupts off:
+  only the producer writes _head and only the consumer writes _tail, and
+  each is a single byte, which the AVR reads and writes in one go.
+
+  This file is in the public domain.
+*/
+
+#ifndef KEY_EVENT_QUEUE_H
+#define KEY_EVENT_QUEUE_H
+
+#include <inttypes.h>
+
+// number of events the queue holds, a power of two no larger than 128
+#ifndef KEY_EVENT_QUEUE_SIZE
+#define KEY_EVENT_QUEUE_SIZE 32
+#endif
+
+// one key change, 4 bytes
+struct KeyEvent
+{
+  static const uint8_t KEY_MASK = 0x3f;
+  static const uint8_t ON = 0x80;
+
+  // key 0 - 63, ON for a press
+  uint8_t code;
+  // the keyboard bus the key is on, 0 for the lower manual
+  uint8_t bus;
+  // micros() / 4 at the scan that saw the change, wraps every 262 ms
+  uint16_t time;
+
+  uint8_t key() const { return code & KEY_MASK; }
+  uint8_t manual() const { return bus; }
+  bool on() const { return (code & ON) != 0; }
+};
+
+class KeyEventQueue {
+
+public:
+
+  KeyEventQueue();
+
+  // Producer side.
+  // Returns false and counts an overflow if the queue is full.
+  bool push(uint8_t key, uint8_t manual, bool on, uint16_t time);
+
+  // Consumer side.
+  // Returns false if the queue is empty.
+  bool pop(KeyEvent &event);
+  uint8_t available();
+
+  // Statistics, safe to read from the consumer side.
+  uint16_t overflows();
+  uint8_t highWater();
+  void clearStatistics();
+
+private:
+
+  static const uint8_t INDEX_MASK = KEY_EVENT_QUEUE_SIZE - 1;
+
+  KeyEvent _events[KEY_EVENT_QUEUE_SIZE];
+
+  // Free running counts of events pushed and popped, the difference is the fill.
+  volatile uint8_t _head;
+  volatile uint8_t _tail;
+
+  volatile uint16_t _overflows;
+  volatile uint8_t _highWater;
+};
+
+#endif // KEY_EVENT_QUEUE_H
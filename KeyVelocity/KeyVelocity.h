@@ -0,0 +1,141 @@
+/*
+  KeyVelocity Library - Declaration and implementation
+
+  Note-on velocity from keyboards with two contacts per key.  The first
+  contact closes as the key starts down, the second near the bottom of
+  its travel; the time between the two is how fast the key was played,
+  and a curve table in flash turns it into a MIDI velocity.  The two
+  contacts are two bus bars, scanned as two buses of the same shift
+  chain, so the times are the scan times in the KeyEvents.
+
+  . start() at the first contact, strike() at the second, which returns
+    the velocity; cancel() when the first contact opens again, so a key
+    let up before it reached the bottom plays nothing.
+  . Times are in the units of KeyEvent::time, micros() / 4 in the
+    sketches.  The resolution is the scan interval: at a 2 kHz scan a
+    stroke is measured to within 0.5 ms.  A stroke longer than the 16
+    bit time wraps (262 ms) is measured short, so the curve should reach
+    its softest well before that.
+  . The curve is count velocities, entry n for a stroke of n steps; a
+    stroke longer than the table gets the last entry.
+  . Only the keys between their two contacts are kept, SLOTS of them, 4
+    bytes each.  When they are all taken one of them is dropped, each
+    slot in turn, and its strike gets the last entry of the curve, the
+    softest, as for the slowest stroke there is.
+
+  This file is in the public domain.
+*/
+
+#ifndef KEY_VELOCITY_H
+#define KEY_VELOCITY_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+template <uint8_t SLOTS>
+class KeyVelocity {
+
+public:
+
+  // curve is a table in flash of count velocities, entry n for a stroke
+  // of n steps of step time units
+  KeyVelocity(const uint8_t *curve, uint8_t count, uint16_t step)
+  {
+    _curve = curve;
+    _count = count;
+    _step = step;
+    _next = 0;
+    for (uint8_t i = 0; i < SLOTS; i++)
+    {
+      _strokes[i].division = FREE;
+    }
+  }
+
+  // The first contact of a key closed at time.
+  void start(uint8_t division, uint8_t key, uint16_t time)
+  {
+    uint8_t i = find(division, key);
+    if (i == SLOTS)
+    {
+      i = find(FREE, 0);
+    }
+    if (i == SLOTS)
+    {
+      // all taken, one goes, each slot in turn
+      i = _next;
+      _next = (_next + 1) % SLOTS;
+    }
+    _strokes[i].division = division;
+    _strokes[i].key = key;
+    _strokes[i].time = time;
+  }
+
+  // The first contact opened again.
+  void cancel(uint8_t division, uint8_t key)
+  {
+    uint8_t i = find(division, key);
+    if (i != SLOTS)
+    {
+      _strokes[i].division = FREE;
+    }
+  }
+
+  // The second contact closed at time; returns the velocity, 1 to 127
+  // if the curve holds nothing else.
+  uint8_t strike(uint8_t division, uint8_t key, uint16_t time)
+  {
+    uint8_t i = find(division, key);
+    if (i == SLOTS)
+    {
+      return pgm_read_byte(&_curve[_count - 1]);
+    }
+    _strokes[i].division = FREE;
+    return velocity(time - _strokes[i].time);
+  }
+
+  // The curve's velocity for a stroke of the given time.
+  uint8_t velocity(uint16_t time)
+  {
+    uint16_t n = time / _step;
+    if (n >= _count)
+    {
+      n = _count - 1;
+    }
+    return pgm_read_byte(&_curve[n]);
+  }
+
+private:
+
+  static const uint8_t FREE = 0xff;
+
+  // a key between its two contacts
+  struct Stroke
+  {
+    uint8_t division;
+    uint8_t key;
+    uint16_t time;
+  };
+
+  const uint8_t *_curve;
+  uint8_t _count;
+  uint16_t _step;
+  // the slot start() takes when none is free
+  uint8_t _next;
+  Stroke _strokes[SLOTS];
+
+  // the slot of a key, SLOTS if it has none
+  uint8_t find(uint8_t division, uint8_t key)
+  {
+    uint8_t i;
+    for (i = 0; i < SLOTS; i++)
+    {
+      if (_strokes[i].division == division && (division == FREE || _strokes[i].key == key))
+      {
+        break;
+      }
+    }
+    return i;
+  }
+};
+
+#endif // KEY_VELOCITY_H
@@ -0,0 +1,247 @@
+/*
+  KeyboardScanner Library - Declaration and implementation
+
+  Reads bus bar organ keyboards through a chain of 74LS165 shift
+  registers, debounces the keys and queues the changes.  The number of
+  chips in the chain, the number of buses (manuals, pedals) and the pins
+  are template parameters, so every loop is unrolled at compile time and
+  every pin access becomes a single port instruction: one scan of 4 buses
+  of 8 chips is straight line code, with no loop counters, no index
+  arithmetic on the state arrays and no pin tables.
+
+  . PINS is a class with the pin operations as static inline functions,
+    written by the sketch for its wiring:
+        static const uint8_t LOAD_PULSE_USEC;  // load pulse, bus settling
+        static void selectBus(uint8_t bus);    // drive this bus only
+        static void loadLow();
+        static void loadHigh();
+        static uint8_t data();                 // nonzero if the data pin is high
+        static void clock();                   // one rising edge
+    selectBus() is always called with a constant, so a switch in it
+    folds down to the one write for that bus.
+  . The last chip comes out of the chain first, and the first bit out of
+    a chip is its highest key: key n of a bus is bit n % 8 of chip n / 8.
+  . A press is reported on the first scan that sees the contact close, a
+    release only once the contact has read open on 3 scans in a row.  A
+    change the queue has no room for is left for the next scan.
+  . Up to 8 chips (64 keys, the range of KeyEvent) and up to 4 buses.
+
+  Written for avr-gcc 4.3, so no variadic templates: the pins come as one
+  class rather than a list.
+
+  This file is in the public domain.
+*/
+
+#ifndef KEYBOARD_SCANNER_H
+#define KEYBOARD_SCANNER_H
+
+#include <inttypes.h>
+#include "Arduino.h"
+#include "KeyEventQueue.h"
+
+// gcc would rather call a function used 32 times than copy it, which would
+// bring back the run time indices the template is there to get rid of
+#define KEYBOARD_SCANNER_INLINE inline __attribute__((always_inline))
+
+// The unrolled loops: N steps left, the step's index a constant.
+// Separate classes, as a member template can not be specialized in place.
+template <class SCANNER, uint8_t BUS, uint8_t N>
+struct KeyboardScannerChips
+{
+  static KEYBOARD_SCANNER_INLINE void scan(SCANNER &scanner, KeyEventQueue &queue, uint16_t time)
+  {
+    // the last chip first, as it comes out of the chain
+    scanner.template scanChip<BUS, N - 1>(queue, time);
+    KeyboardScannerChips<SCANNER, BUS, N - 1>::scan(scanner, queue, time);
+  }
+};
+
+template <class SCANNER, uint8_t BUS>
+struct KeyboardScannerChips<SCANNER, BUS, 0>
+{
+  static KEYBOARD_SCANNER_INLINE void scan(SCANNER &, KeyEventQueue &, uint16_t) {}
+};
+
+template <class SCANNER, uint8_t BUS, uint8_t N>
+struct KeyboardScannerBuses
+{
+  static KEYBOARD_SCANNER_INLINE void scan(SCANNER &scanner, KeyEventQueue &queue, uint16_t time)
+  {
+    scanner.template scanBus<BUS>(queue, time);
+    KeyboardScannerBuses<SCANNER, BUS + 1, N - 1>::scan(scanner, queue, time);
+  }
+};
+
+template <class SCANNER, uint8_t BUS>
+struct KeyboardScannerBuses<SCANNER, BUS, 0>
+{
+  static KEYBOARD_SCANNER_INLINE void scan(SCANNER &, KeyEventQueue &, uint16_t) {}
+};
+
+template <uint8_t CHIPS, uint8_t BUSES, class PINS>
+class KeyboardScanner {
+
+public:
+
+  typedef KeyboardScanner<CHIPS, BUSES, PINS> Scanner;
+
+  static const uint8_t CHIP_COUNT = CHIPS;
+  static const uint8_t BUS_COUNT = BUSES;
+  static const uint8_t KEY_COUNT = CHIPS * 8;
+
+  KeyboardScanner()
+  {
+    for (uint8_t bus = 0; bus < BUSES; bus++)
+    {
+      for (uint8_t chip = 0; chip < CHIPS; chip++)
+      {
+        _down[bus][chip] = 0;
+        _count0[bus][chip] = 0;
+        _count1[bus][chip] = 0;
+      }
+    }
+  }
+
+  // Reads every bus, lowest first, and queues the debounced key changes.
+  // time is stored in the events, micros() / 4 in the sketches.
+  void scan(KeyEventQueue &queue, uint16_t time)
+  {
+    KeyboardScannerBuses<Scanner, 0, BUSES>::scan(*this, queue, time);
+  }
+
+  // Debounced state of the keys chip * 8 to chip * 8 + 7 of a bus, bit 0
+  // the lowest, 1 for down.
+  uint8_t keys(uint8_t bus, uint8_t chip) const
+  {
+    return _down[bus][chip];
+  }
+
+  // Debounced state of every key of a bus, bit n for key n.  The scan
+  // changes it from its interrupt, so read it with interrupts off.
+  uint64_t keys(uint8_t bus) const
+  {
+    uint64_t word = 0;
+    for (uint8_t chip = CHIPS; chip-- > 0;)
+    {
+      word = (word << 8) | _down[bus][chip];
+    }
+    return word;
+  }
+
+  // The steps of scan(), public only for the unrolling classes above.
+  template <uint8_t BUS>
+  KEYBOARD_SCANNER_INLINE void scanBus(KeyEventQueue &queue, uint16_t time)
+  {
+    PINS::selectBus(BUS);
+
+    // a parallel load latches the state of all the data lines
+    // the pulse also gives the bus time to settle
+    PINS::loadLow();
+    delayMicroseconds(PINS::LOAD_PULSE_USEC);
+    PINS::loadHigh();
+
+    KeyboardScannerChips<Scanner, BUS, CHIPS>::scan(*this, queue, time);
+  }
+
+  template <uint8_t BUS, uint8_t CHIP>
+  KEYBOARD_SCANNER_INLINE void scanChip(KeyEventQueue &queue, uint16_t time)
+  {
+    uint8_t byteVal = shiftIn();
+
+    // keys that read different from their debounced state
+    uint8_t changed = byteVal ^ _down[BUS][CHIP];
+
+    // 2 bit vertical counters, count up the keys that changed, clear the
+    // count of the others
+    uint8_t oldCount0 = _count0[BUS][CHIP];
+    uint8_t oldCount1 = _count1[BUS][CHIP];
+    uint8_t count1 = (oldCount1 ^ oldCount0) & changed;
+    uint8_t count0 = ~oldCount0 & changed;
+
+    // presses go through at once, releases once the count reaches 3
+    uint8_t toggle = (changed & byteVal) | (changed & count0 & count1);
+
+    if (toggle == 0)
+    {
+      _count0[BUS][CHIP] = count0;
+      _count1[BUS][CHIP] = count1;
+      return;
+    }
+
+    uint8_t queued = queueEvents(toggle, byteVal, CHIP, BUS, queue, time);
+    _down[BUS][CHIP] ^= queued;
+
+    // a key that toggled starts counting again
+    // a key that did not fit keeps its old count and toggles on the next scan
+    uint8_t deferred = toggle & ~queued;
+    _count0[BUS][CHIP] = (count0 & ~toggle) | (oldCount0 & deferred);
+    _count1[BUS][CHIP] = (count1 & ~toggle) | (oldCount1 & deferred);
+  }
+
+private:
+
+  // a KeyEvent has 6 bits for the key; 4 buses is what the shift chain
+  // can tell apart on one scan interrupt
+  typedef char ChipsFit[CHIPS >= 1 && CHIPS <= 8 ? 1 : -1];
+  typedef char BusesFit[BUSES >= 1 && BUSES <= 4 ? 1 : -1];
+
+  // debounced key state, one bit per key, 1 means down
+  uint8_t _down[BUSES][CHIPS];
+  // one bit of each key's counter per byte, the scans in a row that the
+  // key has read different from _down
+  uint8_t _count0[BUSES][CHIPS];
+  uint8_t _count1[BUSES][CHIPS];
+
+  // The eight bits of one chip, the first one out is the MSB.
+  // Read the data line, then a rising clock edge shifts the next bit.
+  static KEYBOARD_SCANNER_INLINE uint8_t shiftIn()
+  {
+    uint8_t byteVal = 0;
+
+    #define KEYBOARD_SCANNER_BIT(mask) \
+      if (PINS::data()) \
+      { \
+        byteVal |= (mask); \
+      } \
+      PINS::clock();
+
+    KEYBOARD_SCANNER_BIT(0x80);
+    KEYBOARD_SCANNER_BIT(0x40);
+    KEYBOARD_SCANNER_BIT(0x20);
+    KEYBOARD_SCANNER_BIT(0x10);
+    KEYBOARD_SCANNER_BIT(0x08);
+    KEYBOARD_SCANNER_BIT(0x04);
+    KEYBOARD_SCANNER_BIT(0x02);
+    KEYBOARD_SCANNER_BIT(0x01);
+
+    #undef KEYBOARD_SCANNER_BIT
+
+    return byteVal;
+  }
+
+  // Queues an event for each key of a chip that toggled, lowest key first.
+  // Returns the keys that were queued, all of them unless the queue filled up.
+  // Only runs when a key changed, so it stays out of line.
+  static __attribute__((noinline)) uint8_t queueEvents(uint8_t toggle, uint8_t byteVal, uint8_t chip,
+    uint8_t bus, KeyEventQueue &queue, uint16_t time)
+  {
+    uint8_t bits = toggle;
+
+    while (bits != 0)
+    {
+      // the lowest set bit, found by counting trailing zeros
+      uint8_t lowest = bits & -bits;
+      // a key that toggled to 1 was pressed, to 0 released
+      if (!queue.push(chip * 8 + __builtin_ctz(bits), bus, byteVal & lowest, time))
+      {
+        // no room, this key and the ones after it wait for the next scan
+        return toggle & ~bits;
+      }
+      bits &= bits - 1;
+    }
+
+    return toggle;
+  }
+};
+
+#endif // KEYBOARD_SCANNER_H
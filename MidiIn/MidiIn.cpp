@@ -0,0 +1,180 @@
+/*
+  MidiIn Library - Implementation
+
+  This file is in the public domain.
+*/
+
+#include "MidiIn.h"
+
+// Bytes in a message with the given status, status included; 0 for the
+// undefined system common statuses.
+static uint8_t messageLength(uint8_t status)
+{
+  switch (status & 0xf0)
+  {
+    case 0xc0:
+    case 0xd0:
+      return 2;
+    case 0xf0:
+      switch (status)
+      {
+        case 0xf1:
+        case 0xf3:
+          return 2;
+        case 0xf2:
+          return 3;
+        case 0xf6:
+          return 1;
+        default:
+          return 0;
+      }
+    default:
+      return 3;
+  }
+}
+
+MidiIn::MidiIn()
+{
+  _message = _buffer;
+  reset();
+  clearStatistics();
+}
+
+void MidiIn::reset()
+{
+  _running = 0;
+  _expected = 0;
+  _length = 0;
+  _sysex = 0;
+  _overflow = 0;
+}
+
+uint8_t MidiIn::parse(uint8_t c)
+{
+  uint8_t length;
+
+  // real time messages may come anywhere and leave the rest alone
+  if (c >= 0xf8)
+  {
+    _realTime = c;
+    _message = &_realTime;
+    return 1;
+  }
+
+  if (c & 0x80)
+  {
+    // any status byte ends a system exclusive message
+    if (_sysex)
+    {
+      _sysex = 0;
+      if (c == 0xf7 && !_overflow)
+      {
+        // there is always room left for the F7
+        _buffer[_length++] = c;
+        _message = _buffer;
+        length = _length;
+        _length = 0;
+        return length;
+      }
+      _dropped++;
+      _length = 0;
+      if (c == 0xf7)
+      {
+        return 0;
+      }
+    }
+    _length = 0;
+
+    if (c == 0xf7)
+    {
+      // an end with no start
+      _strayBytes++;
+      return 0;
+    }
+    if (c == 0xf0)
+    {
+      _running = 0;
+      _sysex = 1;
+      _overflow = 0;
+      _buffer[_length++] = c;
+      return 0;
+    }
+
+    // system common cancels running status once its message is complete
+    _running = c;
+    _expected = messageLength(c);
+    if (_expected == 0)
+    {
+      _running = 0;
+      return 0;
+    }
+    _buffer[_length++] = c;
+    if (_expected == 1)
+    {
+      _running = 0;
+      _message = _buffer;
+      _length = 0;
+      return 1;
+    }
+    return 0;
+  }
+
+  // data byte
+  if (_sysex)
+  {
+    if (_length < MIDI_IN_BUFFER_SIZE - 1)
+    {
+      _buffer[_length++] = c;
+    }
+    else
+    {
+      _overflow = 1;
+    }
+    return 0;
+  }
+  if (_running == 0)
+  {
+    _strayBytes++;
+    return 0;
+  }
+  if (_length == 0)
+  {
+    // running status, put the status back in
+    _buffer[_length++] = _running;
+  }
+  _buffer[_length++] = c;
+  if (_length < _expected)
+  {
+    return 0;
+  }
+
+  _message = _buffer;
+  length = _length;
+  _length = 0;
+  if (_running >= 0xf0)
+  {
+    _running = 0;
+  }
+  return length;
+}
+
+const uint8_t *MidiIn::message()
+{
+  return _message;
+}
+
+uint16_t MidiIn::dropped()
+{
+  return _dropped;
+}
+
+uint16_t MidiIn::strayBytes()
+{
+  return _strayBytes;
+}
+
+void MidiIn::clearStatistics()
+{
+  _dropped = 0;
+  _strayBytes = 0;
+}
@@ -0,0 +1,73 @@
+/*
+  MidiIn Library - Declaration file
+
+  Splits the byte stream from a MIDI in port into whole messages, so they
+  can be passed on to another output without the bytes of two sources
+  getting mixed up in the middle of a message.
+
+  . Running status is followed: a message that came without its status
+    byte is handed out with the status put back in.
+  . A system exclusive message is collected up to the F7 that ends it and
+    handed out in one piece, F0 and F7 included.  One that does not fit
+    in the buffer, or is cut short by another status byte, is dropped.
+  . System common messages cancel running status, real time messages
+    (F8 - FF) are handed out on their own, wherever they come.
+  . Data bytes with no status to go with them are dropped.
+
+  This file is in the public domain.
+*/
+
+#ifndef MIDI_IN_H
+#define MIDI_IN_H
+
+#include <inttypes.h>
+
+// longest message kept, the system exclusive messages a synth takes for
+// its reset and effects settings are 11 bytes
+#ifndef MIDI_IN_BUFFER_SIZE
+#define MIDI_IN_BUFFER_SIZE 32
+#endif
+
+class MidiIn {
+
+public:
+
+  MidiIn();
+
+  // Takes the next byte received.
+  // Returns the length of the message it completes, 0 if none yet; the
+  // message stays in message() until the next call.
+  uint8_t parse(uint8_t c);
+  const uint8_t *message();
+
+  // Forget a message that was partly received and the running status.
+  void reset();
+
+  // Statistics.
+  // Messages dropped: system exclusive too long or cut short.
+  uint16_t dropped();
+  // Data bytes that did not belong to any message.
+  uint16_t strayBytes();
+  void clearStatistics();
+
+private:
+
+  uint8_t _buffer[MIDI_IN_BUFFER_SIZE];
+  uint8_t _realTime;
+  const uint8_t *_message;
+
+  // status of the message being received, 0 for none
+  uint8_t _running;
+  // bytes a message of that status has, status included
+  uint8_t _expected;
+  // bytes received so far, status included
+  uint8_t _length;
+  // inside a system exclusive message, and if it no longer fits
+  uint8_t _sysex;
+  uint8_t _overflow;
+
+  uint16_t _dropped;
+  uint16_t _strayBytes;
+};
+
+#endif // MIDI_IN_H
@@ -0,0 +1,157 @@
+/*  -------------------------------------------------------
+    TimerSerialTx.cpp
+    Buffered, interrupt driven serial transmit; see TimerSerialTx.h
+    -------------------------------------
+    This software is in the public domain.
+    ------------------------------------------------------- */
+
+#include "Arduino.h"
+#include "TimerSerialTx.h"
+#include <avr/interrupt.h>
+#if !defined(__AVR__)
+#include "HostSim.h"
+#endif
+
+// Keeps the compiler from moving memory accesses across it.
+#define TIMER_SERIAL_TX_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+// start bit low, 8 data bits, stop bit high
+#define TIMER_SERIAL_TX_FRAME_BITS 10
+#define TIMER_SERIAL_TX_STOP_BIT 0x200
+
+//
+// Statics
+//
+uint8_t TimerSerialTx::_buffer[TIMER_SERIAL_TX_BUFFER_SIZE];
+volatile uint8_t TimerSerialTx::_head = 0;
+volatile uint8_t TimerSerialTx::_tail = 0;
+volatile uint16_t TimerSerialTx::_frame = 0;
+volatile uint8_t TimerSerialTx::_bitsLeft = 0;
+#if defined(__AVR__)
+volatile uint8_t *TimerSerialTx::_transmitPortRegister;
+uint8_t TimerSerialTx::_transmitBitMask;
+#else
+uint8_t TimerSerialTx::_transmitPin;
+#endif
+
+//
+// Private methods
+//
+inline void TimerSerialTx::tx_pin_write(uint8_t pin_state)
+{
+#if defined(__AVR__)
+  if (pin_state == LOW)
+    *_transmitPortRegister &= ~_transmitBitMask;
+  else
+    *_transmitPortRegister |= _transmitBitMask;
+#else
+  hostSim().writePin(_transmitPin, pin_state);
+#endif
+}
+
+//
+// Interrupt handling
+//
+
+// One compare match per bit time.  Once the stop bit has had its full
+// time the next byte is started, or the interrupt turns itself off.
+inline void TimerSerialTx::handle_interrupt()
+{
+  if (_bitsLeft == 0)
+  {
+    uint8_t tail = _tail;
+    if (tail == _head)
+    {
+      TIMSK2 &= ~_BV(OCIE2A);
+      return;
+    }
+    _frame = ((uint16_t)_buffer[tail & INDEX_MASK] << 1) | TIMER_SERIAL_TX_STOP_BIT;
+    _tail = tail + 1;
+    _bitsLeft = TIMER_SERIAL_TX_FRAME_BITS;
+  }
+  tx_pin_write(_frame & 1);
+  _frame >>= 1;
+  _bitsLeft--;
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  TimerSerialTx::handle_interrupt();
+#if !defined(__AVR__)
+  // what the body of the handler takes on the AVR
+  hostSim().advance(30);
+#endif
+}
+
+//
+// Constructor
+//
+TimerSerialTx::TimerSerialTx()
+{
+}
+
+//
+// Public methods
+//
+void TimerSerialTx::begin(uint8_t txPin, long speed)
+{
+  // stop a transmission that may be running and drop what is left
+  TIMSK2 &= ~_BV(OCIE2A);
+  _head = 0;
+  _tail = 0;
+  _bitsLeft = 0;
+
+  digitalWrite(txPin, HIGH);
+  pinMode(txPin, OUTPUT);
+#if defined(__AVR__)
+  _transmitBitMask = digitalPinToBitMask(txPin);
+  _transmitPortRegister = portOutputRegister(digitalPinToPort(txPin));
+#else
+  _transmitPin = txPin;
+#endif
+
+  // CTC mode on OCR2A at clk/8
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS21);
+  OCR2A = F_CPU / 8 / speed - 1;
+}
+
+size_t TimerSerialTx::write(uint8_t b)
+{
+  uint8_t head = _head;
+
+  // wait for the interrupt to free a place, one every 10 bit times
+  while ((uint8_t)(head - _tail) >= TIMER_SERIAL_TX_BUFFER_SIZE)
+  {
+#if !defined(__AVR__)
+    hostSim().advance(4);
+#endif
+  }
+  _buffer[head & INDEX_MASK] = b;
+
+  // The byte has to be in place before the interrupt can see it.
+  TIMER_SERIAL_TX_BARRIER();
+  _head = head + 1;
+
+  // if the line is idle, start the bit clock; the start bit goes out at
+  // the first compare match
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!(TIMSK2 & _BV(OCIE2A)))
+  {
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+  }
+  SREG = oldSREG;
+  return 1;
+}
+
+uint8_t TimerSerialTx::pending()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t count = (uint8_t)(_head - _tail) + (_bitsLeft ? 1 : 0);
+  SREG = oldSREG;
+  return count;
+}
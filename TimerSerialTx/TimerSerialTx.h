@@ -0,0 +1,71 @@
+/*  -------------------------------------------------------
+    TimerSerialTx.h
+    Buffered, interrupt driven serial transmit on any pin, for sending MIDI
+    to the Fluxamasynth without holding up the rest of the sketch.
+    -------------------------------------
+    . The sketch declares one and hands it to the synth with
+      Fluxamasynth::transmitThrough(), which begins it.  It is a library
+      of its own so that only a sketch that includes this header has its
+      buffer and the Timer2 interrupt.
+    . write() puts the byte in a ring buffer and returns; it only waits
+      when the buffer is full.
+    . Timer2 runs in CTC mode with one compare match per bit time, and
+      the compare match interrupt shifts out one bit (8N1, LSB first) of
+      the byte at the head of the buffer.  The interrupt is only enabled
+      while there is something to send.
+    . Interrupts are never disabled for more than a few instructions, but
+      a bit edge is late by as long as other code keeps interrupts off:
+      long interrupt handlers in the sketch should sei() first.
+    . Timer2 is taken over, so tone() and PWM on pins 3 and 11 can not be
+      used alongside.  The baud rate has to be at least F_CPU / 2048
+      (7813 at 16 MHz); 31250 is a compare match every 512 cycles.
+    . Only one transmitter can be running; all instances share the buffer.
+    -------------------------------------
+    This software is in the public domain.
+    ------------------------------------------------------- */
+
+#ifndef TimerSerialTx_h
+#define TimerSerialTx_h
+
+#include <inttypes.h>
+#include "Fluxamasynth.h"
+
+// bytes waiting to be sent, a power of two no larger than 128
+#ifndef TIMER_SERIAL_TX_BUFFER_SIZE
+#define TIMER_SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+class TimerSerialTx : public FluxamasynthTransmitter
+{
+  private:
+    static const uint8_t INDEX_MASK = TIMER_SERIAL_TX_BUFFER_SIZE - 1;
+
+    static uint8_t _buffer[TIMER_SERIAL_TX_BUFFER_SIZE];
+    // free running counts of bytes written and taken by the interrupt
+    static volatile uint8_t _head;
+    static volatile uint8_t _tail;
+    // the rest of the frame being sent, next bit in bit 0
+    static volatile uint16_t _frame;
+    static volatile uint8_t _bitsLeft;
+#if defined(__AVR__)
+    static volatile uint8_t *_transmitPortRegister;
+    static uint8_t _transmitBitMask;
+#else
+    static uint8_t _transmitPin;
+#endif
+
+    static inline void tx_pin_write(uint8_t pin_state);
+
+  public:
+    TimerSerialTx();
+    virtual void begin(uint8_t txPin, long speed);
+    virtual size_t write(uint8_t byte);
+    using Print::write;
+    // bytes waiting in the buffer or partly shifted out
+    virtual uint8_t pending();
+
+    // public only for easy access by the interrupt handler
+    static inline void handle_interrupt();
+};
+
+#endif
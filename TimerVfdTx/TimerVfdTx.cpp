@@ -0,0 +1,241 @@
+/*  -------------------------------------------------------
+    TimerVfdTx.cpp
+    Buffered, interrupt driven clocked serial transmit for the HP VFD;
+    see TimerVfdTx.h
+    -------------------------------------
+    This software is in the public domain.
+    ------------------------------------------------------- */
+
+#include "Arduino.h"
+#include "TimerVfdTx.h"
+#include <avr/interrupt.h>
+#if !defined(__AVR__)
+#include "HostSim.h"
+#endif
+
+// Keeps the compiler from moving memory accesses across it.
+#define TIMER_VFD_TX_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+//
+// Statics
+//
+uint8_t TimerVfdTx::_buffer[TIMER_VFD_TX_BUFFER_SIZE];
+uint8_t TimerVfdTx::_executeTimes[TIMER_VFD_TX_BUFFER_SIZE];
+volatile uint8_t TimerVfdTx::_head = 0;
+volatile uint8_t TimerVfdTx::_tail = 0;
+volatile uint8_t TimerVfdTx::_byte = 0;
+volatile uint8_t TimerVfdTx::_mask = 0;
+volatile uint8_t TimerVfdTx::_clockLow = 0;
+volatile unsigned long TimerVfdTx::_lastSendTime = 0;
+volatile uint8_t TimerVfdTx::_executeTime = 0;
+volatile unsigned long TimerVfdTx::_readyTime = 0;
+#if defined(__AVR__)
+volatile uint8_t *TimerVfdTx::_clockPortRegister;
+uint8_t TimerVfdTx::_clockBitMask;
+volatile uint8_t *TimerVfdTx::_dataPortRegister;
+uint8_t TimerVfdTx::_dataBitMask;
+#else
+uint8_t TimerVfdTx::_clockPin;
+uint8_t TimerVfdTx::_dataPin;
+#endif
+
+//
+// Private methods
+//
+inline void TimerVfdTx::clock_write(uint8_t pin_state)
+{
+#if defined(__AVR__)
+  if (pin_state == LOW)
+    *_clockPortRegister &= ~_clockBitMask;
+  else
+    *_clockPortRegister |= _clockBitMask;
+#else
+  hostSim().writePin(_clockPin, pin_state);
+#endif
+}
+
+inline void TimerVfdTx::data_write(uint8_t pin_state)
+{
+#if defined(__AVR__)
+  if (pin_state == LOW)
+    *_dataPortRegister &= ~_dataBitMask;
+  else
+    *_dataPortRegister |= _dataBitMask;
+#else
+  hostSim().writePin(_dataPin, pin_state);
+#endif
+}
+
+//
+// Interrupt handling
+//
+
+// Two compare matches per bit, the clock low with the bit on the data
+// line, then high.  After the last rising edge the next byte is started
+// a clock phase later, or once the display is ready if it starts a
+// command, or the interrupt turns itself off.
+inline void TimerVfdTx::handle_interrupt()
+{
+  uint8_t now = TCNT0;
+  uint8_t next = OCR0B + HALF_CLOCK_TICKS;
+
+  // a late interrupt gets its whole phase from now
+  if ((int8_t)(next - now) < (int8_t)HALF_CLOCK_TICKS)
+  {
+    next = now + HALF_CLOCK_TICKS;
+  }
+
+  if (_clockLow)
+  {
+    // the display takes the bit on this edge
+    clock_write(HIGH);
+    _clockLow = 0;
+    _mask >>= 1;
+    if (_mask == 0)
+    {
+      _lastSendTime = micros();
+      _readyTime = _lastSendTime + _executeTime * 1000UL;
+    }
+  }
+  else
+  {
+    if (_mask == 0)
+    {
+      uint8_t tail = _tail;
+      if (tail == _head)
+      {
+        TIMSK0 &= ~_BV(OCIE0B);
+        return;
+      }
+      uint8_t executeTime = _executeTimes[tail & INDEX_MASK];
+      if (executeTime)
+      {
+        // still executing the last command, look again when it should
+        // be done, at most a millisecond on
+        long wait = _readyTime - micros();
+        if (wait > 0)
+        {
+          OCR0B = now + (wait < 960 ? (uint8_t)(wait / 4) + HALF_CLOCK_TICKS : 250);
+          return;
+        }
+        _executeTime = executeTime;
+      }
+      _byte = _buffer[tail & INDEX_MASK];
+      _tail = tail + 1;
+      _mask = 0x80;
+    }
+    clock_write(LOW);
+    data_write((_byte & _mask) ? HIGH : LOW);
+    _clockLow = 1;
+  }
+  OCR0B = next;
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+  TimerVfdTx::handle_interrupt();
+#if !defined(__AVR__)
+  // what the body of the handler takes on the AVR
+  hostSim().advance(30);
+#endif
+}
+
+//
+// Constructor
+//
+TimerVfdTx::TimerVfdTx()
+{
+}
+
+//
+// Public methods
+//
+void TimerVfdTx::begin(uint8_t clockPin, uint8_t dataPin)
+{
+  // stop a transmission that may be running and drop what is left
+  TIMSK0 &= ~_BV(OCIE0B);
+  _head = 0;
+  _tail = 0;
+  _mask = 0;
+  _clockLow = 0;
+  _readyTime = micros();
+
+#if defined(__AVR__)
+  _clockBitMask = digitalPinToBitMask(clockPin);
+  _clockPortRegister = portOutputRegister(digitalPinToPort(clockPin));
+  _dataBitMask = digitalPinToBitMask(dataPin);
+  _dataPortRegister = portOutputRegister(digitalPinToPort(dataPin));
+#else
+  _clockPin = clockPin;
+  _dataPin = dataPin;
+#endif
+
+  // normal mode, same clk/64 count and overflow as the core's fast PWM
+  TCCR0A &= ~(_BV(WGM01) | _BV(WGM00));
+}
+
+void TimerVfdTx::writeCommand(uint8_t command, uint8_t executeTime)
+{
+  // 0 would make it one of the bytes of the command before
+  queue(command, executeTime ? executeTime : 1);
+}
+
+size_t TimerVfdTx::write(uint8_t b)
+{
+  queue(b, 0);
+  return 1;
+}
+
+void TimerVfdTx::queue(uint8_t b, uint8_t executeTime)
+{
+  uint8_t head = _head;
+
+  // wait for the interrupt to free a place
+  while ((uint8_t)(head - _tail) >= TIMER_VFD_TX_BUFFER_SIZE)
+  {
+#if !defined(__AVR__)
+    hostSim().advance(4);
+#endif
+  }
+  _buffer[head & INDEX_MASK] = b;
+  _executeTimes[head & INDEX_MASK] = executeTime;
+
+  // The byte has to be in place before the interrupt can see it.
+  TIMER_VFD_TX_BARRIER();
+  _head = head + 1;
+
+  // if the line is idle, start the clock; it goes low at the first
+  // compare match
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!(TIMSK0 & _BV(OCIE0B)))
+  {
+    OCR0B = TCNT0 + HALF_CLOCK_TICKS;
+    TIFR0 = _BV(OCF0B);
+    TIMSK0 |= _BV(OCIE0B);
+  }
+  SREG = oldSREG;
+}
+
+uint8_t TimerVfdTx::pending()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t count = (uint8_t)(_head - _tail) + (_mask ? 1 : 0);
+  SREG = oldSREG;
+  return count;
+}
+
+uint8_t TimerVfdTx::room()
+{
+  return TIMER_VFD_TX_BUFFER_SIZE - (uint8_t)(_head - _tail);
+}
+
+unsigned long TimerVfdTx::lastSendTime()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long time = _lastSendTime;
+  SREG = oldSREG;
+  return time;
+}
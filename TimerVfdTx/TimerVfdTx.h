@@ -0,0 +1,111 @@
+/*  -------------------------------------------------------
+    TimerVfdTx.h
+    Buffered, interrupt driven clocked serial transmit for the HP VFD's
+    serial input, so HpDecVfd does not hold up the sketch for the 450 us
+    each byte takes to clock out.
+    -------------------------------------
+    . The sketch declares one and hands it to the display with
+      HpDecVfd::transmitThrough(), and begin() begins it.  It is a
+      library of its own so that only a sketch that includes this header
+      has its queue and the Timer0 compare match B interrupt.
+    . writeCommand() queues the first byte of a display command with the
+      time the display takes to execute it, write() the bytes that go
+      with it, characters of a text command included.  Both put the byte
+      in a ring buffer and return; they only wait when it is full.
+    . The display can not take a command while it is executing the one
+      before, which it does once the last byte of that one is in.  The
+      interrupt holds the first byte of the next command back until
+      then, looking again every millisecond or sooner, so the caller
+      never waits on the display: a reset and the screen after it can
+      be queued together.
+    . Timer0's compare match B interrupt clocks the bits out, MSB first:
+      one match takes the clock low and sets the data bit, the next takes
+      the clock high, where the display samples it.  The matches are
+      HALF_CLOCK_TICKS apart, 28 us, for the same 56 us clock period the
+      bit banged clock has; but never closer than that to the count the
+      interrupt finds when it comes in, so one that is late only makes
+      its phase longer and the next is not cut short.  The data is set
+      up for the whole low phase.
+      The interrupt is only enabled while there is something to send.
+    . Timer0 is the one millis() and micros() run on; begin() puts it
+      from fast PWM into normal mode, where OCR0B takes effect at once.
+      The count and its overflow are the same in both modes, so time
+      keeping is not touched, but analogWrite() on pins 5 and 6 can not
+      be used alongside.  HpDecVfd::begin() begins it, so call that from
+      setup(): the core's init() sets fast PWM again before that.
+    . lastSendTime() is the micros() at which the last byte was complete,
+      for the display's text chaining time.
+    . Only one transmitter can be running; all instances share the buffer.
+    -------------------------------------
+    This software is in the public domain.
+    ------------------------------------------------------- */
+
+#ifndef TimerVfdTx_h
+#define TimerVfdTx_h
+
+#include <inttypes.h>
+#include "HpDecVfd.h"
+
+// bytes waiting to be sent, a power of two no larger than 128, two
+// bytes of RAM each; HpDecVfd::begin() and a two line start up screen
+// are 36
+#ifndef TIMER_VFD_TX_BUFFER_SIZE
+#define TIMER_VFD_TX_BUFFER_SIZE 64
+#endif
+
+class TimerVfdTx : public HpDecVfdTransmitter
+{
+  private:
+    static const uint8_t INDEX_MASK = TIMER_VFD_TX_BUFFER_SIZE - 1;
+    // 7 Timer0 ticks of 4 us at 16 MHz, 28 us
+    static const uint8_t HALF_CLOCK_TICKS = (28 * (F_CPU / 1000000L) + 63) / 64;
+
+    static uint8_t _buffer[TIMER_VFD_TX_BUFFER_SIZE];
+    // for the first byte of a command the milliseconds the display takes
+    // to execute it, 0 for the bytes that go with it
+    static uint8_t _executeTimes[TIMER_VFD_TX_BUFFER_SIZE];
+    // free running counts of bytes written and taken by the interrupt
+    static volatile uint8_t _head;
+    static volatile uint8_t _tail;
+    // the byte being sent and its next bit, 0 between bytes, and whether
+    // the clock is low with that bit on the data line
+    static volatile uint8_t _byte;
+    static volatile uint8_t _mask;
+    static volatile uint8_t _clockLow;
+    static volatile unsigned long _lastSendTime;
+    // the command being sent, and the micros() the display is done with it
+    static volatile uint8_t _executeTime;
+    static volatile unsigned long _readyTime;
+#if defined(__AVR__)
+    static volatile uint8_t *_clockPortRegister;
+    static uint8_t _clockBitMask;
+    static volatile uint8_t *_dataPortRegister;
+    static uint8_t _dataBitMask;
+#else
+    static uint8_t _clockPin;
+    static uint8_t _dataPin;
+#endif
+
+    static inline void clock_write(uint8_t pin_state);
+    static inline void data_write(uint8_t pin_state);
+    static void queue(uint8_t byte, uint8_t executeTime);
+
+  public:
+    TimerVfdTx();
+    // the pins are set up as outputs, clock high, by the caller
+    virtual void begin(uint8_t clockPin, uint8_t dataPin);
+    // the first byte of a command the display takes executeTime ms over
+    virtual void writeCommand(uint8_t command, uint8_t executeTime);
+    // a byte of the command last written
+    virtual size_t write(uint8_t byte);
+    // bytes waiting in the buffer or partly clocked out
+    virtual uint8_t pending();
+    // places free in the buffer
+    uint8_t room();
+    virtual unsigned long lastSendTime();
+
+    // public only for easy access by the interrupt handler
+    static inline void handle_interrupt();
+};
+
+#endif
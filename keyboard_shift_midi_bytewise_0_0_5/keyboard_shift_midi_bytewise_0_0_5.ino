@@ -0,0 +1,1205 @@
+/* vintage organ keyboard to midi converter
+ Author: Alexander Davis
+ Date: 5/10/2012
+ Purpose: Scans a bussbar-type organ keyboard via chained shift registers and outputs MIDI note commands.
+ Also sends the MIDI commands to a Fluxamasynth single-chip MIDI synth for audio output.
+ 
+ Built for the 2012 Raleigh, NC Maker Faire
+ 
+ Hardware: ATMEGA328p @ 16 mHz on Modern Device RBBB
+ Modern Device Fluxamasynth board
+ Wicked Device RBBB shield board (Vcc to Vin pin connected)
+ 5v 1A regulated switchmode power supply
+ 8x 74ls165 shift registers
+ HP Entertainment Center VFD display
+ and old bussbar-type organ keyboard
+ 
+ Git repository: https://github.com/quarterturn/organ-midi-project
+ */
+
+// external libraries
+// button debouncing
+#include <Bounce.h>
+// fluxamasynth
+#include "Fluxamasynth.h"
+#include "TimerSerialTx.h"
+// hp media center vfd
+#include <HpDecVfd.h>
+#include <TimerVfdTx.h>
+// for using atmega eeprom
+#include <EEPROM.h>
+// key changes from the scan to the MIDI sends
+#include <KeyEventQueue.h>
+// the unrolled shift register scan
+#include <KeyboardScanner.h>
+// couplers between the divisions
+#include <CouplerEngine.h>
+// note-on velocity from two contacts per key
+#include <KeyVelocity.h>
+// whole messages out of the MIDI in stream
+#include <MidiIn.h>
+
+// constants
+// 8 bits all '1'
+#define BITS_8_ON 0xFF
+
+// version
+#define VERSION "0.0.5"
+
+// button debounce interval - 10 ms
+#define DEBOUNCE 10
+// debounce/jitter interval for pots
+#define POT_DEBOUNCE 100
+// how long the start up screen stays up, from power up
+#define SPLASH_MS 5000
+// the display is drawn at most this often, 5 frames a second
+// a pot turned faster only shows the value it has when the frame is drawn
+#define DISPLAY_FRAME_MS 200
+
+// the fields of the status display, a bit each in displayDirty
+#define FIELD_BANK 0x01
+#define FIELD_VOICE 0x02
+#define FIELD_VELOCITY 0x04
+#define FIELD_RANK 0x08
+#define FIELD_CUTOFF 0x10
+#define FIELD_RESONANCE 0x20
+#define FIELDS_ALL 0x3f
+
+/* NOTE
+   SoftwareSerial uses pin 4
+   so don't go using it for anything else, ok?
+*/
+
+// buttons
+#define BUTTON_BANK 2
+#define BUTTON_RANK 3
+
+// analog inputs
+#define I_POT_VOICE A0
+#define I_POT_VELOCITY A1
+#define I_POT_CUTOFF A2
+#define I_POT_RESONANCE A3
+
+// keyboard busses
+#define BUS_LOWER 9
+#define BUS_UPPER 10
+// the busses of the second contacts, with VELOCITY_SENSING on
+#define BUS_LOWER_SECOND 8
+#define BUS_UPPER_SECOND 5
+
+// shift register pins
+#define SHIFT_LOAD 13
+#define SHIFT_DATA 11
+#define SHIFT_CLOCK 12
+
+// the same pins as port bits, the scan goes through the port registers
+// digital pins 8 - 13 are PB0 - PB5 on the ATMEGA328p
+// hardware SPI would need the clock on 13 and data on 12, and pin 10 (SS)
+// is the upper bus, so the chain is clocked by hand
+#define SHIFT_PORT PORTB
+#define SHIFT_PIN PINB
+#define SHIFT_LOAD_BIT _BV(PB5)
+#define SHIFT_DATA_BIT _BV(PB3)
+#define SHIFT_CLOCK_BIT _BV(PB4)
+#define BUS_DDR DDRB
+#define BUS_PORT PORTB
+#define BUS_LOWER_BIT _BV(PB1)
+#define BUS_UPPER_BIT _BV(PB2)
+#define BUS_LOWER_SECOND_BIT _BV(PB0)
+// port B has no pin left, the upper second contact bus is on port D
+#define BUS_SECOND_DDR DDRD
+#define BUS_UPPER_SECOND_BIT _BV(PD5)
+
+// shift register setup
+#define NUMBER_OF_SHIFT_CHIPS 8
+#define DATA_WIDTH 8
+#define PULSE_WIDTH_USEC 5
+#define POLL_DELAY_MSEC 1
+
+// 1 for keyboards with a second contact under each key, on a bus bar of
+// its own: the time from the first contact to the second gives the
+// note-on velocity, and a key sounds once it reaches the second
+// the second contacts are scanned as busses after the divisions', and
+// the scan runs at 2 kHz to time a key stroke to within 0.5 ms
+#ifndef VELOCITY_SENSING
+#define VELOCITY_SENSING 0
+#endif
+
+// key scan rate, every bus is read on every scan
+// a release has to be seen on 3 scans in a row, so 3 ms at 1 kHz
+#if VELOCITY_SENSING
+#define SCAN_INTERVAL_USEC 500
+#else
+#define SCAN_INTERVAL_USEC 1000
+#endif
+// the scan runs from the Timer1 compare match interrupt
+// CTC mode with a prescaler of 64, 4 us a count
+#define SCAN_TIMER_PRESCALER 64
+#define SCAN_TIMER_TOP ((F_CPU / 1000000L) * SCAN_INTERVAL_USEC / SCAN_TIMER_PRESCALER - 1)
+
+// keyboard divisions, one per bus, index into the division table and the
+// debounce state
+#define MANUAL_LOWER 0
+#define MANUAL_UPPER 1
+#define NUM_DIVISIONS 2
+
+// the busses scanned, one per division, and with velocity sensing the
+// divisions' second contacts after them, in the same order
+#if VELOCITY_SENSING
+#define NUM_BUSES (2 * NUM_DIVISIONS)
+#else
+#define NUM_BUSES NUM_DIVISIONS
+#endif
+
+// MIDI channels of the manuals
+#define UPPER_CHANNEL 0
+#define LOWER_CHANNEL 1
+
+// this decides what note the leftmost key of a manual will sound
+#define LOWEST_NOTE 36
+
+// how many keys
+#define NUM_KEYS 64
+
+// default velocity
+#define DEFAULT_VELOCITY 100
+
+// the couplers drawn at power up, bit n for row n of the coupler table
+// 0 plays every division on its own
+#define COUPLERS_DRAWN 0
+
+// notes the synth is asked to sound at once, counting MIDI in
+// past this the oldest one is ended with a note-off first, so the synth
+// never steals a voice on its own; both manuals full with couplers drawn
+// ask for far more than the chip has
+#define SYNTH_POLYPHONY 32
+
+// stuck note guard: every GUARD_INTERVAL_MS the notes of one division
+// are checked against the keys the scan reads down, and a note no key
+// holds any more gets its note-off
+// with 2 divisions a lost note-off hangs for 200 ms at most
+#define GUARD_INTERVAL_MS 100
+
+// turn on debugging output via Serial
+// Serial runs at MIDI speed for the MIDI in and out ports, so the prints
+// are only readable on a terminal set to that speed, and get mixed into
+// MIDI out
+#define DEBUG 0
+
+// the USART: MIDI in on the RX pin (digital 0), through the usual
+// optocoupler, and MIDI out on the TX pin (digital 1)
+// 31250 for MIDI jacks, 115200 for a serial-MIDI bridge program on a
+// computer at the other end of the USB serial port
+#define MIDI_USART_BAUD 31250
+// 1 to send everything the synth gets out of the USART too, for recording
+// the organ on a computer, 0 to leave the TX pin alone
+// what comes in on MIDI in goes back out with it, so a computer on both
+// ends should not echo its input
+#define MIDI_USART_OUT 1
+
+// eeprom memory locations
+#define EE_U_VOICE 0
+#define EE_L_VOICE 1
+#define EE_U_VELOCITY 2
+#define EE_L_VELOCITY 3
+#define EE_U_CUTOFF 4
+#define EE_L_CUTOFF 5
+#define EE_U_RESONANCE 6
+#define EE_L_RESONANCE 7
+#define EE_U_BANK 8
+#define EE_L_BANK 9
+#define EE_NEWCHIP1 127
+#define EE_NEWCHIP2 128
+
+// values to test if chip has been programmed
+#define NEWCHIP1_VAL 0xaa
+#define NEWCHIP2_VAL 0x55
+
+// bounce objects
+Bounce buttonMode = Bounce(BUTTON_BANK, DEBOUNCE);
+Bounce buttonRank = Bounce(BUTTON_RANK, DEBOUNCE);
+
+// create a vfd object based on HpDecVfd class
+// pass the pins to use to the constructor
+HpDecVfd vfd(6, 7);
+// the display bytes are queued and clocked out from the Timer0 compare B
+// interrupt, so drawing does not hold up loop() for 450 us a byte;
+// Timer0 keeps millis() going but pins 5 and 6 have no analogWrite()
+TimerVfdTx vfdTx;
+
+// create a synth object
+Fluxamasynth synth;
+// the MIDI bytes are buffered and sent bit by bit from the Timer2 interrupt,
+// so sending a chord does not hold up loop() or the key scan
+TimerSerialTx synthTx;
+// the notes it has sounding, for the polyphony budget and the stuck note
+// guard, 355 bytes
+FluxamasynthVoices synthVoices;
+
+// global variables
+
+// key presses and releases, queued by the scan and sent by loop()
+// 32 events of 4 bytes
+KeyEventQueue keyEvents;
+
+// messages from an external controller on MIDI in, passed on to the synth
+MidiIn midiIn;
+
+// the pins of the shift register chain and the buses, for the scanner
+// every function is a single port instruction, or two for the clock pulse
+// a 74LS165 clock pulse only has to be 25 ns wide, sbi/cbi give 125 ns
+struct OrganPins
+{
+  static const uint8_t LOAD_PULSE_USEC = PULSE_WIDTH_USEC;
+  
+  // both bus bits stay low in the port register, so a bus is either
+  // high-z (input) or low (output)
+  // one write so only one bus is ever driven
+  // a division added to the table needs its bus bit here too
+  static void selectBus(uint8_t bus)
+  {
+#if VELOCITY_SENSING
+    // the bus on the other port is let go before the next one is driven
+    // nothing but the scan changes DDRD once setup() is done
+    if (bus == NUM_DIVISIONS + MANUAL_UPPER)
+    {
+      BUS_DDR &= ~(BUS_LOWER_BIT | BUS_UPPER_BIT | BUS_LOWER_SECOND_BIT);
+      BUS_SECOND_DDR |= BUS_UPPER_SECOND_BIT;
+      return;
+    }
+    BUS_SECOND_DDR &= ~BUS_UPPER_SECOND_BIT;
+    BUS_DDR = (BUS_DDR & ~(BUS_LOWER_BIT | BUS_UPPER_BIT | BUS_LOWER_SECOND_BIT))
+      | (bus == MANUAL_LOWER ? BUS_LOWER_BIT : bus == MANUAL_UPPER ? BUS_UPPER_BIT : BUS_LOWER_SECOND_BIT);
+#else
+    BUS_DDR = (BUS_DDR & ~(BUS_LOWER_BIT | BUS_UPPER_BIT)) | (bus == MANUAL_LOWER ? BUS_LOWER_BIT : BUS_UPPER_BIT);
+#endif
+  }
+  static void loadLow() { SHIFT_PORT &= ~SHIFT_LOAD_BIT; }
+  static void loadHigh() { SHIFT_PORT |= SHIFT_LOAD_BIT; }
+  static uint8_t data() { return SHIFT_PIN & SHIFT_DATA_BIT; }
+  static void clock()
+  {
+    SHIFT_PORT |= SHIFT_CLOCK_BIT;
+    SHIFT_PORT &= ~SHIFT_CLOCK_BIT;
+  }
+};
+
+// the scan of both manuals and the debounced key state
+// 3 bytes per chip and manual: the keys down, and two 2 bit vertical
+// counters, one bit of each key's counter per byte
+KeyboardScanner<NUMBER_OF_SHIFT_CHIPS, NUM_BUSES, OrganPins> scanner;
+
+// what the keys of one division (a manual or the pedalboard) play
+struct Division
+{
+  // MIDI channel
+  byte channel;
+  // note of the leftmost key
+  byte baseNote;
+  // semitones up or down from there
+  int8_t transpose;
+  // note-on velocity, without velocity sensing
+  byte velocity;
+};
+
+// the division table, one row per bus in the order they are scanned, in flash
+// adding a division is a row here, one more in NUM_DIVISIONS and its bus
+// pin in OrganPins; a 32 note pedalboard only uses the first four chips of
+// its bus, and would be a row like
+//   { 2, 24, 0, DEFAULT_VELOCITY },
+const Division divisions[NUM_DIVISIONS] PROGMEM =
+{
+  // lower manual
+  { LOWER_CHANNEL, LOWEST_NOTE, 0, DEFAULT_VELOCITY },
+  // upper manual
+  { UPPER_CHANNEL, LOWEST_NOTE, 0, DEFAULT_VELOCITY },
+};
+
+// the coupler table, in flash: the division whose keys are taken, the one
+// they sound on, and the shift in keys, the interval plus the difference
+// of the two divisions' base notes
+const Coupler couplers[] PROGMEM =
+{
+  // upper to lower, the lower manual's keys play the upper's voice too
+  { MANUAL_LOWER, MANUAL_UPPER, 0 },
+  // lower super octave
+  { MANUAL_LOWER, MANUAL_LOWER, 12 },
+  // upper sub octave
+  { MANUAL_UPPER, MANUAL_UPPER, -12 },
+};
+
+// the keys held on each division and the notes sounding, couplers and all
+// 24 bytes per division
+CouplerEngine<NUM_DIVISIONS> coupling(couplers, sizeof(couplers) / sizeof(couplers[0]));
+
+#if VELOCITY_SENSING
+// the velocity curve, in flash: entry n for a key that took n half
+// milliseconds from its first contact to its second
+// 2 ms or less is full velocity, then the same step down for every
+// doubling of the time, to 17 at 32 ms and slower
+#define VELOCITY_STEP_USEC 500
+const byte velocityCurve[] PROGMEM =
+{
+  127, 127, 127, 127, 127, 118, 111, 105, 99, 95, 90, 87, 83, 80, 77, 74,
+  72, 69, 67, 65, 63, 61, 59, 57, 55, 54, 52, 51, 49, 48, 46, 45,
+  44, 43, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30, 29, 28,
+  28, 27, 26, 25, 24, 24, 23, 22, 21, 21, 20, 19, 19, 18, 17, 17,
+};
+
+// the keys on their way down, between the two contacts, 16 at a time
+// 64 bytes; the event times are in 4 us steps
+KeyVelocity<16> keyVelocity(velocityCurve, sizeof(velocityCurve), VELOCITY_STEP_USEC / 4);
+
+// the velocity of the key struck last, the notes it starts are sent at once
+byte strikeVelocity = DEFAULT_VELOCITY;
+#endif
+
+// the division the stuck note guard checks next
+byte guardDivision = 0;
+
+// 8-bit unsigned int to hold the note select mask
+// initialize with a 1 in the LSB; this represents key 1 the leftmost key
+uint8_t noteSel = 1;
+
+// channel for upper manual
+byte upperChannel = UPPER_CHANNEL;
+// channel for lower manual
+byte lowerChannel = LOWER_CHANNEL;
+// master volume
+byte masterVolume = 110;
+
+// analog input values
+// we store previous and current
+byte potVoicePrevious = 0;
+byte potVoiceCurrent = 0;
+byte potVelocityPrevious = 0;
+byte potVelocityCurrent = 0;
+byte potCutoffPrevious = 0;
+byte potCutoffCurrent = 0;
+byte potResonancePrevious = 0;
+byte potResonanceCurrent = 0;
+
+// voice parameters
+// bank for upper manual
+byte upperBank = 0;
+// bank for lower manual
+byte lowerBank = 0;
+// voice for upper manual
+// default is piano
+byte upperVoice = 0;
+// voice for lower manual
+// default is string ensemble
+byte lowerVoice = 49;
+// master volume
+// velocity
+byte upperVelocity = 110;
+byte lowerVelocity = 110;
+// resonance
+byte upperResonance = 0;
+byte lowerResonance = 0;
+// cutoff
+byte upperCutoff = 127;
+byte lowerCutoff = 127;
+
+
+// note value
+byte theNote;
+
+// for tracking time in delay loops
+unsigned long previousMillis;
+
+// track which keyboard we are setting values on
+byte setUpper = 1;
+
+// the fields of the display whose values changed since it was drawn
+byte displayDirty = FIELDS_ALL;
+
+// the numbers 0 to 127 as the status screen shows them, three characters
+// right-aligned, worked out by the compiler and kept in flash, 384 bytes
+#define PADDED(n) { (n) >= 100 ? '0' + (n) / 100 : ' ', (n) >= 10 ? '0' + (n) / 10 % 10 : ' ', '0' + (n) % 10 }
+#define PADDED_8(n) PADDED(n), PADDED(n + 1), PADDED(n + 2), PADDED(n + 3), \
+  PADDED(n + 4), PADDED(n + 5), PADDED(n + 6), PADDED(n + 7)
+const char paddedNumbers[128][3] PROGMEM =
+{
+  PADDED_8(0), PADDED_8(8), PADDED_8(16), PADDED_8(24),
+  PADDED_8(32), PADDED_8(40), PADDED_8(48), PADDED_8(56),
+  PADDED_8(64), PADDED_8(72), PADDED_8(80), PADDED_8(88),
+  PADDED_8(96), PADDED_8(104), PADDED_8(112), PADDED_8(120),
+};
+
+// older avr-libc has no pgm_read_ptr, the AVR's pointers are a word
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(address) ((void *)pgm_read_word(address))
+#endif
+
+// one field of the status screen
+struct StatusField
+{
+  // its bit in displayDirty
+  byte field;
+  // where it starts
+  byte column;
+  byte row;
+  // the text in front of the value
+  char label[4];
+  // the setting it shows for the lower and for the upper manual, indexed
+  // by setUpper; none for the upper/lower field, which shows U or L
+  byte *settings[2];
+  // characters of the value, the last ones of its padded number
+  byte width;
+};
+
+// the status screen, in flash
+//   B1 P 65 V 65     bank, program, velocity (channel volume)
+//   U  F 65 Q 65     upper/lower, cutoff, resonance
+const StatusField statusFields[] PROGMEM =
+{
+  { FIELD_BANK, 0, 0, "B", { &lowerBank, &upperBank }, 1 },
+  { FIELD_VOICE, 2, 0, " P", { &lowerVoice, &upperVoice }, 3 },
+  { FIELD_VELOCITY, 7, 0, " V", { &lowerVelocity, &upperVelocity }, 3 },
+  { FIELD_RANK, 0, 1, "", { NULL, NULL }, 0 },
+  { FIELD_CUTOFF, 1, 1, "  F", { &lowerCutoff, &upperCutoff }, 3 },
+  { FIELD_RESONANCE, 7, 1, " Q", { &lowerResonance, &upperResonance }, 3 },
+};
+
+void setup()
+{
+
+  // button setup
+  // buttons are active low
+  // pull-ups enabled
+  pinMode(BUTTON_BANK, INPUT);
+  digitalWrite(BUTTON_BANK, HIGH);
+  pinMode(BUTTON_RANK, INPUT);
+  digitalWrite(BUTTON_RANK, HIGH);
+  
+  // analog inputs configured by default
+
+  // bus setup
+  // start off with both busses inactive
+  // a bus is active if it is an output and low
+  pinMode(BUS_LOWER, INPUT);
+  //digitalWrite(BUS_LOWER, LOW);
+  // a bus is inactive if it is an input
+  pinMode(BUS_UPPER, INPUT);
+#if VELOCITY_SENSING
+  pinMode(BUS_LOWER_SECOND, INPUT);
+  pinMode(BUS_UPPER_SECOND, INPUT);
+#endif
+  
+  // shift register pin setup
+  pinMode(SHIFT_LOAD, OUTPUT);
+  digitalWrite(SHIFT_LOAD, HIGH);
+  pinMode(SHIFT_CLOCK, OUTPUT);
+  digitalWrite(SHIFT_CLOCK, LOW);
+  pinMode(SHIFT_DATA, INPUT);
+
+  // initialize and clear the display
+  // the commands are queued and go out as the display is ready for them,
+  // the reset's 100 ms included, so none of this waits
+  vfd.transmitThrough(vfdTx);
+  vfd.begin(1);
+  vfd.setCursor(0, 0);
+  vfd.print("SHIFT-IN DEMO");
+  vfd.setCursor(0, 1);
+  vfd.print("V. 0.0.5");
+  // the start up screen stays up for SPLASH_MS while the keys already
+  // play, then updateDisplay() puts the status screen up
+
+  // uart serial setup
+  // MIDI in, the messages received are merged into what goes to the synth
+  Serial.begin(MIDI_USART_BAUD);
+  // MIDI out, the same bytes as the synth gets, written to the USART's
+  // buffer as they are sent; only compiled in when turned on
+#if MIDI_USART_OUT
+  synth.mirrorTo(Serial);
+#endif
+  synth.transmitThrough(synthTx);
+  synth.midiReset();
+  // leave out repeated status bytes, note-offs go as note-on velocity 0
+  synth.setRunningStatus(1);
+  // notes go out ahead of the controller messages the pots send, which
+  // loop() lets out one at a time when the MIDI line is idle
+  synth.setPriorityScheduling(1);
+  // a cutoff or resonance pot step only sends the new value, not the NRPN number
+  synth.setNrpnCaching(1);
+  // count the notes sounding, before the first one
+  synth.trackVoices(synthVoices);
+  synth.setPolyphony(SYNTH_POLYPHONY);
+  
+  // draw the couplers
+  coupling.setStops(COUPLERS_DRAWN);
+  
+  // check the eeprom to see if it has been programmed
+  if ((EEPROM.read(EE_NEWCHIP1) + EEPROM.read(EE_NEWCHIP2)) == 0xff)
+  {
+    // the eeprom has been programmed so read in the values
+    upperVoice = EEPROM.read(EE_U_VOICE);
+    lowerVoice = EEPROM.read(EE_L_VOICE);
+    upperVelocity = EEPROM.read(EE_U_VELOCITY);
+    lowerVelocity = EEPROM.read(EE_L_VELOCITY);
+    upperCutoff = EEPROM.read(EE_U_CUTOFF);
+    lowerCutoff = EEPROM.read(EE_L_CUTOFF);
+    upperResonance = EEPROM.read(EE_U_RESONANCE);
+    lowerResonance = EEPROM.read(EE_L_RESONANCE);
+    upperBank = EEPROM.read(EE_U_BANK);
+    lowerBank = EEPROM.read(EE_L_BANK);
+  }
+  else
+  {
+    // write the defaults to the eeprom
+    EEPROM.write(EE_U_VOICE, upperVoice);
+    EEPROM.write(EE_L_VOICE, lowerVoice);
+    EEPROM.write(EE_U_VELOCITY, upperVelocity);
+    EEPROM.write(EE_L_VELOCITY, lowerVelocity);
+    EEPROM.write(EE_U_CUTOFF, upperCutoff);
+    EEPROM.write(EE_L_CUTOFF, lowerCutoff);
+    EEPROM.write(EE_U_RESONANCE, upperResonance);
+    EEPROM.write(EE_L_RESONANCE, lowerResonance);
+    EEPROM.write(EE_U_BANK, upperBank);
+    EEPROM.write(EE_L_BANK, lowerBank);
+    EEPROM.write(EE_NEWCHIP1, NEWCHIP1_VAL);
+    EEPROM.write(EE_NEWCHIP2, NEWCHIP2_VAL);
+  }
+  
+  // enable chorus
+  synth.setChorus(0, 1, 30, 30, 10);
+
+  synth.setMasterVolume(100);	// max. master volume
+//  synth.setChannelVolume(channel, 60);
+//  synth.setMasterPan(pan1, pan2);
+
+
+  // configure the voices
+  synth.programChange(upperBank * 127, upperChannel, upperVoice);
+  synth.programChange(lowerBank * 127, lowerChannel, lowerVoice);
+  synth.setChannelVolume(upperChannel, upperVelocity);
+  synth.setChannelVolume(lowerChannel, lowerVelocity);
+  synth.setTVFCutoff(upperChannel, upperCutoff);
+  synth.setTVFCutoff(lowerChannel, lowerCutoff);
+  synth.setTVFResonance(upperChannel, upperResonance);
+  synth.setTVFResonance(lowerChannel, lowerResonance);
+ 
+  // display the initial values
+  updateDisplay();
+  
+  // start scanning the keys
+  // Timer1 in CTC mode, clk/64, interrupt on compare match A
+  cli();
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+  OCR1A = SCAN_TIMER_TOP;
+  TIMSK1 = _BV(OCIE1A);
+  sei();
+  
+}
+
+//---------------------------------------------------------------------------------------------//
+// Timer1 compare match
+// scans the keys every SCAN_INTERVAL_USEC, whatever loop() is busy with
+// the scan only touches port B (and DDRD for a second contact bus), which
+// loop() leaves alone, and hands its
+// events to loop() through the keyEvents queue
+// interrupts go back on right away: the MIDI bit interrupt has to come
+// every 32 us and the scan takes longer than that
+//---------------------------------------------------------------------------------------------//
+ISR(TIMER1_COMPA_vect)
+{
+  sei();
+  getKeystate();
+}
+
+//---------------------------------------------------------------------------------------------//
+// main loop
+//---------------------------------------------------------------------------------------------//
+void loop()
+{
+  // do something if a key was pressed or released
+  sendKeyEvents();
+  
+  // end notes whose note-off got lost
+  guardNotes();
+  
+  // pass on what came in on MIDI in
+  mergeMidiIn();
+  
+  // check the buttons, upper/lower changes every field
+  if (checkButtons() > 0)
+  {
+    displayDirty = FIELDS_ALL;
+  }
+  
+  // check the pots, which mark the fields they change
+  getPots();
+  
+  // draw the fields that changed, at most every DISPLAY_FRAME_MS
+  updateDisplay();
+  
+  // send a held back controller message if the MIDI line is free
+  synth.update();
+  
+  // send the next characters of the display that changed, if it is ready
+  vfd.update();
+  
+  // delay for testing
+  if (DEBUG == 1)
+  {
+    delay(1000);
+  }
+}
+
+//---------------------------------------------------------------------------------------------//
+// function getkeystate()
+// gets the state of the keys, pressed or released
+// both manuals are scanned, called from the timer interrupt
+// a press is reported on the first scan that sees the contact close, a
+// release only once the contact has read open on 3 scans in a row, so
+// chatter while a key goes down or comes up never sends a second note
+// a key change the event queue has no room for is left for the next scan
+//---------------------------------------------------------------------------------------------//
+void getKeystate()
+{
+  unsigned long now = micros();
+  
+  // the events carry the scan time in 4 us steps, the resolution of micros()
+  scanner.scan(keyEvents, now >> 2);
+  
+  return;
+}
+  
+//---------------------------------------------------------------------------------------------//
+// function sendKeyEvents()
+// takes the key changes the scan queued and sends the notes they start
+// and stop, couplers included
+// all the queued changes go in before anything is sent, so a chord that
+// came in one scan is worked out in one coupler update
+//---------------------------------------------------------------------------------------------//
+void sendKeyEvents()
+{
+  KeyEvent event;
+  byte keysChanged = 0;
+  
+  while (keyEvents.pop(event))
+  {
+#if VELOCITY_SENSING
+    // a second contact closing: the key reached the bottom and sounds at
+    // the velocity of its stroke; the notes it starts go out right away,
+    // so the next strike can not change their velocity
+    if (event.manual() >= NUM_DIVISIONS)
+    {
+      if (event.on())
+      {
+        strikeVelocity = keyVelocity.strike(event.manual() - NUM_DIVISIONS, event.key(), event.time);
+        coupling.setKey(event.manual() - NUM_DIVISIONS, event.key(), 1);
+        sendChanges();
+        keysChanged = 0;
+      }
+      continue;
+    }
+    // the first contact closing only starts the clock
+    if (event.on())
+    {
+      keyVelocity.start(event.manual(), event.key(), event.time);
+      continue;
+    }
+    // a key let up before it reached the bottom never sounded
+    keyVelocity.cancel(event.manual(), event.key());
+#endif
+    coupling.setKey(event.manual(), event.key(), event.on());
+    keysChanged = 1;
+  }
+  
+  // nothing came in, nothing can have changed
+  if (keysChanged == 0)
+  {
+    return;
+  }
+  
+  sendChanges();
+  
+  return;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function sendChanges()
+// works out what the keys held now sound on every division, couplers
+// included, and sends the notes that started or stopped
+//---------------------------------------------------------------------------------------------//
+void sendChanges()
+{
+  coupling.update();
+  for (byte i = 0; i < NUM_DIVISIONS; i++)
+  {
+    sendDivision(i);
+  }
+  
+  return;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function sendDivision()
+// sends a note-on or note-off for each note of a division that started or
+// stopped sounding at the last coupler update
+// a note two keys ask for (a key and the key coupled to it) was already
+// sounding, so it gets no second note-on
+// the channel, note and velocity come from the division table row of the
+// division, the same few flash reads however many divisions there are
+//---------------------------------------------------------------------------------------------//
+void sendDivision(byte number)
+{
+  const Division *division = &divisions[number];
+  uint64_t changed = coupling.changed(number);
+  uint64_t sounding = coupling.sounding(number);
+  byte channel;
+  int base;
+  int note;
+  byte key;
+  
+  if (changed == 0)
+  {
+    return;
+  }
+  
+  channel = pgm_read_byte(&division->channel);
+  base = pgm_read_byte(&division->baseNote) + (int8_t)pgm_read_byte(&division->transpose);
+  
+  while (changed != 0)
+  {
+    // the lowest set bit is the leftmost key that changed
+    key = __builtin_ctzll(changed);
+    changed &= changed - 1;
+    note = base + key;
+    
+    // a key transposed off either end of the MIDI range stays silent
+    if (note < 0 || note > 127)
+    {
+      continue;
+    }
+    theNote = note;
+    
+    // started sounding - send note on, at the velocity of the key struck
+    // with velocity sensing, at the division's own without
+    if ((sounding >> key) & 1)
+    {
+#if VELOCITY_SENSING
+      synth.noteOn(channel, theNote, strikeVelocity);
+#else
+      synth.noteOn(channel, theNote, pgm_read_byte(&division->velocity));
+#endif
+    }
+    // stopped sounding - send note off
+    else
+    {
+      synth.noteOff(channel, theNote);
+    }
+    
+    // show the note changes
+    if (DEBUG == 1)
+    {
+      Serial.print(((sounding >> key) & 1) ? " +" : " -");
+      Serial.print(theNote, DEC);
+    }
+  }
+  
+  return;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function guardNotes()
+// the stuck note guard, one division every GUARD_INTERVAL_MS
+// a key the couplers still hold but the scan reads up lost its release
+// on the way, it is let go and its notes end as usual; then any note the
+// synth has sounding on the division's channel that no key asks for lost
+// its note-off, and gets one; notes that came in on MIDI in are left to
+// the controller that sent them
+// the lost keys are found comparing whole keyboards as words, the notes
+// held are gathered a key sounding at a time, so the work only grows
+// with the keys down, and nothing is sent while everything is right
+//---------------------------------------------------------------------------------------------//
+void guardNotes()
+{
+  static unsigned long lastGuardTime;
+  const Division *division;
+  uint64_t down;
+  uint64_t lost;
+  uint64_t sounding;
+  byte oldSREG;
+  byte channel;
+  byte held[16];
+  int base;
+  int note;
+  byte i;
+  
+  if (millis() - lastGuardTime < GUARD_INTERVAL_MS)
+  {
+    return;
+  }
+  
+  // the scan keeps going in its interrupt; with changes still queued the
+  // couplers are behind the keys, so try again on the next loop()
+  oldSREG = SREG;
+  cli();
+  if (keyEvents.available() != 0)
+  {
+    SREG = oldSREG;
+    return;
+  }
+  down = scanner.keys(guardDivision);
+  SREG = oldSREG;
+  lastGuardTime = millis();
+  
+  // keys held for the couplers that are up on the keyboard
+  lost = coupling.keys(guardDivision) & ~down;
+  if (lost != 0)
+  {
+    while (lost != 0)
+    {
+      coupling.setKey(guardDivision, __builtin_ctzll(lost), 0);
+      lost &= lost - 1;
+    }
+    sendChanges();
+  }
+  
+  // the notes of every division on this channel, as the synth numbers them
+  channel = pgm_read_byte(&divisions[guardDivision].channel);
+  for (i = 0; i < 16; i++)
+  {
+    held[i] = 0;
+  }
+  for (i = 0; i < NUM_DIVISIONS; i++)
+  {
+    division = &divisions[i];
+    if (pgm_read_byte(&division->channel) != channel)
+    {
+      continue;
+    }
+    base = pgm_read_byte(&division->baseNote) + (int8_t)pgm_read_byte(&division->transpose);
+    // a set bit at a time, the lowest is the leftmost key sounding
+    sounding = coupling.sounding(i);
+    while (sounding != 0)
+    {
+      note = base + __builtin_ctzll(sounding);
+      sounding &= sounding - 1;
+      if (note >= 0 && note <= 127)
+      {
+        held[note >> 3] |= 1 << (note & 7);
+      }
+    }
+  }
+  synth.reconcileNotes(channel, held);
+  
+  guardDivision = (guardDivision + 1) % NUM_DIVISIONS;
+  
+  return;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function mergeMidiIn()
+// passes the messages an external controller sent to MIDI in on to the synth
+// the core's interrupt puts the bytes in a 64 byte buffer, 20 ms at full
+// speed; a message goes to the synth only once it is complete, so it never
+// gets mixed up with the notes of the keys
+// only the bytes that were there on entry are taken, so a busy MIDI in can
+// not keep loop() from the keys; a message waits at most one loop()
+// real time messages are left out: the synth has no use for clock and
+// transport, and passed on active sensing would make it cut the organ's
+// own notes whenever the controller is unplugged
+//---------------------------------------------------------------------------------------------//
+void mergeMidiIn()
+{
+  int count = Serial.available();
+  byte length;
+  
+  while (count-- > 0)
+  {
+    length = midiIn.parse(Serial.read());
+    if (length > 0 && midiIn.message()[0] < 0xf8)
+    {
+      synth.passThrough(midiIn.message(), length);
+    }
+  }
+  
+  return;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function getPots()
+// gets the state of the analog inputs connected to the potentiometers
+// marks the display fields of the values that changed
+// returns 1 if values changed, 0 if no change
+//---------------------------------------------------------------------------------------------//
+byte getPots()
+{
+  byte potChanged = 0;
+  
+  static long lastPotTime;
+  
+  // handle when millis counter overflows
+  if (millis() <  lastPotTime)
+  {
+    lastPotTime = millis();
+  }
+  
+  // the debounce period has not elapsed yet
+  // go back and handle other stuff in the main loop
+  if ((lastPotTime + POT_DEBOUNCE) > millis())
+  {
+    return 0;
+  }
+  
+  // otherwise DEBOUNCE has elapsed so reset the timer
+  lastPotTime = millis();
+  
+  // read the analog inputs and scale to 0 - 127
+  potVoiceCurrent = map(analogRead(I_POT_VOICE), 40, 960, 0, 127);
+  potVelocityCurrent = map(analogRead(I_POT_VELOCITY), 40, 960, 0, 127);
+  potCutoffCurrent = map(analogRead(I_POT_CUTOFF), 40, 960, 0, 127);
+  potResonanceCurrent = map(analogRead(I_POT_RESONANCE), 40, 960, 0, 127);
+  
+  // something crazy is going on with map
+  // values are going higher than 127
+  // cheap fix
+  if (potVoiceCurrent > 127)
+  {
+    potVoiceCurrent = 127;
+  }
+  if (potVelocityCurrent > 127)
+  {
+    potVelocityCurrent = 127;
+  }
+  if (potCutoffCurrent > 127)
+  {
+    potCutoffCurrent = 127;
+  }
+  if (potResonanceCurrent > 127)
+  {
+    potResonanceCurrent = 127;
+  }
+  
+  // see if the values have changed
+  // send the midi value if there is a change
+  if (potVoiceCurrent != potVoicePrevious)
+  {
+    potVoicePrevious = potVoiceCurrent;
+    potChanged = 1;
+    displayDirty |= FIELD_VOICE;
+    if (setUpper == 1)
+    {
+      upperVoice = potVoiceCurrent;
+      synth.programChange(upperBank * 127, upperChannel, upperVoice);
+    }
+    else
+    {
+      lowerVoice = potVoiceCurrent;
+      synth.programChange(lowerBank * 127, lowerChannel, lowerVoice);
+    }
+  }
+  if (potVelocityCurrent != potVelocityPrevious)
+  {
+    potVelocityPrevious = potVelocityCurrent;
+    potChanged = 1;
+    displayDirty |= FIELD_VELOCITY;
+    if (setUpper == 1)
+    {
+      upperVelocity = potVelocityCurrent;
+      // I decided to use volume not velocity so it could be changed while notes are held down
+      synth.setChannelVolume(upperChannel, upperVelocity);
+    }
+    else
+    {
+      lowerVelocity = potVelocityCurrent;
+      synth.setChannelVolume(lowerChannel, lowerVelocity);
+    }
+  }
+  if (potCutoffCurrent != potCutoffPrevious)
+  {
+    potCutoffPrevious = potCutoffCurrent;
+    potChanged = 1;
+    displayDirty |= FIELD_CUTOFF;
+    if (setUpper == 1)
+    {
+      upperCutoff = potCutoffCurrent;
+      synth.setTVFCutoff(upperChannel, upperCutoff);
+    }
+    else
+    {
+      lowerCutoff = potCutoffCurrent;
+      synth.setTVFCutoff(lowerChannel, lowerCutoff);
+    }
+  }
+  if (potResonanceCurrent != potResonancePrevious)
+  {
+    potResonancePrevious = potResonanceCurrent;
+    potChanged = 1;
+    displayDirty |= FIELD_RESONANCE;
+    if (setUpper == 1)
+    {
+      upperResonance = potResonanceCurrent;
+      synth.setTVFResonance(upperChannel, upperResonance);
+    }
+    else
+    {
+      lowerResonance = potResonanceCurrent;
+      synth.setTVFResonance(lowerChannel, lowerResonance);
+    }
+  }
+  
+  // return with potChanged status
+  return potChanged;
+}
+
+//---------------------------------------------------------------------------------------------//
+// function checkButtons()
+// gets the state of the buttons
+// returns 1 if values changed, 0 if no change
+//---------------------------------------------------------------------------------------------//
+byte checkButtons()
+{
+  byte modeState;
+  
+  // upper/lower pressed
+  if (buttonRank.update())
+  {
+    if (buttonRank.fallingEdge())
+    {
+      // toggle upper and lower
+      if (setUpper == 1)
+      {
+        setUpper = 0;
+      }
+      else
+      {
+        setUpper = 1;
+      }
+      return 1;
+    }
+  }
+  
+  // bank (set) pressed
+  if (buttonMode.update())
+  {
+    // get the button state
+    modeState = buttonMode.read();
+    if (modeState == LOW);
+    {
+      // if it has been low for more than 1 sec write the settingd to eeprom
+      if (buttonMode.duration() > 1000)
+      {
+        // test first so we dont wear out the eeprom
+        if (DEBUG == 1)
+        {
+          Serial.println("writing values to eeprom");
+        }
+      }
+      else
+      {
+        if (setUpper == 1)
+        {
+          if (upperBank == 1)
+          {
+            upperBank = 0;
+          }
+          else
+          {
+            upperBank = 1;
+          }
+          synth.programChange(upperBank * 127, upperChannel, upperVoice);
+        }
+        else
+        {
+          if (lowerBank == 1)
+          {
+            lowerBank = 0;
+          }
+          else
+          {
+            lowerBank = 1;
+          }
+          synth.programChange(lowerBank * 127, lowerChannel, lowerVoice);
+        }
+      }
+    }
+    return 1;
+  }
+  
+  // otherwise nothing pressed
+  return 0;
+}     
+          
+//---------------------------------------------------------------------------------------------//
+// function updateDisplay()
+// updated the display
+// draws the fields marked in displayDirty, at most every DISPLAY_FRAME_MS,
+// so a pot sweep only shows the value the pot has when the frame is drawn
+// only draws into the vfd's frame in RAM, vfd.update() in loop() sends
+// the characters that changed
+// nothing is drawn until the start up screen has been up for SPLASH_MS
+// the fields and where they go are in statusFields, the numbers come
+// ready padded from paddedNumbers, no division or print() for them
+//---------------------------------------------------------------------------------------------//
+void updateDisplay()
+{
+  static unsigned long lastFrameTime;
+  static byte splash = 1;
+  byte fields;
+  
+  // take the start up screen down once its time is up
+  if (splash == 1)
+  {
+    if (millis() < SPLASH_MS)
+    {
+      return;
+    }
+    splash = 0;
+    vfd.clear();
+    // from here on the display is drawn in RAM and loop() sends what
+    // changed, a command or a character at a time, without waiting on it
+    vfd.setBuffered(1);
+  }
+  
+  // nothing changed, or the last frame was drawn too recently
+  if (displayDirty == 0 || millis() - lastFrameTime < DISPLAY_FRAME_MS)
+  {
+    return;
+  }
+  lastFrameTime = millis();
+  fields = displayDirty;
+  displayDirty = 0;
+  
+  // each field marked, its label and then its value from the padded numbers
+  for (byte i = 0; i < sizeof(statusFields) / sizeof(statusFields[0]); i++)
+  {
+    const StatusField *status = &statusFields[i];
+    const char *text;
+    byte *setting;
+    byte length;
+    char c;
+    
+    if ((fields & pgm_read_byte(&status->field)) == 0)
+    {
+      continue;
+    }
+    vfd.setCursor(pgm_read_byte(&status->column), pgm_read_byte(&status->row));
+    text = status->label;
+    while ((c = pgm_read_byte(text++)) != 0)
+    {
+      vfd.write(c);
+    }
+    setting = (byte *)pgm_read_ptr(&status->settings[setUpper == 1]);
+    if (setting == NULL)
+    {
+      // show upper or lower setting
+      vfd.write(setUpper == 1 ? 'U' : 'L');
+      continue;
+    }
+    // the settings are MIDI data bytes, 0 to 127
+    length = pgm_read_byte(&status->width);
+    text = paddedNumbers[*setting & 0x7f] + 3 - length;
+    while (length-- > 0)
+    {
+      vfd.write(pgm_read_byte(text++));
+    }
+  }
+  // that's it
+  return;
+}